@@ -0,0 +1,351 @@
+/**
+ * File: main.c
+ * Description: This is a benchmark of the genetic algorithm
+ *              on synthetic fitness landscapes, run without
+ *              the simulator.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+// The operators of a generation are timed one by one, which the public header does not offer, so
+// the benchmark is built against the internal one like the library itself.
+#include "../src/evlearn_ctx.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Genes bred per configuration when timing, so that every configuration takes a similar time.
+#define GENES_BUDGET 50000000.0
+#define MIN_GENERATIONS 5
+#define MAX_GENERATIONS 200
+
+// Generations allowed to reach the target fitness.
+#define TARGET_GENERATIONS 500
+
+#define MUTATION_PROBABILITY 0.1
+
+// Threads evaluating the episodes of the headless simulator.
+#define ROAD_THREADS 4
+
+#define PI 3.14159265358979323846
+
+// LANDSCAPES -------------------------------------------------------------------------------------
+
+// The landscapes are minimization problems with the optimum 0. The algorithm expects a positive
+// fitness, as the mutation scales with the fitness over the best one, so it is 1 / (1 + f).
+
+static double sphere(const evlearn_gene* x, size_t rows, size_t cols, void* user_data)
+{
+    double sum = 0;
+
+    (void) user_data;
+    for (size_t i = 0; i < rows * cols; i++) {
+        sum += x[i] * x[i];
+    }
+    return 1 / (1 + sum);
+}
+
+static double rastrigin(const evlearn_gene* x, size_t rows, size_t cols, void* user_data)
+{
+    size_t n = rows * cols;
+    double sum = 10.0 * n;
+
+    (void) user_data;
+    for (size_t i = 0; i < n; i++) {
+        sum += x[i] * x[i] - 10.0 * cos(2 * PI * x[i]);
+    }
+    return 1 / (1 + sum);
+}
+
+static double rosenbrock(const evlearn_gene* x, size_t rows, size_t cols, void* user_data)
+{
+    double sum = 0;
+
+    (void) user_data;
+    for (size_t i = 0; i + 1 < rows * cols; i++) {
+        double a = x[i + 1] - x[i] * x[i];
+        double b = 1 - x[i];
+        sum += 100 * a * a + b * b;
+    }
+    return 1 / (1 + sum);
+}
+
+typedef struct landscape {
+    const char* name;
+    evlearn_fitness_fn fitness_fn;
+} landscape;
+
+static const landscape landscapes[] = {
+    {"sphere", sphere},
+    {"rastrigin", rastrigin},
+    {"rosenbrock", rosenbrock}
+};
+
+// SWEEP ------------------------------------------------------------------------------------------
+
+typedef struct shape {
+    size_t rows;
+    size_t cols;
+} shape;
+
+// The first one is the chromosome of the truck controller.
+static const shape shapes[] = {{6, 9}, {16, 32}, {64, 64}};
+static const size_t populations[] = {20, 200, 2000};
+static const size_t tournaments[] = {2, 6};
+
+static const shape quick_shapes[] = {{6, 9}, {16, 32}};
+static const size_t quick_populations[] = {20, 200};
+static const size_t quick_tournaments[] = {6};
+
+#define COUNT(array) (sizeof(array) / sizeof(array[0]))
+
+/**
+ * Time spent in every operator and in the evaluation, in nanoseconds.
+ */
+typedef struct timing {
+    double select;
+    double cross;
+    double mutate;
+    double evaluate;
+    size_t generations;
+} timing;
+
+static double now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * \brief Runs one generation like compute_next_generation() does,
+ * timing every operator.
+ */
+static void timed_generation(evlearn_ctx* ctx, size_t k, timing* t)
+{
+    double start = 0;
+
+    begin_generation(ctx);
+    start = now_ns();
+    select_population(ctx, k);
+    t->select += now_ns() - start;
+
+    start = now_ns();
+    cross_population(ctx);
+    t->cross += now_ns() - start;
+
+    start = now_ns();
+    mutate_population(ctx, MUTATION_PROBABILITY);
+    t->mutate += now_ns() - start;
+    end_generation(ctx);
+
+    t->generations++;
+}
+
+/**
+ * \brief Runs generations until the function value of the best
+ * individual is a tenth of the one of the best initial individual.
+ *
+ * \return the generations needed, 0 if it was not reached
+ */
+static size_t generations_to_target(
+    const landscape* l, size_t population, const shape* s, size_t k)
+{
+    evlearn_ctx* ctx = create_ctx();
+    double target = 0;
+    size_t generations = 0;
+
+    if (ctx == NULL || init(ctx, population, s->rows, s->cols, NULL, NULL)) {
+        destroy_ctx(ctx);
+        return 0;
+    }
+    evaluate(ctx, l->fitness_fn, NULL, 1);
+    // fitness = 1 / (1 + f), so f / 10 is reached at this fitness.
+    target = 1 / (1 + (1 / get_best(ctx).fitness - 1) * 0.1);
+
+    for (size_t g = 1; g <= TARGET_GENERATIONS && generations == 0; g++) {
+        compute_next_generation(ctx, k, MUTATION_PROBABILITY);
+        evaluate(ctx, l->fitness_fn, NULL, 1);
+        if (get_best(ctx).fitness >= target) {
+            generations = g;
+        }
+    }
+
+    destroy_ctx(ctx);
+    return generations;
+}
+
+/**
+ * \brief Benchmarks one configuration and prints a row of the table
+ * but its last column.
+ */
+static void run(const landscape* l, size_t population, const shape* s, size_t k, int target)
+{
+    evlearn_ctx* ctx = create_ctx();
+    double genes = (double) population * s->rows * s->cols;
+    size_t generations = (size_t) (GENES_BUDGET / genes);
+    timing t = {0};
+    double start = 0;
+    double breed = 0;
+    size_t to_target = 0;
+
+    if (generations < MIN_GENERATIONS) {
+        generations = MIN_GENERATIONS;
+    }
+    if (generations > MAX_GENERATIONS) {
+        generations = MAX_GENERATIONS;
+    }
+    if (ctx == NULL || init(ctx, population, s->rows, s->cols, NULL, NULL)) {
+        fprintf(stderr, "can't initialize %zu x %zu x %zu\n", population, s->rows, s->cols);
+        destroy_ctx(ctx);
+        return;
+    }
+
+    for (size_t g = 0; g < generations; g++) {
+        start = now_ns();
+        evaluate(ctx, l->fitness_fn, NULL, 1);
+        t.evaluate += now_ns() - start;
+        timed_generation(ctx, k, &t);
+    }
+    destroy_ctx(ctx);
+
+    if (target) {
+        to_target = generations_to_target(l, population, s, k);
+    }
+
+    breed = t.select + t.cross + t.mutate;
+    printf("%-10s %6zu %3zux%-3zu %3zu %12.1f %8.2f %8.2f %8.2f ",
+        l->name, population, s->rows, s->cols, k,
+        t.generations / (breed * 1e-9),
+        t.select / t.generations / genes,
+        t.cross / t.generations / genes,
+        t.mutate / t.generations / genes);
+    if (!target) {
+        printf("%10s ", "-");
+    }
+    else if (to_target == 0) {
+        printf("%5s%5d ", ">", TARGET_GENERATIONS);
+    }
+    else {
+        printf("%10zu ", to_target);
+    }
+    fflush(stdout);
+}
+
+/**
+ * \brief Runs one configuration in a child process, so that the peak
+ * resident memory printed at the end of its row is its own and not
+ * the one of every configuration so far.
+ */
+static void run_child(const landscape* l, size_t population, const shape* s, size_t k, int target)
+{
+    struct rusage usage;
+    int status = 0;
+    pid_t pid = 0;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "can't fork the configuration\n");
+        return;
+    }
+    if (pid == 0) {
+        run(l, population, s, k, target);
+        _exit(0);
+    }
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status)) {
+        printf("%10s\n", "failed");
+    }
+    else {
+        printf("%10ld\n", usage.ru_maxrss);
+    }
+    fflush(stdout);
+}
+
+/**
+ * \brief Trains the truck controller on the headless simulator and
+ * prints the episodes per second of the evaluation and the best
+ * fitness reached.
+ */
+static void run_road(size_t population, size_t generations)
+{
+    evlearn_sim_config config;
+    evlearn_sim* sim = NULL;
+    evlearn_ctx* ctx = create_ctx();
+    double start = 0;
+    double elapsed = 0;
+
+    sim_default_config(&config);
+    sim = create_sim(&config);
+    if (sim == NULL || ctx == NULL ||
+        init(ctx, population, shapes[0].rows, config.bundles, NULL, NULL)) {
+        fprintf(stderr, "can't initialize the road benchmark\n");
+        destroy_sim(sim);
+        destroy_ctx(ctx);
+        return;
+    }
+
+    for (size_t g = 0; g < generations; g++) {
+        start = now_ns();
+        evaluate(ctx, sim_fitness, sim, ROAD_THREADS);
+        elapsed += now_ns() - start;
+        if (g + 1 < generations) {
+            compute_next_generation(ctx, 6, MUTATION_PROBABILITY);
+        }
+    }
+    printf("%-10s %6zu %3zux%-3zu %4zu generations %10.1f episodes/s %12.1f best fitness\n",
+        "road", population, shapes[0].rows, config.bundles, generations,
+        population * generations / (elapsed * 1e-9), get_best(ctx).fitness);
+
+    destroy_ctx(ctx);
+    destroy_sim(sim);
+}
+
+/**
+ * Usage: evlearn_bench [--quick]
+ *
+ * For every landscape, population size, chromosome shape and
+ * tournament size it prints the generations per second of the
+ * operators (the evaluation is not counted), the nanoseconds per
+ * gene of the selection, crossover and mutation, the generations
+ * needed to reach the target fitness (only for the controller shape,
+ * it is slow for the big ones) and the peak resident memory of the
+ * configuration, which runs in a process of its own. Then it trains
+ * the controller on the headless simulator. --quick runs a smaller
+ * sweep.
+ */
+int main(int argc, char** argv)
+{
+    int quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    const shape* s = quick ? quick_shapes : shapes;
+    const size_t* p = quick ? quick_populations : populations;
+    const size_t* k = quick ? quick_tournaments : tournaments;
+    size_t s_count = quick ? COUNT(quick_shapes) : COUNT(shapes);
+    size_t p_count = quick ? COUNT(quick_populations) : COUNT(populations);
+    size_t k_count = quick ? COUNT(quick_tournaments) : COUNT(tournaments);
+
+    printf("%-10s %6s %7s %3s %12s %8s %8s %8s %10s %10s\n",
+        "landscape", "pop", "shape", "k", "gen/s", "sel ns/g", "crs ns/g", "mut ns/g",
+        "to target", "rss KB");
+
+    for (size_t l = 0; l < COUNT(landscapes); l++) {
+        for (size_t i = 0; i < s_count; i++) {
+            for (size_t j = 0; j < p_count; j++) {
+                for (size_t m = 0; m < k_count; m++) {
+                    run_child(&landscapes[l], p[j], &s[i], k[m], i == 0);
+                }
+            }
+        }
+    }
+    run_road(quick ? 50 : 200, quick ? 10 : 50);
+
+    return 0;
+}
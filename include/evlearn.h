@@ -8,22 +8,63 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 
 #pragma once
 
-#define MAX_CHROM_ARRAY_SIZE 100
-#define MAX_CHROM_SIZE 100
-#define MAX_POPULATION_SIZE 100
+#ifdef __cplusplus
+extern "C" {
+#endif
 
+// Alignment in bytes of every chromosome inside the population arena.
+#define EVLEARN_ALIGNMENT 64
+
+// Type of the genes and their bounds. The library is built with float genes if EVLEARN_FLOAT_GENES
+// is defined, which halves the memory of the population and doubles the genes per SIMD register.
+#ifdef EVLEARN_FLOAT_GENES
+typedef float evlearn_gene;
+#else
+typedef double evlearn_gene;
+#endif
+
+// The chromosome points into the population arena allocated by init(). It holds
+// chrom_array_size rows of chrom_size genes each, so the gene j of the row i is
+// chromosome[i * chrom_size + j].
 typedef struct Individual {
     int s_count;
     double fitness;
 
-    double chromosome[MAX_CHROM_ARRAY_SIZE][MAX_CHROM_SIZE];
+    evlearn_gene* chromosome;
 } Individual;
 
+// State of a xoshiro256** random number generator. Every context owns one, seeded from the
+// context seed, and the operators seed their own per (seed, generation, individual).
+typedef struct evlearn_rng {
+    uint64_t s[4];
+} evlearn_rng;
+
+// State of one run of the algorithm. It is opaque, create it with create_ctx() and free it
+// with destroy_ctx(). Different contexts share nothing, so they can be used from different
+// threads, but a single context must not be used by two threads at the same time.
+typedef struct evlearn_ctx evlearn_ctx;
+
+// Fitness function used by evaluate(). It gets the chromosome of one individual and
+// returns its fitness. It is called from several threads at the same time.
+typedef double (*evlearn_fitness_fn)(
+    const evlearn_gene* chromosome, 
+    size_t chrom_array_size, 
+    size_t chrom_size, 
+    void* user_data);
+
+// Creates a context. It returns NULL if there is no memory.
+evlearn_ctx* create_ctx();
+
+// Frees the context and everything allocated for it.
+void destroy_ctx(evlearn_ctx* ctx);
+
 // Initializes the algorithm. It is mandatory.
 int init(
+    evlearn_ctx* ctx,
     size_t population_size, 
     size_t chrom_array_size, 
     size_t chrom_size, 
@@ -32,19 +73,600 @@ int init(
 
 // Main function of the algorithm.
 void 
-compute_next_generation(size_t tournament_size, double mutation_probability);
+compute_next_generation(evlearn_ctx* ctx, size_t tournament_size, double mutation_probability);
+
+// Selection methods. Tournaments take tournament_size contestants, distinct or drawn with
+// replacement. Rank selection gives each individual a weight linear in its rank, SUS a weight
+// proportional to its fitness over the worst one, and both sample with stochastic universal sampling.
+typedef enum evlearn_selection {
+    EVLEARN_SELECT_TOURNAMENT,
+    EVLEARN_SELECT_TOURNAMENT_REPLACEMENT,
+    EVLEARN_SELECT_RANK,
+    EVLEARN_SELECT_SUS
+} evlearn_selection;
+
+// Chooses the selection method, tournament by default. rank_pressure, within {1, 2}, is the
+// expected number of selections of the best individual in rank selection.
+int set_selection(evlearn_ctx* ctx, evlearn_selection selection, double rank_pressure);
 
 // Gets the best individual so far.
-Individual get_best();
+Individual get_best(const evlearn_ctx* ctx);
+
+// Gets the chromosome of the best individual without copying it. It is kept up to date as the
+// fitness is told, so it costs nothing to call it every control step.
+const evlearn_gene* get_best_chromosome(const evlearn_ctx* ctx);
+
+// Stores in top pointers to the k best individuals, from the best to the worst, and returns how
+// many were stored. They point into the population and are valid until the next generation.
+size_t get_top(evlearn_ctx* ctx, const Individual** top, size_t k);
+
+// Gets the median fitness of the population.
+double get_median_fitness(evlearn_ctx* ctx);
+
+// Frees the memory allocated by init(), the context can be initialized again.
+void release(evlearn_ctx* ctx);
+
+// Sets the seed of the run. Two runs with the same seed and sizes give the same results. It
+// should be called before init() so that the initial population depends on it as well.
+void set_seed(evlearn_ctx* ctx, uint64_t seed);
+
+// ENGINES ////////////////////////////////////////////////////////////////////////////////////////
+
+// Algorithms breeding the generations: the genetic algorithm, differential evolution DE/rand/1/bin
+// and the covariance matrix adaptation evolution strategy CMA-ES.
+typedef enum evlearn_engine {
+    EVLEARN_ENGINE_GA,
+    EVLEARN_ENGINE_DE,
+    EVLEARN_ENGINE_CMAES
+} evlearn_engine;
+
+// Chooses the engine of compute_next_generation(), the genetic algorithm by default, starting from
+// the current population. step is F for DE, within (0, 2], and the initial step size of CMA-ES as a
+// fraction of the bounds, crossover is CR for DE. The population is what the engine asks to
+// evaluate and its best individual is kept, so evaluate(), ask / tell, the farm and checkpoints work
+// the same. It has to be called after init(), which goes back to the genetic algorithm, and it
+// needs at least 4 individuals.
+int set_engine(evlearn_ctx* ctx, evlearn_engine engine, double step, double crossover);
+
+// Gets the engine of compute_next_generation().
+evlearn_engine get_engine(const evlearn_ctx* ctx);
+
+// ASK / TELL /////////////////////////////////////////////////////////////////////////////////////
+
+// Hands out up to max_count individuals of the current generation not handed out yet, skipping
+// the ones found in the fitness cache. Their indices are stored in indices and the number of them
+// is returned.
+size_t ask(evlearn_ctx* ctx, size_t* indices, size_t max_count);
+
+// Gets the chromosome of the individual at index.
+const evlearn_gene* get_chromosome(const evlearn_ctx* ctx, size_t index);
+
+// Reports the fitness of count individuals previously handed out by ask().
+void tell(evlearn_ctx* ctx, const size_t* indices, const double* fitness, size_t count);
+
+// Asks for every pending individual, evaluates them with fitness_fn on n_threads threads and
+// tells the results.
+int evaluate(evlearn_ctx* ctx, evlearn_fitness_fn fitness_fn, void* user_data, size_t n_threads);
+
+// STEADY STATE ///////////////////////////////////////////////////////////////////////////////////
+
+// Individuals replaced by the offspring in steady state mode: the worst one, or the loser of a
+// tournament of tournament_size contestants. The best individual is never replaced.
+typedef enum evlearn_replacement {
+    EVLEARN_REPLACE_WORST,
+    EVLEARN_REPLACE_TOURNAMENT
+} evlearn_replacement;
+
+// Starts the steady state mode, where every evaluation told replaces an individual at once instead
+// of waiting for the whole generation. Offspring are bred with tournament selection, uniform
+// crossover and uniform mutation scaled by the fitness of the parents.
+int start_steady_state(
+    evlearn_ctx* ctx,
+    size_t tournament_size,
+    double mutation_probability,
+    evlearn_replacement replacement);
+
+// Ends the steady state mode.
+void stop_steady_state(evlearn_ctx* ctx);
+
+// Copies to chromosome the genes of the next individual to evaluate, an individual of the population
+// not evaluated yet or a new offspring, and stores its ticket. It is safe to call it from several
+// threads at the same time.
+int steady_ask(evlearn_ctx* ctx, evlearn_gene* chromosome, uint64_t* ticket);
+
+// Reports the fitness of the individual of a ticket, given back with its genes. It is safe to call
+// it from several threads at the same time.
+int steady_tell(evlearn_ctx* ctx, uint64_t ticket, const evlearn_gene* chromosome, double fitness);
+
+// Runs evaluations of the steady state mode with fitness_fn on n_threads threads, every thread
+// asking for a new individual as soon as it tells the last one.
+int evaluate_steady(
+    evlearn_ctx* ctx,
+    evlearn_fitness_fn fitness_fn,
+    void* user_data,
+    size_t n_threads,
+    size_t evaluations);
+
+// RACING /////////////////////////////////////////////////////////////////////////////////////////
+
+// Counters of the racing. completed episodes ran every checkpoint and aborted ones were stopped,
+// skipped counts the checkpoints they did not run, partials the partial fitness values reported
+// and elite the trajectories compared with.
+typedef struct evlearn_racing_stats {
+    uint64_t completed;
+    uint64_t aborted;
+    uint64_t skipped;
+    uint64_t partials;
+    size_t elite;
+} evlearn_racing_stats;
+
+// Races every episode against the distinct trajectories of the elite best individuals that
+// completed theirs so far. An individual is stopped at a checkpoint if its partial fitness is below
+// the lowest one of the elite there by more than margin times it, so elite sets how strict it is:
+// about the number of individuals selection keeps. It has to be called after init(), 0
+// checkpoints stops racing.
+int set_racing(evlearn_ctx* ctx, size_t checkpoints, size_t elite, double margin);
+
+// Reports the partial fitness of the individual of chromosome at a checkpoint of its episode, in
+// order. It returns 1 if the episode has to stop, then estimate is the fitness to tell or return
+// from the fitness function, a conservative guess. It is safe to call it from the fitness function.
+// Only the chromosomes of the population are raced, as given by evaluate() and get_chromosome(),
+// not the copies of the steady state mode or the farm: it returns -1 for them, and for a checkpoint
+// out of order.
+int race(
+    evlearn_ctx* ctx,
+    const evlearn_gene* chromosome,
+    size_t checkpoint,
+    double partial,
+    double* estimate);
+
+// Gets the counters of the racing.
+evlearn_racing_stats get_racing_stats(const evlearn_ctx* ctx);
+
+// EVALUATOR FARM /////////////////////////////////////////////////////////////////////////////////
+
+// Counters of the evaluator farm. workers is the number connected, lost the ones dropped because
+// they closed the connection, broke the protocol or timed out, requeued the individuals they had
+// that were handed to another worker and batches the messages of work sent.
+typedef struct evlearn_farm_stats {
+    size_t workers;
+    uint64_t lost;
+    uint64_t requeued;
+    uint64_t batches;
+} evlearn_farm_stats;
+
+// Makes the context the coordinator of a farm of worker processes connecting to a Unix socket at
+// socket_path. Each message sends batch_size individuals, a worker has timeout seconds to answer,
+// a day at most.
+int open_farm(evlearn_ctx* ctx, const char* socket_path, size_t batch_size, double timeout);
+
+// Disconnects the workers and removes the socket.
+void close_farm(evlearn_ctx* ctx);
+
+// Evaluates every individual not handed out yet by ask() on the workers and tells the results. The
+// individuals of workers that die or time out are evaluated by other ones. It fails if there are no
+// workers for timeout seconds, and the individuals are handed out again by the next call.
+int evaluate_farm(evlearn_ctx* ctx);
+
+// Gets the counters of the farm.
+evlearn_farm_stats get_farm_stats(const evlearn_ctx* ctx);
+
+// Runs a worker process, evaluating with fitness_fn the chromosomes sent by the farm at
+// socket_path. It returns 0 when the farm is closed and 1 on error.
+int run_worker(const char* socket_path, evlearn_fitness_fn fitness_fn, void* user_data);
+
+// ISLANDS ////////////////////////////////////////////////////////////////////////////////////////
+
+// Where the migrants of an island go, the next island of a ring or every other one.
+typedef enum evlearn_topology {
+    EVLEARN_TOPOLOGY_RING,
+    EVLEARN_TOPOLOGY_FULL
+} evlearn_topology;
+
+// Subpopulations, each one a context of its own evolving on its own thread, that exchange their
+// best individuals every few generations. Create it with create_islands() and free it with
+// destroy_islands().
+typedef struct evlearn_islands evlearn_islands;
+
+// Creates n_islands contexts initialized like init(), the island i with the seed seed + i. The
+// migration is every 5 generations, of the 2 best individuals, over a ring. It returns NULL on
+// error.
+evlearn_islands* create_islands(
+    size_t n_islands,
+    size_t population_size,
+    size_t chrom_array_size,
+    size_t chrom_size,
+    double** min_max_matrix,
+    uint64_t seed);
+
+// Frees the islands and their contexts.
+void destroy_islands(evlearn_islands* islands);
+
+// Every interval generations each island sends its migrants best individuals, which replace the
+// worst ones where they arrive. With a full topology an island takes the best migrants sent to it.
+// 0 migrants or interval disables the migration, migrants must be less than the population size.
+int set_migration(
+    evlearn_islands* islands, size_t interval, size_t migrants, evlearn_topology topology);
+
+// Evaluates and evolves every island for generations generations on its own thread, fitness_fn
+// being called from all of them at the same time. The results only depend on the seeds. Migrants
+// are only taken from islands at the same generation, an island stepped on its own is skipped.
+int evolve_islands(
+    evlearn_islands* islands,
+    evlearn_fitness_fn fitness_fn,
+    void* user_data,
+    size_t generations,
+    size_t tournament_size,
+    double mutation_probability);
+
+// Gets the context of an island, to read or configure it between calls to evolve_islands(). It
+// returns NULL if there is no such island.
+evlearn_ctx* get_island(evlearn_islands* islands, size_t index);
+
+// Gets the island with the best individual.
+size_t get_best_island(const evlearn_islands* islands);
+
+// CHECKPOINTS ////////////////////////////////////////////////////////////////////////////////////
+
+// Version of the binary checkpoint format.
+#define EVLEARN_CHECKPOINT_VERSION 3
+
+// Formats of the genes in a checkpoint. FIXED16 stores every gene in 16 bits scaled to its
+// {min, max}, a quarter of a double, with an error of at most (max - min) / 131070.
+typedef enum evlearn_gene_format {
+    EVLEARN_GENES_DOUBLE,
+    EVLEARN_GENES_FLOAT,
+    EVLEARN_GENES_FIXED16
+} evlearn_gene_format;
+
+// Writes the sizes, generation, random state, bounds, chromosomes and fitness of the population
+// and the state of the engine to file_path. It is written to a temporary file that is renamed, so it is never left half done.
+int save_checkpoint(const evlearn_ctx* ctx, const char* file_path);
+
+// Loads a checkpoint written by save_checkpoint(). The context takes the sizes and bounds stored in
+// it. If the file is not a valid checkpoint it returns 1 and the context is left as it was.
+int load_checkpoint(evlearn_ctx* ctx, const char* file_path);
+
+// Chooses the format of the genes written by save_checkpoint(), by default the one of
+// evlearn_gene. A checkpoint in any format can be loaded, the genes are converted.
+int set_checkpoint_format(evlearn_ctx* ctx, evlearn_gene_format format);
+
+// TELEMETRY //////////////////////////////////////////////////////////////////////////////////////
+
+// Version of the binary telemetry format.
+#define EVLEARN_TELEMETRY_VERSION 2
+
+// Record appended to the telemetry for every generation. The fitness values are the ones of the
+// evaluated generation, mutations the number of genes mutated breeding the next one. diversity is
+// the standard deviation of every gene over the population divided by the range of its bounds,
+// diversity_mean and diversity_min are the mean and the minimum of it over the genes. dropped is
+// the number of records lost so far because the writer thread fell behind.
+typedef struct evlearn_record {
+    uint64_t generation;
+    double best_fitness;
+    double mean_fitness;
+    double median_fitness;
+    double worst_fitness;
+    uint64_t best_index;
+    uint64_t mutations;
+    double diversity_mean;
+    double diversity_min;
+    uint64_t dropped;
+} evlearn_record;
+
+// Starts appending a record per generation to binary_path and / or csv_path, either can be NULL.
+// The statistics are computed and written by a background thread, so compute_next_generation() only
+// sums up the fitness and hands it the evaluated chromosomes without copying them. It never waits
+// for the files: a record that finds the thread too far behind is dropped and counted.
+int open_telemetry(evlearn_ctx* ctx, const char* binary_path, const char* csv_path);
+
+// Writes the pending records and closes the telemetry files. It returns 1 if any record was lost.
+int close_telemetry(evlearn_ctx* ctx);
+
+// FITNESS CACHE //////////////////////////////////////////////////////////////////////////////////
+
+// Counters of the fitness cache. hits / (hits + misses) is the fraction of evaluations saved.
+typedef struct evlearn_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t size;
+    size_t capacity;
+} evlearn_cache_stats;
+
+// Keeps the fitness of up to capacity chromosomes, evicting the least recently used ones. ask()
+// does not hand out individuals found in it, they get the cached fitness. 0 disables it.
+int set_cache(evlearn_ctx* ctx, size_t capacity);
+
+// Gets the counters of the fitness cache.
+evlearn_cache_stats get_cache_stats(const evlearn_ctx* ctx);
+
+// SURROGATE //////////////////////////////////////////////////////////////////////////////////////
+
+// Counters of the surrogate. size is the number of chromosomes archived, predictions the fitness
+// values predicted, distances the distances computed building and searching the index, rebuilds
+// the times it was built and screened the candidates bred but never evaluated.
+typedef struct evlearn_surrogate_stats {
+    size_t size;
+    size_t capacity;
+    uint64_t predictions;
+    uint64_t distances;
+    uint64_t rebuilds;
+    uint64_t screened;
+} evlearn_surrogate_stats;
+
+// Archives up to capacity evaluated chromosomes, dropping the oldest, to predict the fitness of
+// new ones from their neighbours nearest ones. With an oversampling over 1,
+// compute_next_generation() breeds that many candidates for every individual and keeps the best
+// predicted one, so only it is evaluated. It has to be called after init(), 0 capacity disables it.
+int set_surrogate(evlearn_ctx* ctx, size_t capacity, size_t neighbours, size_t oversampling);
+
+// Predicts the fitness of a chromosome from its nearest archived ones, weighted by the inverse of
+// their distance. It returns 1 if there are fewer archived chromosomes than neighbours.
+int predict_fitness(evlearn_ctx* ctx, const evlearn_gene* chromosome, double* fitness);
+
+// Gets the counters of the surrogate.
+evlearn_surrogate_stats get_surrogate_stats(const evlearn_ctx* ctx);
+
+// INSTRUMENTATION ////////////////////////////////////////////////////////////////////////////////
+
+// Timed operations. rank is sorting the population for get_top() and get_median_fitness(), io is
+// writing and reading checkpoints and text files, screen breeding with the surrogate and sample
+// breeding with DE or CMA-ES.
+typedef enum evlearn_timer {
+    EVLEARN_TIMER_SELECT,
+    EVLEARN_TIMER_CROSS,
+    EVLEARN_TIMER_MUTATE,
+    EVLEARN_TIMER_RANK,
+    EVLEARN_TIMER_EVALUATE,
+    EVLEARN_TIMER_IO,
+    EVLEARN_TIMER_SCREEN,
+    EVLEARN_TIMER_SAMPLE,
+    EVLEARN_TIMERS
+} evlearn_timer;
+
+// Timers and counters of a context. ticks are CPU time stamp counter ticks, ns_per_tick converts
+// them. rng_draws counts 64 bit words drawn, selection_draws the contestants or pointers drawn by
+// the selection and best_scans the times the whole population was scanned for the best individual.
+// They are only collected if the library is built with EVLEARN_STATS, otherwise they are all 0.
+typedef struct evlearn_stats {
+    uint64_t ticks[EVLEARN_TIMERS];
+    uint64_t calls[EVLEARN_TIMERS];
+    double ns_per_tick;
+    uint64_t generations;
+    uint64_t rng_draws;
+    uint64_t genes_mutated;
+    uint64_t selection_draws;
+    uint64_t best_scans;
+    uint64_t bytes_written;
+} evlearn_stats;
+
+// Gets the timers and counters collected since the context was created or reset_stats() was called.
+evlearn_stats get_stats(const evlearn_ctx* ctx);
+
+// Sets the timers and counters to 0.
+void reset_stats(evlearn_ctx* ctx);
+
+// Writes every timed operation to file_path as a Chrome trace event. It returns 1 if the library
+// is built without EVLEARN_STATS.
+int open_trace(evlearn_ctx* ctx, const char* file_path);
+
+// Finishes the trace and closes it.
+int close_trace(evlearn_ctx* ctx);
+
+// INFERENCE //////////////////////////////////////////////////////////////////////////////////////
+
+// Activations applied to the outputs of evlearn_apply().
+typedef enum evlearn_activation {
+    EVLEARN_ACTIVATION_NONE,
+    EVLEARN_ACTIVATION_TANH,
+    EVLEARN_ACTIVATION_RELU,
+    EVLEARN_ACTIVATION_SIGMOID
+} evlearn_activation;
+
+// Computes the outputs of a chromosome used as a weight matrix of rows x cols genes, outputs[i] =
+// the dot product of the row i and the cols inputs. Then the activation[i] of the row is applied
+// and the output is truncated to {min[i], max[i]}. activation, min and max can be NULL.
+void evlearn_apply(
+    const evlearn_gene* chromosome,
+    size_t rows,
+    size_t cols,
+    const double* inputs,
+    double* outputs,
+    const evlearn_activation* activation,
+    const double* min,
+    const double* max);
+
+// evlearn_apply() for a batch of individuals and n_frames frames of cols inputs each. The frames
+// of the individual i start at frames + i * individual_stride, 0 to share the same frames. The
+// outputs of the frame f of the individual i are outputs + (i * n_frames + f) * rows. Each output
+// is exactly the one of evlearn_apply().
+void evlearn_apply_batch(
+    const evlearn_gene* const* chromosomes,
+    size_t individuals,
+    size_t rows,
+    size_t cols,
+    const double* frames,
+    size_t n_frames,
+    size_t individual_stride,
+    double* outputs,
+    const evlearn_activation* activation,
+    const double* min,
+    const double* max);
+
+// SIMULATOR //////////////////////////////////////////////////////////////////////////////////////
+
+// Most LiDAR bundles of the simulator.
+#define EVLEARN_SIM_MAX_BUNDLES 256
+
+// Headless 2D simulator of the truck on a road with barriers, to train and test without Webots. It
+// is deterministic and read only once created, so it can be shared by the threads of evaluate().
+typedef struct evlearn_sim evlearn_sim;
+
+// Road, LiDAR and truck of the simulator, in metres, radians and seconds. The LiDAR has bundles
+// bundles over fov centered ahead, each the nearest hit of rays_per_bundle rays. The road is
+// road_length long with curvatures up to max_curvature, built from seed.
+typedef struct evlearn_sim_config {
+    size_t bundles;
+    size_t rays_per_bundle;
+    double fov;
+    double lidar_range;
+    double road_length;
+    double road_half_width;
+    double max_curvature;
+    double truck_half_width;
+    double wheelbase;
+    double max_steering;
+    double max_speed;
+    double max_acceleration;
+    double dt;
+    double duration;
+    uint64_t seed;
+} evlearn_sim_config;
+
+// Outcome of an episode. time is tt, distance the one travelled along the road and fitness
+// tt * av². crashed is set if the truck hit a barrier, finished if it reached the end of the road.
+typedef struct evlearn_sim_result {
+    double time;
+    double distance;
+    double fitness;
+    int crashed;
+    int finished;
+} evlearn_sim_result;
+
+// Fills config with the default simulator, with the 9 bundles of the truck controller.
+void sim_default_config(evlearn_sim_config* config);
+
+// Builds the road of config. It returns NULL if the config is not valid.
+evlearn_sim* create_sim(const evlearn_sim_config* config);
+
+// Frees a simulator created by create_sim().
+void destroy_sim(evlearn_sim* sim);
+
+// Drives the truck with a chromosome of rows x cols genes, cols has to be the bundles. The readings
+// of the bundles, 0 to 1 of the range, are the inputs of evlearn_apply(), the row 0 is the steering
+// and the row 1 the throttle, both through tanh. It returns 1 if the shape does not fit.
+int sim_episode(
+    const evlearn_sim* sim,
+    const evlearn_gene* chromosome,
+    size_t rows,
+    size_t cols,
+    evlearn_sim_result* result);
+
+// Fitness function for evaluate() with the simulator as user_data, the fitness of sim_episode().
+double sim_fitness(const evlearn_gene* chromosome, size_t rows, size_t cols, void* user_data);
 
 // HELPERS ////////////////////////////////////////////////////////////////////////////////////////
 
 // This is to store the last generation of a traning. If you want to store the generated population,
-// you need to call this function explicitly.
-int write_file(int index, size_t generation);
+// you need to call this function explicitly. It writes the individuals from index on, 0 for the
+// whole population, and returns 1 if the file could not be written.
+int write_file(evlearn_ctx* ctx, size_t index, size_t generation);
 
 // Checks if the value given is out of the {min, max} and returns it truncated.
 double truncate_value(double value, double min, double max);
 
+// Gets the euclidean distance of two chromosomes of the context.
+double euclidean_d(
+    const evlearn_ctx* ctx, const evlearn_gene* chromosome1, const evlearn_gene* chromosome2);
+
 // Get a random value in the range {min, max}
-double f_rand(double min, double max);
+double f_rand(evlearn_rng* rng, double min, double max);
+
+// GENE KERNELS ///////////////////////////////////////////////////////////////////////////////////
+
+// Instruction sets the gene kernels can run on. The best one supported by the CPU is picked the
+// first time a kernel runs.
+typedef enum evlearn_simd {
+    EVLEARN_SIMD_SCALAR,
+    EVLEARN_SIMD_SSE2,
+    EVLEARN_SIMD_AVX2,
+    EVLEARN_SIMD_AVX512
+} evlearn_simd;
+
+// Gets the instruction set the kernels run on.
+evlearn_simd get_simd();
+
+// Makes the kernels run on the given instruction set, it returns 1 if the CPU does not support
+// it. It affects the whole process, it is meant for tests and benchmarks.
+int set_simd(evlearn_simd simd);
+
+// Copies count genes to son, each one from the father if its bit in bits is set, otherwise from
+// the mother. Bit i is bit i % 64 of bits[i / 64].
+void cross_genes(
+    evlearn_gene* son,
+    const evlearn_gene* mother,
+    const evlearn_gene* father,
+    const uint64_t* bits,
+    size_t count);
+
+// Sets each of count genes with threshold[i] < omega to min[i] + random[i] * (max[i] - min[i])
+// and returns the number of genes set. Omega is rounded to evlearn_gene first.
+size_t mutate_genes(
+    evlearn_gene* genes, 
+    const evlearn_gene* min, 
+    const evlearn_gene* max, 
+    const evlearn_gene* threshold, 
+    const evlearn_gene* random, 
+    double omega, 
+    size_t count);
+
+// Truncates each of count genes to its {min, max} like truncate_value().
+void truncate_genes(
+    evlearn_gene* genes, const evlearn_gene* min, const evlearn_gene* max, size_t count);
+
+// Squared euclidean distance between two vectors of count genes, summed as double. It and the dot
+// products are summed in the same order whatever the instruction set, so they are exactly the same
+// on every machine.
+double squared_distance(const evlearn_gene* a, const evlearn_gene* b, size_t count);
+
+// Dot product of count genes and count inputs, summed as double.
+double dot_genes(const evlearn_gene* weights, const double* inputs, size_t count);
+
+// Dot products of count genes and four vectors of count inputs, stride doubles apart, into out[4].
+// Each one is exactly the one of dot_genes().
+void dot4_genes(
+    const evlearn_gene* weights, const double* inputs, size_t stride, size_t count, double* out);
+
+// RANDOM NUMBERS /////////////////////////////////////////////////////////////////////////////////
+
+// Seed used by the contexts until set_seed() is called.
+#define EVLEARN_DEFAULT_SEED 0x5eedULL
+
+// Every individual has one random stream per operator, the stream of the individual i for the
+// operator op is i * EVLEARN_STREAMS + op. The stream of the selection of a generation is the one
+// past the last individual.
+enum {
+    EVLEARN_STREAM_INIT,
+    EVLEARN_STREAM_CROSS,
+    EVLEARN_STREAM_MUTATE,
+    EVLEARN_STREAMS
+};
+
+// Seeds the generator with the independent stream of the given (seed, generation, individual).
+void rng_seed(evlearn_rng* rng, uint64_t seed, uint64_t generation, uint64_t individual);
+
+// Draws 64 random bits.
+uint64_t rng_next(evlearn_rng* rng);
+
+// Draws a value in the range [0, 1).
+double rng_uniform(evlearn_rng* rng);
+
+// Fills out with count values in the range [0, 1).
+void rng_fill_uniform(evlearn_rng* rng, double* out, size_t count);
+
+// Fills out with count floats in the range [0, 1) of 24 random bits, two per draw.
+void rng_fill_uniform_float(evlearn_rng* rng, float* out, size_t count);
+
+// Fills out with count genes in the range [0, 1), with one of the functions above.
+void rng_fill_uniform_genes(evlearn_rng* rng, evlearn_gene* out, size_t count);
+
+// Fills out with count words of 64 random bits.
+void rng_fill_bits(evlearn_rng* rng, uint64_t* out, size_t count);
+
+// Fills out with count values of the standard normal distribution.
+void rng_fill_normal(evlearn_rng* rng, double* out, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,284 @@
+/**
+ * File: evlearn.hpp
+ * Description: This is a header only C++ front-end for
+ *              chromosomes of a shape fixed at compile time.
+ *              It breeds exactly like the C library.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#pragma once
+
+namespace evlearn {
+
+// Bounds of every gene within {-1, 1}, the default of init().
+template <std::size_t Genes>
+struct UnitBounds {
+    static constexpr double min(std::size_t) { return -1; }
+    static constexpr double max(std::size_t) { return 1; }
+};
+
+// Bounds given by two constexpr arrays, for example:
+// struct MyBounds : ArrayBounds<54, MyBounds> {
+//     static constexpr std::array<double, 54> min_values = {...};
+//     static constexpr std::array<double, 54> max_values = {...};
+// };
+template <std::size_t Genes, typename Derived>
+struct ArrayBounds {
+    static constexpr double min(std::size_t i) { return Derived::min_values[i]; }
+    static constexpr double max(std::size_t i) { return Derived::max_values[i]; }
+};
+
+/**
+ * The genetic algorithm of evlearn.h for a population of PopSize
+ * chromosomes of Rows x Cols genes. The sizes are constants, so the
+ * chromosomes are packed with no stride, the whole population lives
+ * inside the object and every loop has a trip count known to the
+ * compiler, which unrolls and vectorizes it.
+ *
+ * Given the same seed and the same fitness values, an Engine of
+ * evlearn_gene breeds exactly the same genes as a context initialized
+ * with the same sizes and default bounds: it uses the same random
+ * streams, tournament selection without replacement, uniform
+ * crossover with elitism and mutation scaled by the fitness over the
+ * best one.
+ *
+ * Gene can be double or float, whatever the library is built with.
+ * A big Engine should be allocated on the heap, it holds
+ * 2 * PopSize * Rows * Cols genes.
+ */
+template <
+    std::size_t Rows,
+    std::size_t Cols,
+    std::size_t PopSize,
+    typename Gene = double,
+    typename Bounds = UnitBounds<Rows * Cols>>
+class Engine {
+public:
+    static constexpr std::size_t rows = Rows;
+    static constexpr std::size_t cols = Cols;
+    static constexpr std::size_t genes = Rows * Cols;
+    static constexpr std::size_t population_size = PopSize;
+
+    using Chromosome = std::array<Gene, genes>;
+
+    static_assert(Rows > 0 && Cols > 0 && PopSize > 0, "evlearn::Engine sizes must not be 0");
+    static_assert(std::is_same<Gene, double>::value || std::is_same<Gene, float>::value,
+        "evlearn::Engine genes must be double or float");
+
+    explicit Engine(std::uint64_t seed = EVLEARN_DEFAULT_SEED) : seed_(seed)
+    {
+        initialize_population();
+    }
+
+    // Main function of the algorithm, like compute_next_generation().
+    void compute_next_generation(std::size_t tournament_size, double mutation_probability)
+    {
+        evlearn_rng rng;
+
+        rng_seed(&rng, seed_, generation_, (std::uint64_t) PopSize * EVLEARN_STREAMS);
+        select_population(rng, tournament_size);
+        cross_population();
+        mutate_population(mutation_probability);
+        best_ = 0;
+        generation_++;
+    }
+
+    // Evaluates every individual with fitness_fn(const Chromosome&) and stores the results.
+    template <typename FitnessFn>
+    void evaluate(FitnessFn&& fitness_fn)
+    {
+        for (std::size_t i = 0; i < PopSize; i++) {
+            fitness_[i] = fitness_fn(population_[i]);
+        }
+        best_ = scan_best();
+    }
+
+    // Stores the fitness of an individual.
+    void set_fitness(std::size_t index, double fitness)
+    {
+        fitness_[index] = fitness;
+        best_ = scan_best();
+    }
+
+    const Chromosome& chromosome(std::size_t index) const { return population_[index]; }
+    double fitness(std::size_t index) const { return fitness_[index]; }
+    std::size_t best_index() const { return best_; }
+    const Chromosome& best() const { return population_[best_]; }
+    std::size_t generation() const { return generation_; }
+
+private:
+    static constexpr std::size_t bit_words = (genes + 63) / 64;
+
+    static void seed_stream(evlearn_rng* rng, std::uint64_t seed, std::size_t generation,
+        std::size_t individual, int op)
+    {
+        rng_seed(rng, seed, generation, (std::uint64_t) individual * EVLEARN_STREAMS + op);
+    }
+
+    static void fill_uniform(evlearn_rng* rng, double* out, std::size_t count)
+    {
+        rng_fill_uniform(rng, out, count);
+    }
+
+    static void fill_uniform(evlearn_rng* rng, float* out, std::size_t count)
+    {
+        rng_fill_uniform_float(rng, out, count);
+    }
+
+    static std::size_t draw_index(evlearn_rng* rng, std::size_t n)
+    {
+        std::size_t r = (std::size_t) (rng_uniform(rng) * n);
+        return r < n ? r : n - 1;
+    }
+
+    void initialize_population()
+    {
+        evlearn_rng rng;
+
+        for (std::size_t index = 0; index < PopSize; index++) {
+            seed_stream(&rng, seed_, generation_, index, EVLEARN_STREAM_INIT);
+            for (std::size_t i = 0; i < genes; i++) {
+                population_[index][i] =
+                    (Gene) f_rand(&rng, (Gene) Bounds::min(i), (Gene) Bounds::max(i));
+            }
+            fitness_[index] = 0;
+        }
+        best_ = 0;
+    }
+
+    // The first individual with the highest fitness, like find_best().
+    std::size_t scan_best() const
+    {
+        std::size_t index = 0;
+
+        for (std::size_t i = 1; i < PopSize; i++) {
+            if (fitness_[i] > fitness_[index]) {
+                index = i;
+            }
+        }
+        return index;
+    }
+
+    // Tournaments of distinct contestants drawn with a partial Fisher-Yates shuffle.
+    void select_population(evlearn_rng& rng, std::size_t k)
+    {
+        std::array<std::size_t, PopSize> order;
+
+        k = k == 0 ? 1 : (k > PopSize ? PopSize : k);
+        for (std::size_t i = 0; i < PopSize; i++) {
+            order[i] = i;
+            s_count_[i] = 0;
+        }
+
+        for (std::size_t t = 0; t < PopSize; t++) {
+            std::size_t winner = 0;
+            double winner_f = 0;
+
+            for (std::size_t i = 0; i < k; i++) {
+                std::size_t r = i + draw_index(&rng, PopSize - i);
+                std::size_t contestant = order[r];
+
+                order[r] = order[i];
+                order[i] = contestant;
+                if (i == 0 || fitness_[contestant] > winner_f) {
+                    winner = contestant;
+                    winner_f = fitness_[contestant];
+                }
+            }
+            s_count_[winner]++;
+        }
+    }
+
+    std::size_t next_alive(std::size_t begin) const
+    {
+        std::size_t index = begin % PopSize;
+
+        for (std::size_t count = 0; count <= PopSize; count++, index++) {
+            if (index == PopSize) {
+                index = 0;
+            }
+            if (s_count_[index] > 0) {
+                return index;
+            }
+        }
+        return 0;
+    }
+
+    void cross_chromosomes(std::size_t son_index, std::size_t mother, std::size_t father)
+    {
+        std::array<std::uint64_t, bit_words> bits;
+        evlearn_rng rng;
+        const Chromosome& m = population_[mother];
+        const Chromosome& f = population_[father];
+        Chromosome& son = offspring_[son_index];
+
+        seed_stream(&rng, seed_, generation_, son_index, EVLEARN_STREAM_CROSS);
+        rng_fill_bits(&rng, bits.data(), bit_words);
+        for (std::size_t i = 0; i < genes; i++) {
+            son[i] = (bits[i / 64] >> (i % 64)) & 1 ? f[i] : m[i];
+        }
+    }
+
+    // Uniform crossover into the offspring with the best individual kept, then a swap.
+    void cross_population()
+    {
+        std::size_t son_index = 0;
+
+        for (std::size_t mother = 0; mother < PopSize; mother++) {
+            for (std::size_t j = 0; j < s_count_[mother]; j++) {
+                if (son_index != best_) {
+                    cross_chromosomes(son_index, mother, next_alive(mother + j + 1));
+                }
+                son_index++;
+            }
+        }
+        offspring_[best_] = population_[best_];
+        population_.swap(offspring_);
+    }
+
+    // Uniform mutation inversely proportional to the fitness, the best one is not mutated. A best
+    // fitness of 0 gives every individual m_prob, like mutation_rate() of the C library.
+    void mutate_population(double m_prob)
+    {
+        std::array<Gene, genes * 2> uniform;
+        double best_f = fitness_[best_];
+        evlearn_rng rng;
+
+        for (std::size_t index = 0; index < PopSize; index++) {
+            Gene omega = (Gene) (best_f != 0 ? (1 - (fitness_[index] / best_f)) * m_prob : m_prob);
+
+            if (index == best_) {
+                continue;
+            }
+            seed_stream(&rng, seed_, generation_, index, EVLEARN_STREAM_MUTATE);
+            fill_uniform(&rng, uniform.data(), genes * 2);
+            for (std::size_t i = 0; i < genes; i++) {
+                Gene min = (Gene) Bounds::min(i);
+                Gene max = (Gene) Bounds::max(i);
+                Gene value = min + uniform[genes + i] * (max - min);
+
+                population_[index][i] = uniform[i] < omega ? value : population_[index][i];
+            }
+        }
+        fitness_.fill(0);
+    }
+
+    alignas(EVLEARN_ALIGNMENT) std::array<Chromosome, PopSize> population_;
+    alignas(EVLEARN_ALIGNMENT) std::array<Chromosome, PopSize> offspring_;
+    std::array<double, PopSize> fitness_;
+    std::array<std::size_t, PopSize> s_count_;
+    std::uint64_t seed_;
+    std::size_t generation_ = 0;
+    std::size_t best_ = 0;
+};
+
+}
@@ -9,56 +9,12 @@
 
 // TODO: Use proper log system.
 
-#include "../include/evlearn.h"
+#include "evlearn_ctx.h"
 
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-/**
- * This variables are the relevant user defined sizes, 
- * the population itself and the pointer to the file 
- * that stores the chromosomes of the best generation, 
- * so that it can be reused. The population will be 
- * initialized to random values or to the values in the
- * best generation on the file. 
- */
-size_t evlearn_population_size;
-size_t evlearn_chrom_array_size;
-size_t evlearn_chrom_size;
-size_t evlearn_generation = 0;
-Individual evlearn_population[MAX_POPULATION_SIZE];
-FILE* evlearn_output_file;
-FILE* evlearn_input_file;
-
-/**
- * This 2d array contains the limits of the chromosome values so that the
- * initialize population function provides a random value for each chromosome
- * component within the given range. There are two vectors for each chromosome,
- * the first one contains the lower limit and the second the upper limit.
- * They should be changed depending of the specific application. By default, the
- * init function initializes every even vector to -1, (min_value) and every odd 
- * to 1 (max_value) if the NULL value is passed.
- * Example:
- * Chromosome -> 
- * [
- *  [0, 0, 0], first chromosome row
- *  [0, 0, 0]  second chromosome row
- * ]
- * 
- * min_max -> 
- * [
- *  [-1, -1, -1], first chromosome row min
- *  [ 1,  1,  1], first chromosome row max
- *  [-1, -1, -1], second chromosome row min
- *  [ 1,  1,  1]  secord chromosome row max
- * ]
- * 
- * Note that this would be the default min max matrix but elements of every vector
- * can be different.
- */
-double evlearn_min_max_matrix[MAX_CHROM_ARRAY_SIZE*2][MAX_CHROM_SIZE];
-
+#include <string.h>
 
 //FUNCTIONS----------------------------------------------------------------------------------------
 
@@ -66,17 +22,35 @@ double evlearn_min_max_matrix[MAX_CHROM_ARRAY_SIZE*2][MAX_CHROM_SIZE];
  * \brief This is to find a random double value within a given
  * interval.
  * 
+ * \param rng the generator to draw from
  * \param min minimum value returned
  * \param max maximum value returned
  * 
  * \return it returns a random value within the interval
  */
-double f_rand(double min, double max)
+double f_rand(evlearn_rng* rng, double min, double max)
 {
-    double f = (double)rand() / RAND_MAX;
+    double f = rng_uniform(rng);
     return min + f * (max - min);
 }
 
+/**
+ * \brief Seeds rng with the stream of an individual for an operator
+ * in the current generation and round.
+ *
+ * \param ctx the context
+ * \param rng the generator to seed
+ * \param individual the index of the individual
+ * \param op the operator, one of EVLEARN_STREAM_*
+ */
+static void seed_stream(const evlearn_ctx* ctx, evlearn_rng* rng, size_t individual, int op)
+{
+    // The streams of a round come after the ones of the selection and the steady state mode.
+    uint64_t stream = individual + ctx->round * (ctx->population_size + 2);
+
+    rng_seed(rng, ctx->seed, ctx->generation, stream * EVLEARN_STREAMS + op);
+}
+
 /**
  * \brief Check if the value given is out of the {min, max}
  * interval.
@@ -100,125 +74,314 @@ double truncate_value(double value, double min, double max)
 /**
  * \brief Calculates the euclidean distance of two vectors.
  *
+ * \param ctx the context
  * \param chromosome1 subtrahend vector
  * \param chromosome2 minuend vector
  * 
  * \return the positive or negative distance
  */
 double euclidean_d(
-    double chromosome1[MAX_CHROM_ARRAY_SIZE][MAX_CHROM_SIZE], 
-    double chromosome2[MAX_CHROM_ARRAY_SIZE][MAX_CHROM_SIZE])
+    const evlearn_ctx* ctx, const evlearn_gene* chromosome1, const evlearn_gene* chromosome2)
 {
-    double sum = 0;
-    double sub = 0;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
 
-    for (int i = 0; i < evlearn_chrom_array_size; i++) {
-        for (int j = 0; j < evlearn_chrom_size; j++) {
-            sub = chromosome1[i][j] - chromosome2[i][j];
-            sum += pow(sub, 2);
-        }
-    }
-    return sqrt(sum);
+    return sqrt(squared_distance(chromosome1, chromosome2, genes));
 }
 
-// TODO close to free resources, doc. Don't need global file variable
-int read_file(char* file_path)
+/**
+ * \brief Loads the population from a file. It can be a binary
+ * checkpoint written by save_checkpoint() or the text written by
+ * write_file(): for every individual chrom_array_size lines of
+ * chrom_size genes and a line with its fitness, then the line
+ * "Generation: n". In both cases the sizes in the file have to
+ * match the ones of the context, and the bounds of a checkpoint have
+ * to be the ones of the context as well.
+ *
+ * \param ctx the context
+ * \param file_path path of the file, NULL is allowed
+ *
+ * \return 0 if the whole population was loaded, 1 otherwise
+ */
+int read_file(evlearn_ctx* ctx, char* file_path)
 {
-    evlearn_input_file = fopen(file_path, "r");
-    if (evlearn_input_file == NULL)
-        return 1;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t generation = 0;
+    double value = 0;
+    int result = 0;
 
-    int i_index = 0;
-    int ca_index = 0;
-    int c_index = 0;
-    while (!feof(evlearn_input_file)) {
-        double value;
+    if (file_path == NULL)
+        return 1;
 
-        if (i_index  >= evlearn_population_size  || 
-            ca_index >= evlearn_chrom_array_size ||
-            c_index  >= evlearn_chrom_size) {
-                return 1;
-        }
+    if (is_checkpoint(file_path))
+        return restore_checkpoint(ctx, file_path, 1);
 
-        if (fscanf(evlearn_input_file, "%lf", &value) == 1) {
-            if (ca_index > 0 % (ca_index % (evlearn_chrom_array_size - 1) == 0)) {
+    STATS_START(start);
+    ctx->input_file = fopen(file_path, "r");
+    if (ctx->input_file == NULL)
+        return 1;
 
+    for (size_t i = 0; i < ctx->population_size && result == 0; i++) {
+        for (size_t j = 0; j < genes && result == 0; j++) {
+            if (fscanf(ctx->input_file, "%lf", &value) != 1) {
+                result = 1;
+            }
+            else {
+                ctx->population[i].chromosome[j] = (evlearn_gene) value;
             }
-            evlearn_population[i_index].chromosome[ca_index][c_index];
-        }
-        else {
-            return 1;
         }
-
-        if (c_index > 0 && (c_index % (evlearn_chrom_size - 1) == 0)) {
-            ca_index++;
+        if (result == 0 && fscanf(ctx->input_file, "%lf", &ctx->population[i].fitness) != 1) {
+            result = 1;
         }
+    }
+    if (result == 0 && fscanf(ctx->input_file, " Generation: %zu", &generation) == 1) {
+        ctx->generation = generation;
+    }
 
-        if (ca_index > 0 && (ca_index % (evlearn_chrom_array_size -1) == 0)) {
-            i_index++;
-        }
+    fclose(ctx->input_file);
+    ctx->input_file = NULL;
+    refresh_ranking(ctx);
+    STATS_TIME(ctx, EVLEARN_TIMER_IO, start);
 
-        c_index++;
-    }
+    return result;
+}
 
+/**
+ * \brief Adds the bytes written by a call to fprintf() to a count.
+ *
+ * \return 0 if the call succeeded, 1 otherwise
+ */
+static int count_written(int n, size_t* written)
+{
+    if (n < 0)
+        return 1;
+    *written += (size_t) n;
     return 0;
 }
 
 /**
  * \brief Writes the chromosomes and fitness of each individual
- * in the population to a file called best_gen.txt.
+ * in the population to a file called best_gen.txt, in the format
+ * read_file() reads. The file is closed whether the writes succeed or
+ * not.
  *
- * \param index recursive index, should start in 0
+ * \param ctx the context
+ * \param index first individual written, 0 for the whole population
  * \param generation the current generation
+ *
+ * \return 0 if the whole file was written, 1 otherwise
  */
-int write_file(int index, size_t generation)
+int write_file(evlearn_ctx* ctx, size_t index, size_t generation)
 {
-    // TODO: Manage errors with file
-    if (index == 0) {
-        evlearn_output_file = fopen("best_gen.txt", "w+");
-    }
+    size_t cs = ctx->chrom_size;
+    size_t written = 0;
+    int result = 0;
+
+    STATS_START(start);
+    ctx->output_file = fopen("best_gen.txt", "w+");
+    if (ctx->output_file == NULL)
+        return 1;
+
+    for (size_t k = index; k < ctx->population_size && result == 0; k++) {
+        const evlearn_gene* chromosome = ctx->population[k].chromosome;
 
-    if (index < evlearn_population_size) {
-        for (int i = 0; i < evlearn_chrom_array_size; i++) {
-            for (int j = 0; j < evlearn_chrom_size; j++) {
-                fprintf(evlearn_output_file, "%lf ", evlearn_population[index].chromosome[i][j]);
+        for (size_t i = 0; i < ctx->chrom_array_size && result == 0; i++) {
+            for (size_t j = 0; j < cs && result == 0; j++) {
+                result = count_written(fprintf(ctx->output_file, "%lf ", chromosome[i * cs + j]),
+                    &written);
             }
-            fprintf(evlearn_output_file, "\n");
+            if (result == 0) {
+                result = count_written(fprintf(ctx->output_file, "\n"), &written);
+            }
+        }
+        if (result == 0) {
+            result = count_written(
+                fprintf(ctx->output_file, "%lf\n", ctx->population[k].fitness), &written);
         }
-        fprintf(evlearn_output_file, "%lf\n", evlearn_population[index].fitness);
-        write_file(index + 1, generation);
     }
-    else {
-        fprintf(evlearn_output_file, "Generation: %d", (int) generation);
-        fclose(evlearn_output_file);
-        return 0;
+    if (result == 0) {
+        result = count_written(fprintf(ctx->output_file, "Generation: %zu", generation), &written);
     }
 
-    return 1;
+    if (fclose(ctx->output_file) != 0) {
+        result = 1;
+    }
+    ctx->output_file = NULL;
+    STATS_ADD(ctx, bytes_written, written);
+    STATS_TIME(ctx, EVLEARN_TIMER_IO, start);
+
+    return result;
 }
 
 /**
- * \brief Loads a population from file. If not available it gives 
- * random values within the given limits in the evlearn_min_max_matrix
- * to the population. Fitness is initialized to 0 that way.
- *
- * \param index recursive index
+ * \brief Gives random values within the given limits in the 
+ * ctx->min_max_matrix to the population. Fitness is initialized
+ * to 0 that way. It iterates instead of recursing so that the
+ * population size is only limited by the memory available.
  */
-void initialize_population(size_t index)
+void initialize_population(evlearn_ctx* ctx)
 {
-    if (index < evlearn_population_size) {
-    
-        for (int i = 0; i < evlearn_chrom_array_size; i++) {
-            for (int j = 0; j < evlearn_chrom_size; j++) {
-                double random = f_rand(evlearn_min_max_matrix[i*2][j], evlearn_min_max_matrix[i*2+1][j]);
-                evlearn_population[index].s_count = 0;
-                evlearn_population[index].fitness = 0;
-                evlearn_population[index].chromosome[i][j] = random;
+    size_t cs = ctx->chrom_size;
+    evlearn_rng rng;
+
+    STATS_ADD(ctx, rng_draws, ctx->population_size * ctx->chrom_array_size * cs);
+    for (size_t index = 0; index < ctx->population_size; index++) {
+        ctx->population[index].s_count = 0;
+        ctx->population[index].fitness = 0;
+        seed_stream(ctx, &rng, index, EVLEARN_STREAM_INIT);
+
+        for (size_t i = 0; i < ctx->chrom_array_size; i++) {
+            for (size_t j = 0; j < cs; j++) {
+                double random = f_rand(&rng,
+                    ctx->min_max_matrix[i * 2 * cs + j], ctx->min_max_matrix[(i * 2 + 1) * cs + j]);
+                ctx->population[index].chromosome[i * cs + j] = (evlearn_gene) random;
             }
         }
+    }
+    refresh_ranking(ctx);
+}
+
+/**
+ * \brief Rounds size up to the next multiple of EVLEARN_ALIGNMENT.
+ */
+static size_t align_up(size_t size)
+{
+    return (size + EVLEARN_ALIGNMENT - 1) / EVLEARN_ALIGNMENT * EVLEARN_ALIGNMENT;
+}
+
+/**
+ * \brief Releases the context and allocates the arena holding the
+ * population, the offspring buffer and the min max matrix for the
+ * given sizes. Every block starts at an EVLEARN_ALIGNMENT boundary.
+ * The layout is:
+ * [Individual x population_size][chromosomes][offspring][min_max]
+ * [batch indices][batch fitness][uniform][bits][order][ranking].
+ * The chromosome buffers are zeroed so that the padding after every
+ * chromosome has a known value.
+ *
+ * \param ctx the context
+ * \param population_size the number of individuals
+ * \param chrom_array_size the number of rows of every chromosome
+ * \param chrom_size the number of genes of every row
+ *
+ * \return 0 for success, 1 if the sizes are 0 or overflow or there is no memory.
+ */
+int allocate_ctx(
+    evlearn_ctx* ctx, size_t population_size, size_t chrom_array_size, size_t chrom_size)
+{
+    size_t genes = 0;
+    size_t stride = 0;
+    size_t individuals_bytes = 0;
+    size_t chromosomes_bytes = 0;
+    size_t min_max_bytes = 0;
+    size_t batch_bytes = 0;
+    size_t uniform_bytes = 0;
+    size_t bits_bytes = 0;
+    size_t order_bytes = 0;
+    char* arena = NULL;
+
+    release(ctx);
+
+    if (population_size == 0 || chrom_array_size == 0 || chrom_size == 0)
+        return 1;
+    if (chrom_size > SIZE_MAX / chrom_array_size / 2)
+        return 1;
+    genes = chrom_array_size * chrom_size;
+    stride = align_up(genes * sizeof(evlearn_gene)) / sizeof(evlearn_gene);
+
+    if (population_size > SIZE_MAX / sizeof(Individual) ||
+        stride > SIZE_MAX / sizeof(double) / population_size / 4)
+        return 1;
+    individuals_bytes = align_up(population_size * sizeof(Individual));
+    chromosomes_bytes = population_size * stride * sizeof(evlearn_gene);
+    min_max_bytes = align_up(genes * 2 * sizeof(evlearn_gene));
+    batch_bytes = align_up(population_size * sizeof(size_t));
+    uniform_bytes = stride * 2 * sizeof(evlearn_gene);
+    bits_bytes = align_up((stride / 64 + 1) * sizeof(uint64_t));
+    order_bytes = align_up(population_size * sizeof(size_t));
+
+    arena = aligned_alloc(
+        EVLEARN_ALIGNMENT, 
+        individuals_bytes + chromosomes_bytes * 2 + min_max_bytes + batch_bytes * 2 + 
+        uniform_bytes + bits_bytes + order_bytes * 2);
+    if (arena == NULL)
+        return 1;
+
+    ctx->arena = arena;
+    ctx->population = (Individual*) arena;
+    ctx->chromosomes = (evlearn_gene*) (arena + individuals_bytes);
+    ctx->offspring = (evlearn_gene*) (arena + individuals_bytes + chromosomes_bytes);
+    ctx->min_max_matrix = (evlearn_gene*) (arena + individuals_bytes + chromosomes_bytes * 2);
+    ctx->batch = (size_t*) ((char*) ctx->min_max_matrix + min_max_bytes);
+    ctx->batch_fitness = (double*) ((char*) ctx->batch + batch_bytes);
+    ctx->uniform = (evlearn_gene*) ((char*) ctx->batch_fitness + batch_bytes);
+    ctx->bits = (uint64_t*) ((char*) ctx->uniform + uniform_bytes);
+    ctx->order = (size_t*) ((char*) ctx->bits + bits_bytes);
+    ctx->ranking = (size_t*) ((char*) ctx->order + order_bytes);
+    ctx->chrom_stride = stride;
+    ctx->population_size = population_size;
+    ctx->chrom_array_size = chrom_array_size;
+    ctx->chrom_size = chrom_size;
+    ctx->generation = 0;
+    ctx->ask_cursor = 0;
 
-        initialize_population(index+1);
+    memset(ctx->chromosomes, 0, chromosomes_bytes * 2);
+    for (size_t i = 0; i < population_size; i++) {
+        ctx->population[i].s_count = 0;
+        ctx->population[i].fitness = 0;
+        ctx->population[i].chromosome = ctx->chromosomes + i * stride;
     }
+    refresh_ranking(ctx);
+
+    return 0;
+}
+
+/**
+ * \brief Creates an empty context, init() has to be called on it
+ * before starting.
+ *
+ * \return the context or NULL if there is no memory
+ */
+evlearn_ctx* create_ctx()
+{
+    evlearn_ctx* ctx = calloc(1, sizeof(evlearn_ctx));
+
+#ifdef EVLEARN_STATS
+    if (ctx != NULL) {
+        ctx->instruments = calloc(1, sizeof(evlearn_instruments));
+        if (ctx->instruments == NULL) {
+            free(ctx);
+            return NULL;
+        }
+    }
+#endif
+    if (ctx != NULL) {
+        ctx->seed = EVLEARN_DEFAULT_SEED;
+        ctx->selection = EVLEARN_SELECT_TOURNAMENT;
+        ctx->rank_pressure = 2;
+        ctx->checkpoint_format = NATIVE_FORMAT;
+    }
+    return ctx;
+}
+
+/**
+ * \brief Releases everything allocated for the context and frees it.
+ *
+ * \param ctx the context, NULL is ignored
+ */
+void destroy_ctx(evlearn_ctx* ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    close_telemetry(ctx);
+    close_farm(ctx);
+    cache_destroy(ctx->cache);
+    release(ctx);
+#ifdef EVLEARN_STATS
+    close_trace(ctx);
+    free(ctx->instruments);
+#endif
+    free(ctx);
 }
 
 /**
@@ -226,6 +389,7 @@ void initialize_population(size_t index)
  * The algorithm assumes this function is called, so it is
  * mandatory to call it before starting.
  * 
+ * \param ctx the context
  * \param population_size The number of individuals in the population.
  * \param chrom_array_size The number of rows of the chromosome matrix,
  * it is presented as a matrix. Every row represents a characteristic
@@ -242,10 +406,16 @@ void initialize_population(size_t index)
  * component can have a value within the range {-1, 1}. Different
  * min / max values can be used for every chromosome component of 
  * every row.
+ * \param file_path File to resume from, either a checkpoint written
+ * by save_checkpoint() or the text written by write_file(), with the
+ * same sizes. A checkpoint also needs the same bounds, the ones given
+ * here always win. If it is NULL or it can't be loaded, the
+ * population is initialized to random values.
  * 
  * \return Returns 0 for success, 1 otherwise.
  */
 int init(
+    evlearn_ctx* ctx,
     size_t population_size, 
     size_t chrom_array_size, 
     size_t chrom_size, 
@@ -253,35 +423,29 @@ int init(
     char* file_path)
 {
     int condition = 
-    population_size <= MAX_POPULATION_SIZE && 
-    chrom_array_size <= MAX_CHROM_ARRAY_SIZE && 
-    chrom_size <= MAX_CHROM_SIZE;
-
-    if (!read_file(file_path))
-    {
-        initialize_population(0);
-    }
+    allocate_ctx(ctx, population_size, chrom_array_size, chrom_size) == 0;
 
     if (condition)
     {
-        evlearn_population_size = population_size;
-        evlearn_chrom_array_size = chrom_array_size;
-        evlearn_chrom_size = chrom_size;
-
-        for (int i = 0; i < chrom_array_size * 2; i++)
+        for (size_t i = 0; i < chrom_array_size * 2; i++)
         {
-            for (int j = 0; j < chrom_array_size * 2; j++)
+            for (size_t j = 0; j < chrom_size; j++)
             {
                 if (min_max_matrix != NULL)
                 {
-                    evlearn_min_max_matrix[i][j] = min_max_matrix[i][j];
+                    ctx->min_max_matrix[i * chrom_size + j] = (evlearn_gene) min_max_matrix[i][j];
                 }
                 else
                 {
-                    evlearn_min_max_matrix[i][j] = i % 2  == 0 ? -1 : 1;
+                    ctx->min_max_matrix[i * chrom_size + j] = i % 2  == 0 ? -1 : 1;
                 }
             }
         }
+
+        if (read_file(ctx, file_path))
+        {
+            initialize_population(ctx);
+        }
     
         return 0;
     }
@@ -290,38 +454,66 @@ int init(
 }
 
 /**
- * \brief Checks if an element exists in an array
- *
- * \param index_a array to check
- * \param k size of the array
- * \param e element to find
- * 
- * \return 1 if the element r exists in index_a, 0 otherwise
+ * \brief Frees the arena allocated by init() and ends the steady
+ * state mode, the racing and the surrogate, going back to the
+ * genetic algorithm. It is safe to call it more than once,
+ * init() calls it as well before allocating again.
  */
-int contains(int* index_a, size_t k, size_t e)
+void release(evlearn_ctx* ctx)
 {
-    for (int i = 0; i < k; i++) {
-        if (index_a[i] == e) {
-            return 1;
-        }
+    stop_steady_state(ctx);
+    racing_destroy(ctx->racing);
+    ctx->racing = NULL;
+    surrogate_destroy(ctx->surrogate);
+    ctx->surrogate = NULL;
+    engine_destroy(ctx);
+    pool_destroy(ctx->pool);
+    ctx->pool = NULL;
+    if (ctx->telemetry != NULL) {
+        return_chromosomes(ctx);
     }
-    return 0;
+    free(ctx->arena);
+    ctx->arena = NULL;
+    ctx->population = NULL;
+    ctx->chromosomes = NULL;
+    ctx->offspring = NULL;
+    ctx->min_max_matrix = NULL;
+    ctx->batch = NULL;
+    ctx->batch_fitness = NULL;
+    ctx->uniform = NULL;
+    ctx->bits = NULL;
+    ctx->order = NULL;
+    ctx->ranking = NULL;
+    ctx->population_size = 0;
 }
 
 /**
- * \brief This finds the individual with the best fitness
+ * \brief Sets the seed every random stream of the run derives from.
+ *
+ * \param ctx the context
+ * \param seed the seed
+ */
+void set_seed(evlearn_ctx* ctx, uint64_t seed)
+{
+    ctx->seed = seed;
+}
+
+/**
+ * \brief Scans the population for the individual with the best
+ * fitness, the first one if there are several.
  *
  * \return the index of the best individual
  */
-int find_best()
+static size_t scan_best(const evlearn_ctx* ctx)
 {
-    int index = 0;
+    size_t index = 0;
     double i_f = 0;
     double index_f = 0;
 
-    for (int i = 1; i < evlearn_population_size; i++) {
-        i_f = evlearn_population[i].fitness;
-        index_f = evlearn_population[index].fitness;
+    STATS_ADD(ctx, best_scans, 1);
+    for (size_t i = 1; i < ctx->population_size; i++) {
+        i_f = ctx->population[i].fitness;
+        index_f = ctx->population[index].fitness;
         if(i_f > index_f) {
             index = i;
         }
@@ -330,203 +522,539 @@ int find_best()
     return index;
 }
 
+/**
+ * \brief Rebuilds the ranking state after the fitness of the whole
+ * population changed at once.
+ */
+void refresh_ranking(evlearn_ctx* ctx)
+{
+    ctx->best = scan_best(ctx);
+    ctx->ranked = 0;
+}
+
+/**
+ * \brief Sets the fitness of an individual keeping the best one up
+ * to date. It only has to scan the population when the best one gets
+ * worse, the sorted ranking is rebuilt the next time it is needed.
+ *
+ * \param ctx the context
+ * \param index index of the individual
+ * \param fitness its new fitness
+ */
+void set_fitness(evlearn_ctx* ctx, size_t index, double fitness)
+{
+    double best_f = ctx->population[ctx->best].fitness;
+
+    ctx->population[index].fitness = fitness;
+    ctx->ranked = 0;
+
+    if (index == ctx->best) {
+        if (fitness < best_f) {
+            ctx->best = scan_best(ctx);
+        }
+    }
+    else if (fitness > best_f || (fitness == best_f && index < ctx->best)) {
+        ctx->best = index;
+    }
+}
+
+/**
+ * \brief This gives the individual with the best fitness, which is
+ * kept up to date as the fitness is set.
+ *
+ * \return the index of the best individual
+ */
+size_t find_best(const evlearn_ctx* ctx)
+{
+    return ctx->best;
+}
+
 /**
  * \brief Finds the next individual alive (with a value different from
  * 0 in the field "s_count"), beginning from "begin" parameter.
  *
+ * \param ctx the context
  * \param begin the beginning index
  * 
- * \return the index of the next alive individual
+ * \return the index of the next alive individual, or
+ * ctx->population_size if there is none
  */
-int next_alive(int begin)
+size_t next_alive(const evlearn_ctx* ctx, size_t begin)
 {
-    int index = begin;
-    int count = 0;
+    size_t index = begin % ctx->population_size;
 
-    while (count <= evlearn_population_size) {
-        if (index == evlearn_population_size) {
-            index = 0;
-        }
-        if (evlearn_population[index].s_count > 0) {
+    for (size_t count = 0; count < ctx->population_size; count++) {
+        if (ctx->population[index].s_count > 0)
             return index;
-        }
-        count++;
-        index++;
+        index = index + 1 == ctx->population_size ? 0 : index + 1;
     }
-    return -1;
+    return ctx->population_size;
 }
 
 /**
  * \brief Uniform crossover
  *
- * \param son_matrix matrix storing all generated offspring chromosomes
+ * \param ctx the context
+ * \param son_matrix offspring chromosomes, one every ctx->chrom_stride genes
  * \param son_index current son being crossed
  * \param mother 1st selected parent for crossing
  * \param father 2nd selected parent for crossing
  */
 void cross_chromosomes(
-    double son_matrix[MAX_POPULATION_SIZE][MAX_CHROM_ARRAY_SIZE][MAX_CHROM_SIZE], 
-    int son_index, int mother, int father)
+    evlearn_ctx* ctx, evlearn_gene* son_matrix, size_t son_index, size_t mother, size_t father)
 {
-    int select = rand()%2;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    evlearn_gene* son = son_matrix + son_index * ctx->chrom_stride;
+    evlearn_rng rng;
 
-    for (int i = 0; i < evlearn_chrom_array_size; i++) {
-        for (int j = 0; j < evlearn_chrom_size; j++)  {
-            double chrom_val = evlearn_population[mother].chromosome[i][j];
-            if (select) {
-                chrom_val = evlearn_population[father].chromosome[i][j];
+    // One random bit per gene selects the father.
+    seed_stream(ctx, &rng, son_index, EVLEARN_STREAM_CROSS);
+    rng_fill_bits(&rng, ctx->bits, (genes + 63) / 64);
+    STATS_ADD(ctx, rng_draws, (genes + 63) / 64);
+
+    cross_genes(son, 
+        ctx->population[mother].chromosome, ctx->population[father].chromosome, ctx->bits, genes);
+}
+
+/**
+ * \brief Implements the crossover method of the genetic algorithm.
+ * The specific method is Uniform crossover. The substitution is done
+ * in this step as well (with elitism k = 1): the offspring are bred
+ * into the spare chromosome buffer, the best individual is copied
+ * there once and then both buffers are swapped.
+ */
+void cross_population(evlearn_ctx* ctx)
+{
+    size_t best = find_best(ctx);
+    size_t mother = 0;
+    size_t s_count = 0;
+    size_t son_index = 0;
+    size_t father = 0;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    evlearn_gene* elite = ctx->offspring + best * ctx->chrom_stride;
+
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        mother = i;
+        s_count = ctx->population[mother].s_count;
+
+        if (s_count > 0) {
+            for (size_t j = 0; j < s_count; j++) {
+                // The son in the place of the best would be replaced by it.
+                if (son_index != best) {
+                    father = next_alive(ctx, mother + j + 1);
+                    cross_chromosomes(ctx, ctx->offspring, son_index, mother, father);
+                }
+                son_index++;
             }
-            son_matrix[son_index][i][j] = chrom_val;
-            select = rand()%2;
         }
     }
+
+    for (size_t j = 0; j < genes; j++) {
+        elite[j] = ctx->population[best].chromosome[j];
+    }
+
+    swap_chromosomes(ctx);
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        ctx->population[i].s_count = 0;
+    }
 }
 
 /**
- * \brief Implements the selection method of the genetic algorithm.
- * A tournament with k given by the argument k.
+ * \brief Makes the chromosomes bred into the spare buffer the ones of
+ * the population. Every engine breeds that way, so the evaluated
+ * generation stays in ctx->offspring until the next one is bred and
+ * the telemetry can take it from there instead of copying it.
+ */
+void swap_chromosomes(evlearn_ctx* ctx)
+{
+    evlearn_gene* swap = ctx->chromosomes;
+
+    ctx->chromosomes = ctx->offspring;
+    ctx->offspring = swap;
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        ctx->population[i].chromosome = ctx->chromosomes + i * ctx->chrom_stride;
+    }
+}
+
+/**
+ * \brief Scales the max mutation probability by how far the fitness
+ * is from the best one. A best fitness of 0 says nothing about it, as
+ * nothing is evaluated yet or nothing scores, so every individual gets
+ * the max probability instead of a division by 0.
  *
- * \param index recursive index
- * \param k number of individuals in the tournament
+ * \param fitness the fitness of the individual
+ * \param best_fitness the best fitness of the population
+ * \param m_prob max mutation probability
+ *
+ * \return the mutation probability of the individual
  */
-void select_population(int index, size_t k)
+double mutation_rate(double fitness, double best_fitness, double m_prob)
 {
-    int winner = 0;
-    double index_f = 0;
-    double winner_f = 0;
-    int* index_a = (int*) malloc(k * sizeof(int)) ;
-    int r = (int)f_rand(0, evlearn_population_size);
+    if (best_fitness == 0)
+        return m_prob;
+    return (1 - (fitness / best_fitness)) * m_prob;
+}
+
+/**
+ * \brief Implements the mutation method of the genetic algorithm.
+ * Uniform mutation inversely proportional to the fitness. The fitness
+ * is only reset once every individual is mutated, as every omega needs
+ * the best fitness.
+ *
+ * \param ctx the context
+ * \param m_prob max mutation probability
+ */
+void mutate_population(evlearn_ctx* ctx, double m_prob)
+{
+    mutate_counting(ctx, m_prob, NULL);
+}
+
+/**
+ * \brief Mutates the population like mutate_population(), storing the
+ * genes mutated in every individual.
+ *
+ * \param ctx the context
+ * \param m_prob max mutation probability
+ * \param mutated where to store the genes mutated in every individual, 0
+ * for the best one, or NULL
+ */
+void mutate_counting(evlearn_ctx* ctx, double m_prob, size_t* mutated)
+{
+    size_t best = find_best(ctx);
+    double best_f = ctx->population[best].fitness;
+    size_t cs = ctx->chrom_size;
+    size_t genes = ctx->chrom_array_size * cs;
+    evlearn_gene* threshold = ctx->uniform;
+    evlearn_gene* random = ctx->uniform + genes;
+    evlearn_rng rng;
+
+    for (size_t index = 0; index < ctx->population_size; index++) {
+        double omega = mutation_rate(ctx->population[index].fitness, best_f, m_prob);
+        size_t count = 0;
+
+        if (mutated != NULL) {
+            mutated[index] = 0;
+        }
+        if (index == best)
+            continue;
+
+        // A threshold and a candidate value for every gene, drawn at once.
+        seed_stream(ctx, &rng, index, EVLEARN_STREAM_MUTATE);
+        rng_fill_uniform_genes(&rng, ctx->uniform, genes * 2);
+        STATS_ADD(ctx, rng_draws, (genes * 2 * sizeof(evlearn_gene) + 7) / 8);
+
+        for (size_t i = 0; i < ctx->chrom_array_size; i++) {
+            count += mutate_genes(
+                ctx->population[index].chromosome + i * cs,
+                ctx->min_max_matrix + i * 2 * cs,
+                ctx->min_max_matrix + (i * 2 + 1) * cs,
+                threshold + i * cs,
+                random + i * cs,
+                omega,
+                cs);
+        }
+        ctx->mutations += count;
+        if (mutated != NULL) {
+            mutated[index] = count;
+        }
+    }
 
-    for (int i = 0; i < k; i++) {
-        index_a[i] = -1;
+    for (size_t index = 0; index < ctx->population_size; index++) {
+        ctx->population[index].fitness = 0;
     }
+}
 
-    if (r == evlearn_population_size) {
-        r--;
+/**
+ * \brief Computes the next generation. The algorithm uses an internal array
+ * with the population. The best individual so far can be retrieved using
+ * the function get_best_chromosome. With DE or CMA-ES as the engine the
+ * tournament size and the mutation probability are not used.
+ *
+ * \param ctx the context
+ * \param tournament_size Size of the tournament selection
+ * \param mutation_probability Probability of the mutation operator
+ * \param write_flag Set 1 to write results on the file 0 otherwise.
+ */
+void compute_next_generation(evlearn_ctx* ctx, size_t tournament_size, double mutation_probability)
+{
+    if (ctx->telemetry != NULL) {
+        begin_record(ctx);
     }
-    index_a[0] = r;
 
-    for (int i = 1 ; i < k; i++) {
-        r = (int)f_rand(0, evlearn_population_size);
-        if (r == evlearn_population_size) {
-            r--;
+    begin_generation(ctx);
+
+    if (ctx->engine != EVLEARN_ENGINE_GA) {
+        STATS_START(sample_start);
+        engine_next_generation(ctx);
+        STATS_TIME(ctx, EVLEARN_TIMER_SAMPLE, sample_start);
+    }
+    else {
+        STATS_START(select_start);
+        select_population(ctx, tournament_size);
+        STATS_TIME(ctx, EVLEARN_TIMER_SELECT, select_start);
+
+        if (ctx->surrogate != NULL) {
+            STATS_START(screen_start);
+            breed_screened(ctx, mutation_probability);
+            STATS_TIME(ctx, EVLEARN_TIMER_SCREEN, screen_start);
         }
-        while (contains(index_a, k, r)) {
-            r = (int)f_rand(0, evlearn_population_size);
-            if (r == evlearn_population_size) {
-                r--;
-            }
+        else {
+            STATS_START(cross_start);
+            cross_population(ctx);
+            STATS_TIME(ctx, EVLEARN_TIMER_CROSS, cross_start);
+
+            STATS_START(mutate_start);
+            mutate_population(ctx, mutation_probability);
+            STATS_TIME(ctx, EVLEARN_TIMER_MUTATE, mutate_start);
         }
-        index_a[i] = r;
     }
-    winner_f = evlearn_population[index_a[0]].fitness;
 
-    for (int i = 1; i < k; i++) {
-        index_f = evlearn_population[index_a[i]].fitness;
-        if (index_f > winner_f) {
-            winner = index_a[i];
-        }
+    if (ctx->telemetry != NULL) {
+        end_record(ctx);
     }
-    evlearn_population[winner].s_count++;
 
-    if(index < evlearn_population_size - 1) {
-        select_population(index + 1, k);
+    end_generation(ctx);
+}
+
+/**
+ * \brief Prepares the context for the operators of a generation,
+ * seeding the stream of the selection.
+ */
+void begin_generation(evlearn_ctx* ctx)
+{
+    ctx->mutations = 0;
+    seed_stream(ctx, &ctx->rng, ctx->population_size, 0);
+}
+
+/**
+ * \brief Finishes a generation once the operators are done. The
+ * fitness of the new population is 0, so the first individual is the
+ * best until it is evaluated.
+ */
+void end_generation(evlearn_ctx* ctx)
+{
+    STATS_ADD(ctx, genes_mutated, ctx->mutations);
+    STATS_ADD(ctx, generations, 1);
+    ctx->best = 0;
+    ctx->ranked = 0;
+    ctx->generation++;
+    ctx->ask_cursor = 0;
+}
+
+Individual get_best(const evlearn_ctx* ctx)
+{
+    return ctx->population[find_best(ctx)];
+}
+
+/**
+ * \brief Gets the genes of the best individual without copying them.
+ *
+ * \param ctx the context
+ *
+ * \return the chromosome of the best individual, valid until the
+ * next call to compute_next_generation()
+ */
+const evlearn_gene* get_best_chromosome(const evlearn_ctx* ctx)
+{
+    return ctx->population[ctx->best].chromosome;
+}
+
+/**
+ * \brief Sorts the ranking if any fitness changed since it was last
+ * sorted.
+ */
+static void update_ranking(evlearn_ctx* ctx)
+{
+    if (!ctx->ranked) {
+        STATS_START(start);
+        rank_population(ctx, ctx->ranking);
+        ctx->ranked = 1;
+        STATS_TIME(ctx, EVLEARN_TIMER_RANK, start);
     }
+}
 
-    free(index_a);
+/**
+ * \brief Gets the best individuals, from the best to the worse. The
+ * ranking is only sorted again if some fitness changed since the
+ * last call, so calling it every control step is free.
+ *
+ * \param ctx the context
+ * \param top array where the pointers to the individuals are stored,
+ * they are valid until the next call to compute_next_generation()
+ * \param k maximum number of individuals
+ *
+ * \return the number of individuals stored
+ */
+size_t get_top(evlearn_ctx* ctx, const Individual** top, size_t k)
+{
+    if (ctx->population == NULL)
+        return 0;
+
+    update_ranking(ctx);
+    if (k > ctx->population_size) {
+        k = ctx->population_size;
+    }
+    for (size_t i = 0; i < k; i++) {
+        top[i] = &ctx->population[ctx->ranking[i]];
+    }
+    return k;
 }
 
 /**
- * \brief Implements the crossover method of the genetic algorithm.
- * The specific method is Uniform crossover. The substitution is done
- * in this step as well (with elitism k = 1).
+ * \brief Gets the median fitness of the population, the mean of the
+ * two middle ones if the population size is even.
  */
-void cross_population()
+double get_median_fitness(evlearn_ctx* ctx)
 {
-    int best = find_best();
-    int mother = 0;
-    size_t s_count = 0;
-    int son_index = 0;
-    int father = 0;
-    double son_matrix[MAX_POPULATION_SIZE][MAX_CHROM_ARRAY_SIZE][MAX_CHROM_SIZE] = {0};
+    size_t n = ctx->population_size;
 
-    for (int i = 0; i < evlearn_population_size; i++) {
-        mother = i;
-        s_count = evlearn_population[mother].s_count;
+    if (ctx->population == NULL)
+        return 0;
 
-        if (s_count > 0) {
-            for (int j = 0; j < s_count; j++) {
-                father = next_alive(mother + j + 1);
-                cross_chromosomes(son_matrix, son_index, mother, father);
-                son_index++;
-            }
-        }
+    update_ranking(ctx);
+    if (n % 2 == 0) {
+        return (ctx->population[ctx->ranking[n / 2 - 1]].fitness + 
+            ctx->population[ctx->ranking[n / 2]].fitness) / 2;
     }
+    return ctx->population[ctx->ranking[n / 2]].fitness;
+}
 
-    for (int i = 0; i < evlearn_population_size; i++) {
-        if (i != best) {
-            for (int j = 0; j < evlearn_chrom_array_size; j++) {
-                for (int k = 0; k < evlearn_chrom_size; k++) {
-                    evlearn_population[i].chromosome[j][k] = son_matrix[i][j][k];
-                }
-            }
+/**
+ * \brief Hands out individuals of the current generation that have
+ * not been handed out yet, in order. Once compute_next_generation()
+ * is called the whole new generation is pending again. If the
+ * fitness cache is enabled, individuals found in it get the cached
+ * fitness and are not handed out.
+ *
+ * \param ctx the context
+ * \param indices array where the indices of the individuals are stored
+ * \param max_count maximum number of individuals to hand out
+ *
+ * \return the number of individuals handed out, 0 when there are none left
+ */
+size_t ask(evlearn_ctx* ctx, size_t* indices, size_t max_count)
+{
+    size_t count = 0;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    double fitness = 0;
+
+    while (count < max_count && ctx->ask_cursor < ctx->population_size) {
+        if (ctx->cache != NULL && 
+            cache_lookup(ctx->cache, ctx->population[ctx->ask_cursor].chromosome, genes, &fitness)) {
+            set_fitness(ctx, ctx->ask_cursor, fitness);
         }
-        evlearn_population[i].s_count = 0;
+        else {
+            indices[count] = ctx->ask_cursor;
+            count++;
+        }
+        ctx->ask_cursor++;
     }
+
+    return count;
 }
 
 /**
- * \brief Implements the mutation method of the genetic algorithm.
- * Uniform mutation inversely proportional to the fitness.
+ * \brief Gets the genes of an individual, chrom_array_size rows
+ * of chrom_size genes.
  *
- * \param index recursive index
- * \param m_prob max mutation probability
- * \param best current best individual
- */
-void mutate_population(int index, double m_prob, int best)
-{
-    int b = index == 0 ? find_best() : best;
-    double mp = m_prob;
-    double best_f = evlearn_population[b].fitness;
-    double omega = (1 - (evlearn_population[index].fitness / best_f)) * mp;
-    double threshold = 0;
-
-    if (index < evlearn_population_size) {
-        for (int i = 0; i < evlearn_chrom_array_size; i++) {
-            if (i != b) {
-                for (int j = 0; j < evlearn_chrom_size; j++) {
-                    threshold = f_rand(0, 1);
-                    if (threshold < omega) {
-                        evlearn_population[index].chromosome[i][j] = 
-                        f_rand(evlearn_min_max_matrix[i * 2][j], evlearn_min_max_matrix[i * 2 + 1][j]);
-                    }
-                }
-            }
-            evlearn_population[i].fitness = 0;
+ * \param ctx the context
+ * \param index index of the individual
+ *
+ * \return the chromosome of the individual
+ */
+const evlearn_gene* get_chromosome(const evlearn_ctx* ctx, size_t index)
+{
+    return ctx->population[index].chromosome;
+}
+
+/**
+ * \brief Stores the fitness of individuals handed out by ask(), and
+ * in the fitness cache and the archive of the surrogate if they are
+ * enabled. The estimates of individuals stopped by race() are not
+ * stored in either.
+ *
+ * \param ctx the context
+ * \param indices indices of the individuals
+ * \param fitness fitness of every individual in indices
+ * \param count number of individuals
+ */
+void tell(evlearn_ctx* ctx, const size_t* indices, const double* fitness, size_t count)
+{
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+
+    for (size_t i = 0; i < count; i++) {
+        int estimate = ctx->racing != NULL && racing_tell(ctx->racing, indices[i], fitness[i]);
+
+        set_fitness(ctx, indices[i], fitness[i]);
+        if (ctx->cache != NULL && !estimate) {
+            cache_insert(ctx->cache, ctx->population[indices[i]].chromosome, genes, fitness[i]);
+        }
+        if (ctx->surrogate != NULL && !estimate) {
+            surrogate_insert(ctx, ctx->population[indices[i]].chromosome, fitness[i]);
         }
-        mutate_population(index + 1, mp, b);
     }
 }
 
 /**
- * \brief Computes the next generation. The algorithm uses an internal array
- * with the population. The best individual so far can be retrieved using
- * the function get_best_chromosome.
- *
- * \param tournament_size Size of the tournament selection
- * \param mutation_probability Probability of the mutation operator
- * \param write_flag Set 1 to write results on the file 0 otherwise.
+ * Arguments shared by every task of an evaluate() batch.
  */
-void compute_next_generation(size_t tournament_size, double mutation_probability)
+typedef struct evaluate_job {
+    evlearn_ctx* ctx;
+    evlearn_fitness_fn fitness_fn;
+    void* user_data;
+} evaluate_job;
+
+/**
+ * \brief Pool task evaluating the individual at the position index
+ * of the batch.
+ */
+static void evaluate_task(size_t index, void* arg)
 {
-    select_population(0, tournament_size);
-    cross_population();
-    mutate_population(0, mutation_probability, 0);
+    evaluate_job* job = arg;
+    evlearn_ctx* ctx = job->ctx;
 
-    evlearn_generation++;
+    ctx->batch_fitness[index] = job->fitness_fn(
+        ctx->population[ctx->batch[index]].chromosome, 
+        ctx->chrom_array_size, 
+        ctx->chrom_size, 
+        job->user_data);
 }
 
-Individual get_best()
+/**
+ * \brief Evaluates every individual not handed out yet by ask() on a
+ * pool of threads and tells the results. The pool is kept between
+ * calls and only recreated if n_threads changes.
+ *
+ * \param ctx the context
+ * \param fitness_fn function computing the fitness of a chromosome
+ * \param user_data pointer passed to every call of fitness_fn
+ * \param n_threads number of threads evaluating, the caller included
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int evaluate(evlearn_ctx* ctx, evlearn_fitness_fn fitness_fn, void* user_data, size_t n_threads)
 {
-    return evlearn_population[find_best()];
-}
\ No newline at end of file
+    evaluate_job job = {ctx, fitness_fn, user_data};
+    size_t count = 0;
+
+    if (fitness_fn == NULL || n_threads == 0 || ctx->population == NULL)
+        return 1;
+
+    if (ctx->pool != NULL && pool_size(ctx->pool) != n_threads) {
+        pool_destroy(ctx->pool);
+        ctx->pool = NULL;
+    }
+    if (ctx->pool == NULL) {
+        ctx->pool = pool_create(n_threads);
+        if (ctx->pool == NULL)
+            return 1;
+    }
+
+    STATS_START(start);
+    count = ask(ctx, ctx->batch, ctx->population_size);
+    pool_run(ctx->pool, evaluate_task, &job, count);
+    tell(ctx, ctx->batch, ctx->batch_fitness, count);
+    STATS_TIME(ctx, EVLEARN_TIMER_EVALUATE, start);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * File: evlearn_apply.c
+ * Description: This is the implementation of the inference
+ *              declared in evlearn.h, the outputs of a
+ *              chromosome used as a weight matrix for one
+ *              input frame or a batch of them.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "../include/evlearn.h"
+
+#include <math.h>
+
+// Bytes of the input frames of a tile, kept under a half of a 32 KiB L1 data cache.
+#define TILE_BYTES 16384
+
+/**
+ * \brief Applies the activation of the row and truncates the output
+ * to its bounds.
+ */
+static double finish_output(
+    double value,
+    size_t row,
+    const evlearn_activation* activation,
+    const double* min,
+    const double* max)
+{
+    switch (activation ? activation[row] : EVLEARN_ACTIVATION_NONE) {
+    case EVLEARN_ACTIVATION_TANH:
+        value = tanh(value);
+        break;
+    case EVLEARN_ACTIVATION_RELU:
+        value = value > 0 ? value : 0;
+        break;
+    case EVLEARN_ACTIVATION_SIGMOID:
+        value = 1 / (1 + exp(-value));
+        break;
+    default:
+        break;
+    }
+    if (min && value < min[row]) {
+        value = min[row];
+    }
+    if (max && value > max[row]) {
+        value = max[row];
+    }
+    return value;
+}
+
+/**
+ * \brief Main function of the inference, one dot product per row of
+ * the chromosome.
+ */
+void evlearn_apply(
+    const evlearn_gene* chromosome,
+    size_t rows,
+    size_t cols,
+    const double* inputs,
+    double* outputs,
+    const evlearn_activation* activation,
+    const double* min,
+    const double* max)
+{
+    for (size_t r = 0; r < rows; r++) {
+        outputs[r] = finish_output(
+            dot_genes(chromosome + r * cols, inputs, cols), r, activation, min, max);
+    }
+}
+
+/**
+ * \brief Applies every chromosome to every frame. The frames are
+ * walked in tiles that fit in the L1 cache, so frames shared by the
+ * individuals are read from memory once per tile and not once per
+ * individual. Inside a tile every row of the chromosome is loaded
+ * once for four frames, which dot4_genes() multiplies with four
+ * accumulators at the same time.
+ */
+void evlearn_apply_batch(
+    const evlearn_gene* const* chromosomes,
+    size_t individuals,
+    size_t rows,
+    size_t cols,
+    const double* frames,
+    size_t n_frames,
+    size_t individual_stride,
+    double* outputs,
+    const evlearn_activation* activation,
+    const double* min,
+    const double* max)
+{
+    size_t tile = cols > 0 ? TILE_BYTES / (cols * sizeof(double)) / 4 * 4 : n_frames;
+
+    tile = tile < 4 ? 4 : tile;
+    for (size_t first = 0; first < n_frames; first += tile) {
+        size_t last = first + tile < n_frames ? first + tile : n_frames;
+
+        for (size_t i = 0; i < individuals; i++) {
+            const evlearn_gene* w = chromosomes[i];
+            const double* in = frames + i * individual_stride;
+            double* out = outputs + i * n_frames * rows;
+            size_t f = first;
+
+            for (; f + 4 <= last; f += 4) {
+                for (size_t r = 0; r < rows; r++) {
+                    double dots[4];
+
+                    dot4_genes(w + r * cols, in + f * cols, cols, cols, dots);
+                    for (size_t k = 0; k < 4; k++) {
+                        out[(f + k) * rows + r] =
+                            finish_output(dots[k], r, activation, min, max);
+                    }
+                }
+            }
+            for (; f < last; f++) {
+                evlearn_apply(
+                    w, rows, cols, in + f * cols, out + f * rows, activation, min, max);
+            }
+        }
+    }
+}
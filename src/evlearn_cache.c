@@ -0,0 +1,318 @@
+/**
+ * File: evlearn_cache.c
+ * Description: This is the implementation of the fitness
+ *              cache declared in evlearn.h.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NONE UINT32_MAX
+
+/**
+ * A cached chromosome. chain links the entries of the same bucket,
+ * newer and older link every entry in the LRU list.
+ */
+typedef struct cache_entry {
+    uint64_t hash;
+    double fitness;
+    uint32_t chain;
+    uint32_t newer;
+    uint32_t older;
+} cache_entry;
+
+/**
+ * The entries and their genes are preallocated for capacity
+ * chromosomes of genes values, so the cache never allocates after
+ * it is created. buckets has a power of two size of at least twice
+ * the capacity. newest and oldest are the ends of the LRU list, the
+ * oldest entry is the one reused when the cache is full.
+ */
+struct evlearn_cache {
+    size_t capacity;
+    size_t genes;
+    size_t size;
+    cache_entry* entries;
+    evlearn_gene* genes_block;
+    uint32_t* buckets;
+    size_t bucket_mask;
+    uint32_t newest;
+    uint32_t oldest;
+
+    evlearn_cache_stats stats;
+};
+
+/**
+ * \brief Hash of the bit patterns of the genes, one multiply and
+ * rotation per gene and a splitmix64 finalizer.
+ */
+static uint64_t hash_genes(const evlearn_gene* genes, size_t count)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ count;
+    uint64_t word = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(&word, &genes[i], sizeof(evlearn_gene));
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h = (h << 31) | (h >> 33);
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/**
+ * \brief Empties the cache and sets the number of genes of the
+ * chromosomes it stores, allocating the genes block if it changes.
+ *
+ * \return 0 for success, 1 if there is no memory
+ */
+static int reset(evlearn_cache* cache, size_t genes)
+{
+    if (genes != cache->genes) {
+        free(cache->genes_block);
+        cache->genes_block = NULL;
+        cache->genes = 0;
+        if (genes > 0) {
+            if (genes > SIZE_MAX / sizeof(evlearn_gene) / cache->capacity)
+                return 1;
+            cache->genes_block = malloc(cache->capacity * genes * sizeof(evlearn_gene));
+            if (cache->genes_block == NULL)
+                return 1;
+        }
+        cache->genes = genes;
+    }
+    for (size_t i = 0; i <= cache->bucket_mask; i++) {
+        cache->buckets[i] = NONE;
+    }
+    cache->size = 0;
+    cache->newest = NONE;
+    cache->oldest = NONE;
+    cache->stats.size = 0;
+
+    return 0;
+}
+
+static void unlink_lru(evlearn_cache* cache, uint32_t index)
+{
+    cache_entry* entry = &cache->entries[index];
+
+    if (entry->newer != NONE) {
+        cache->entries[entry->newer].older = entry->older;
+    }
+    else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NONE) {
+        cache->entries[entry->older].newer = entry->newer;
+    }
+    else {
+        cache->oldest = entry->newer;
+    }
+}
+
+static void push_newest(evlearn_cache* cache, uint32_t index)
+{
+    cache_entry* entry = &cache->entries[index];
+
+    entry->newer = NONE;
+    entry->older = cache->newest;
+    if (cache->newest != NONE) {
+        cache->entries[cache->newest].newer = index;
+    }
+    cache->newest = index;
+    if (cache->oldest == NONE) {
+        cache->oldest = index;
+    }
+}
+
+/**
+ * \brief Removes an entry from the chain of its bucket.
+ */
+static void unlink_bucket(evlearn_cache* cache, uint32_t index)
+{
+    uint32_t* link = &cache->buckets[cache->entries[index].hash & cache->bucket_mask];
+
+    while (*link != index) {
+        link = &cache->entries[*link].chain;
+    }
+    *link = cache->entries[index].chain;
+}
+
+/**
+ * \brief Finds the entry of a chromosome.
+ *
+ * \return the index of the entry or NONE
+ */
+static uint32_t find(const evlearn_cache* cache, const evlearn_gene* genes, uint64_t hash)
+{
+    uint32_t index = cache->buckets[hash & cache->bucket_mask];
+
+    while (index != NONE) {
+        if (cache->entries[index].hash == hash &&
+            memcmp(cache->genes_block + index * cache->genes, genes,
+                cache->genes * sizeof(evlearn_gene)) == 0)
+            return index;
+        index = cache->entries[index].chain;
+    }
+    return NONE;
+}
+
+/**
+ * \brief Looks a chromosome up, making it the most recently used if
+ * it is found.
+ *
+ * \param cache the cache
+ * \param genes the chromosome
+ * \param count number of genes of the chromosome
+ * \param fitness where the cached fitness is stored
+ *
+ * \return 1 if it was found, 0 otherwise
+ */
+int cache_lookup(evlearn_cache* cache, const evlearn_gene* genes, size_t count, double* fitness)
+{
+    uint32_t index = NONE;
+
+    if (count != cache->genes && reset(cache, count))
+        return 0;
+
+    index = find(cache, genes, hash_genes(genes, count));
+    if (index == NONE) {
+        cache->stats.misses++;
+        return 0;
+    }
+
+    unlink_lru(cache, index);
+    push_newest(cache, index);
+    *fitness = cache->entries[index].fitness;
+    cache->stats.hits++;
+    return 1;
+}
+
+/**
+ * \brief Stores the fitness of a chromosome, evicting the least
+ * recently used one if the cache is full.
+ *
+ * \param cache the cache
+ * \param genes the chromosome
+ * \param count number of genes of the chromosome
+ * \param fitness its fitness
+ */
+void cache_insert(evlearn_cache* cache, const evlearn_gene* genes, size_t count, double fitness)
+{
+    uint64_t hash = 0;
+    uint32_t index = NONE;
+    uint32_t* bucket = NULL;
+
+    if (count != cache->genes && reset(cache, count))
+        return;
+
+    hash = hash_genes(genes, count);
+    index = find(cache, genes, hash);
+    if (index != NONE) {
+        unlink_lru(cache, index);
+    }
+    else {
+        if (cache->size < cache->capacity) {
+            index = (uint32_t) cache->size;
+            cache->size++;
+        }
+        else {
+            index = cache->oldest;
+            unlink_lru(cache, index);
+            unlink_bucket(cache, index);
+            cache->stats.evictions++;
+        }
+        bucket = &cache->buckets[hash & cache->bucket_mask];
+        cache->entries[index].hash = hash;
+        cache->entries[index].chain = *bucket;
+        *bucket = index;
+        memcpy(cache->genes_block + index * count, genes, count * sizeof(evlearn_gene));
+    }
+
+    cache->entries[index].fitness = fitness;
+    push_newest(cache, index);
+    cache->stats.size = cache->size;
+}
+
+/**
+ * \brief Frees the cache.
+ *
+ * \param cache the cache, NULL is ignored
+ */
+void cache_destroy(evlearn_cache* cache)
+{
+    if (cache == NULL)
+        return;
+
+    free(cache->entries);
+    free(cache->genes_block);
+    free(cache->buckets);
+    free(cache);
+}
+
+/**
+ * \brief Enables the fitness cache of the context, replacing the
+ * one it had. From now on ask() skips every individual whose
+ * chromosome is in the cache, giving it the cached fitness, and
+ * tell() stores the fitness it gets. It is meant for deterministic
+ * fitness functions, as a chromosome is only evaluated once while
+ * it stays in the cache.
+ *
+ * \param ctx the context
+ * \param capacity maximum number of chromosomes stored, 0 disables it
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int set_cache(evlearn_ctx* ctx, size_t capacity)
+{
+    evlearn_cache* cache = NULL;
+    size_t buckets = 1;
+
+    cache_destroy(ctx->cache);
+    ctx->cache = NULL;
+
+    if (capacity == 0)
+        return 0;
+    if (capacity >= NONE)
+        return 1;
+
+    while (buckets < capacity * 2) {
+        buckets *= 2;
+    }
+    cache = calloc(1, sizeof(evlearn_cache));
+    if (cache == NULL)
+        return 1;
+    cache->capacity = capacity;
+    cache->bucket_mask = buckets - 1;
+    cache->entries = malloc(capacity * sizeof(cache_entry));
+    cache->buckets = malloc(buckets * sizeof(uint32_t));
+    if (cache->entries == NULL || cache->buckets == NULL ||
+        reset(cache, ctx->chrom_array_size * ctx->chrom_size)) {
+        cache_destroy(cache);
+        return 1;
+    }
+    cache->stats.capacity = capacity;
+
+    ctx->cache = cache;
+    return 0;
+}
+
+/**
+ * \brief Gets the hits, misses and evictions of the fitness cache
+ * since it was enabled. They are all 0 if it is disabled.
+ */
+evlearn_cache_stats get_cache_stats(const evlearn_ctx* ctx)
+{
+    evlearn_cache_stats stats = {0};
+
+    if (ctx->cache != NULL) {
+        stats = ctx->cache->stats;
+    }
+    return stats;
+}
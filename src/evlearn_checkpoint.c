@@ -0,0 +1,642 @@
+/**
+ * File: evlearn_checkpoint.c
+ * Description: This is the implementation of the binary
+ *              checkpoints declared in evlearn.h.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#define _GNU_SOURCE
+
+#include "evlearn_ctx.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "EVLCKPT"
+
+// Largest value of a FIXED16 gene.
+#define FIXED16_MAX 65535
+
+/**
+ * Header at the beginning of every checkpoint. It is followed by the
+ * min max matrix as doubles, the chromosomes (chrom_stride genes of
+ * gene_format each, so the block is a copy of the arena when it is
+ * the format of evlearn_gene) and the fitness of every individual,
+ * at the given offsets, then engine_count doubles with the state of
+ * the engine. Every block starts at an EVLEARN_ALIGNMENT boundary of
+ * the file. Values are stored in the byte order of the machine that
+ * wrote it. Version 1 ends before gene_format and its genes are
+ * doubles, version 2 ends before engine and it is always the genetic
+ * algorithm.
+ */
+typedef struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t population_size;
+    uint64_t chrom_array_size;
+    uint64_t chrom_size;
+    uint64_t chrom_stride;
+    uint64_t generation;
+    uint64_t seed;
+    uint64_t rng[4];
+    uint64_t min_max_offset;
+    uint64_t chromosomes_offset;
+    uint64_t fitness_offset;
+    uint64_t file_size;
+    uint32_t gene_format;
+    uint32_t reserved;
+    uint32_t engine;
+    uint32_t reserved_engine;
+    uint64_t engine_offset;
+    uint64_t engine_count;
+} checkpoint_header;
+
+#define HEADER_V1_SIZE offsetof(checkpoint_header, gene_format)
+#define HEADER_V2_SIZE offsetof(checkpoint_header, engine)
+
+/**
+ * \brief Gets the bytes of a gene in the given format.
+ */
+static size_t gene_bytes(evlearn_gene_format format)
+{
+    switch (format) {
+    case EVLEARN_GENES_DOUBLE:
+        return sizeof(double);
+    case EVLEARN_GENES_FLOAT:
+        return sizeof(float);
+    case EVLEARN_GENES_FIXED16:
+        return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+/**
+ * \brief Stores a gene at the position i of a block in the given
+ * format. FIXED16 maps {min, max} to {0, FIXED16_MAX}, rounding.
+ */
+static void encode_gene(
+    void* block, size_t i, evlearn_gene_format format, double gene, double min, double max)
+{
+    float f = (float) gene;
+    uint16_t q = 0;
+
+    switch (format) {
+    case EVLEARN_GENES_DOUBLE:
+        memcpy((char*) block + i * sizeof(double), &gene, sizeof(double));
+        break;
+    case EVLEARN_GENES_FLOAT:
+        memcpy((char*) block + i * sizeof(float), &f, sizeof(float));
+        break;
+    case EVLEARN_GENES_FIXED16:
+        if (max > min) {
+            q = (uint16_t) lrint(truncate_value((gene - min) / (max - min), 0, 1) * FIXED16_MAX);
+        }
+        memcpy((char*) block + i * sizeof(uint16_t), &q, sizeof(uint16_t));
+        break;
+    }
+}
+
+/**
+ * \brief Reads the gene at the position i of a block in the given
+ * format.
+ */
+static double decode_gene(
+    const void* block, size_t i, evlearn_gene_format format, double min, double max)
+{
+    double d = 0;
+    float f = 0;
+    uint16_t q = 0;
+
+    switch (format) {
+    case EVLEARN_GENES_DOUBLE:
+        memcpy(&d, (const char*) block + i * sizeof(double), sizeof(double));
+        return d;
+    case EVLEARN_GENES_FLOAT:
+        memcpy(&f, (const char*) block + i * sizeof(float), sizeof(float));
+        return f;
+    case EVLEARN_GENES_FIXED16:
+        memcpy(&q, (const char*) block + i * sizeof(uint16_t), sizeof(uint16_t));
+        return min + q * (max - min) / FIXED16_MAX;
+    }
+    return 0;
+}
+
+/**
+ * \brief Gets the format of the genes of a checkpoint, version 1
+ * only had doubles.
+ */
+static evlearn_gene_format header_format(const checkpoint_header* header)
+{
+    return header->version == 1 ? EVLEARN_GENES_DOUBLE : (evlearn_gene_format) header->gene_format;
+}
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + EVLEARN_ALIGNMENT - 1) / EVLEARN_ALIGNMENT * EVLEARN_ALIGNMENT;
+}
+
+/**
+ * \brief Writes zeros up to the given offset of the file.
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int pad_to(FILE* file, uint64_t offset)
+{
+    static const char zeros[EVLEARN_ALIGNMENT] = {0};
+    long position = ftell(file);
+
+    if (position < 0 || (uint64_t) position > offset)
+        return 1;
+    return fwrite(zeros, 1, offset - position, file) != offset - position;
+}
+
+/**
+ * \brief Fills the header describing the checkpoint of a context.
+ * The chromosomes keep the stride of the arena in the format of
+ * evlearn_gene, in any other format they are packed.
+ */
+static void fill_header(const evlearn_ctx* ctx, checkpoint_header* header)
+{
+    uint64_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    uint64_t stride = ctx->checkpoint_format == NATIVE_FORMAT ? ctx->chrom_stride : genes;
+    uint64_t min_max_bytes = genes * 2 * sizeof(double);
+    uint64_t chromosomes_bytes = ctx->population_size * stride * gene_bytes(ctx->checkpoint_format);
+
+    memset(header, 0, sizeof(checkpoint_header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header->version = EVLEARN_CHECKPOINT_VERSION;
+    header->header_size = sizeof(checkpoint_header);
+    header->population_size = ctx->population_size;
+    header->chrom_array_size = ctx->chrom_array_size;
+    header->chrom_size = ctx->chrom_size;
+    header->chrom_stride = stride;
+    header->generation = ctx->generation;
+    header->seed = ctx->seed;
+    memcpy(header->rng, ctx->rng.s, sizeof(header->rng));
+    header->min_max_offset = align_offset(sizeof(checkpoint_header));
+    header->chromosomes_offset = align_offset(header->min_max_offset + min_max_bytes);
+    header->fitness_offset = align_offset(header->chromosomes_offset + chromosomes_bytes);
+    header->engine_offset = align_offset(header->fitness_offset +
+        ctx->population_size * sizeof(double));
+    header->engine_count = engine_save(ctx, NULL);
+    header->file_size = header->engine_offset + header->engine_count * sizeof(double);
+    header->gene_format = ctx->checkpoint_format;
+    header->engine = ctx->engine;
+}
+
+#ifdef EVLEARN_STATS
+/**
+ * \brief Gets the size in bytes of the checkpoint of a context.
+ */
+static uint64_t checkpoint_size(const evlearn_ctx* ctx)
+{
+    checkpoint_header header;
+
+    fill_header(ctx, &header);
+    return header.file_size;
+}
+#endif
+
+/**
+ * \brief Writes the checkpoint of the context to an open file.
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int write_checkpoint(const evlearn_ctx* ctx, FILE* file)
+{
+    checkpoint_header header;
+    size_t cs = ctx->chrom_size;
+    size_t genes = ctx->chrom_array_size * cs;
+    size_t chromosomes_count = ctx->population_size * ctx->chrom_stride;
+    evlearn_gene_format format = ctx->checkpoint_format;
+    size_t bytes = gene_bytes(format);
+    void* packed = NULL;
+    int result = 0;
+
+    fill_header(ctx, &header);
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return 1;
+    if (pad_to(file, header.min_max_offset))
+        return 1;
+    for (size_t i = 0; i < genes * 2; i++) {
+        double bound = ctx->min_max_matrix[i];
+
+        if (fwrite(&bound, sizeof(double), 1, file) != 1)
+            return 1;
+    }
+    if (pad_to(file, header.chromosomes_offset))
+        return 1;
+    if (format == NATIVE_FORMAT) {
+        if (fwrite(ctx->chromosomes, bytes, chromosomes_count, file) != chromosomes_count)
+            return 1;
+    }
+    else {
+        packed = malloc(genes * bytes);
+        if (packed == NULL)
+            return 1;
+        for (size_t i = 0; i < ctx->population_size && result == 0; i++) {
+            for (size_t j = 0; j < genes; j++) {
+                encode_gene(packed, j, format, ctx->population[i].chromosome[j],
+                    ctx->min_max_matrix[(j / cs * 2) * cs + j % cs],
+                    ctx->min_max_matrix[(j / cs * 2 + 1) * cs + j % cs]);
+            }
+            result = fwrite(packed, bytes, genes, file) != genes;
+        }
+        free(packed);
+        if (result)
+            return 1;
+    }
+    if (pad_to(file, header.fitness_offset))
+        return 1;
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        if (fwrite(&ctx->population[i].fitness, sizeof(double), 1, file) != 1)
+            return 1;
+    }
+    if (pad_to(file, header.engine_offset))
+        return 1;
+    if (header.engine_count > 0) {
+        double* state = malloc(header.engine_count * sizeof(double));
+
+        if (state == NULL)
+            return 1;
+        engine_save(ctx, state);
+        result = fwrite(state, sizeof(double), header.engine_count, file) != header.engine_count;
+        free(state);
+    }
+
+    return result;
+}
+
+/**
+ * \brief Flushes the directory that holds a file, so a file renamed
+ * into it survives a crash.
+ *
+ * \param file_path path of the file
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int sync_directory(const char* file_path)
+{
+    const char* slash = strrchr(file_path, '/');
+    char* dir_path = NULL;
+    size_t length = 0;
+    int fd = -1;
+    int result = 1;
+
+    if (slash == NULL) {
+        fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    else {
+        length = slash == file_path ? 1 : (size_t)(slash - file_path);
+        dir_path = malloc(length + 1);
+        if (dir_path == NULL)
+            return 1;
+        memcpy(dir_path, file_path, length);
+        dir_path[length] = 0;
+        fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        free(dir_path);
+    }
+    if (fd < 0)
+        return 1;
+    if (!fsync(fd)) {
+        result = 0;
+    }
+    close(fd);
+
+    return result;
+}
+
+/**
+ * \brief Writes a checkpoint of the context. The data is written to
+ * a temporary file next to file_path, synced and renamed over it, so
+ * file_path always holds either the previous or the new checkpoint,
+ * even if the process dies while writing.
+ *
+ * \param ctx the context
+ * \param file_path path of the checkpoint
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int save_checkpoint(const evlearn_ctx* ctx, const char* file_path)
+{
+    size_t length = 0;
+    char* temp_path = NULL;
+    FILE* file = NULL;
+    int fd = -1;
+    int result = 1;
+
+    if (ctx == NULL || ctx->population == NULL || file_path == NULL)
+        return 1;
+
+    STATS_START(start);
+    length = strlen(file_path);
+    temp_path = malloc(length + sizeof(".XXXXXX"));
+    if (temp_path == NULL)
+        return 1;
+    memcpy(temp_path, file_path, length);
+    memcpy(temp_path + length, ".XXXXXX", sizeof(".XXXXXX"));
+
+    fd = mkstemp(temp_path);
+    if (fd < 0) {
+        free(temp_path);
+        return 1;
+    }
+    file = fdopen(fd, "wb");
+    if (file == NULL) {
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        return 1;
+    }
+
+    if (!write_checkpoint(ctx, file) && !fflush(file) && !fsync(fd)) {
+        result = 0;
+    }
+    if (fclose(file)) {
+        result = 1;
+    }
+    if (result == 0 && (rename(temp_path, file_path) || sync_directory(file_path))) {
+        result = 1;
+    }
+    if (result) {
+        unlink(temp_path);
+    }
+    else {
+        STATS_ADD(ctx, bytes_written, checkpoint_size(ctx));
+    }
+    free(temp_path);
+    STATS_TIME(ctx, EVLEARN_TIMER_IO, start);
+
+    return result;
+}
+
+/**
+ * \brief Checks that the header describes a checkpoint that fits in
+ * a file of the given size.
+ *
+ * \return 1 if it is valid, 0 otherwise
+ */
+static int valid_header(const checkpoint_header* header, uint64_t file_size)
+{
+    uint64_t genes = 0;
+    uint64_t bytes = 0;
+
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) ||
+        header->file_size != file_size)
+        return 0;
+    if (!(header->version == 1 && header->header_size == HEADER_V1_SIZE) &&
+        !(header->version == 2 && header->header_size == HEADER_V2_SIZE &&
+            header->gene_format <= EVLEARN_GENES_FIXED16) &&
+        !(header->version == EVLEARN_CHECKPOINT_VERSION && 
+            header->header_size == sizeof(checkpoint_header) &&
+            header->gene_format <= EVLEARN_GENES_FIXED16 &&
+            header->engine <= EVLEARN_ENGINE_CMAES &&
+            header->engine_offset <= file_size &&
+            header->engine_count <= (file_size - header->engine_offset) / sizeof(double)))
+        return 0;
+    bytes = gene_bytes(header_format(header));
+
+    if (header->population_size == 0 || header->chrom_array_size == 0 || header->chrom_size == 0 ||
+        header->chrom_size > UINT32_MAX || header->chrom_array_size > UINT32_MAX)
+        return 0;
+    genes = header->chrom_array_size * header->chrom_size;
+
+    if (header->chrom_stride < genes || 
+        header->population_size > file_size / bytes / header->chrom_stride)
+        return 0;
+
+    // The blocks are compared by their free space so crafted offsets and
+    // sizes cannot wrap around.
+    if (header->min_max_offset < header->header_size ||
+        header->chromosomes_offset < header->min_max_offset ||
+        header->fitness_offset < header->chromosomes_offset ||
+        header->fitness_offset > file_size)
+        return 0;
+
+    return genes <= (header->chromosomes_offset - header->min_max_offset) / (2 * sizeof(double)) &&
+        header->population_size * header->chrom_stride * bytes <=
+            header->fitness_offset - header->chromosomes_offset &&
+        header->population_size <= (file_size - header->fitness_offset) / sizeof(double);
+}
+
+/**
+ * \brief Checks that a valid checkpoint fits the context, with its
+ * sizes and bounds, and that its engine block has the size of the
+ * state of its engine.
+ *
+ * \param ctx the context
+ * \param header the header of the checkpoint, already validated
+ * \param map the checkpoint
+ * \param keep_sizes if not 0 the sizes and bounds have to be the ones
+ * of the context
+ *
+ * \return 1 if it can be loaded, 0 otherwise
+ */
+static int fits_context(
+    const evlearn_ctx* ctx, const checkpoint_header* header, const char* map, int keep_sizes)
+{
+    size_t genes = header->chrom_array_size * header->chrom_size;
+
+    if (header->version == EVLEARN_CHECKPOINT_VERSION && header->engine_count !=
+            engine_count((evlearn_engine) header->engine, header->population_size, genes))
+        return 0;
+    if (!keep_sizes)
+        return 1;
+
+    if (ctx->population == NULL ||
+        header->population_size != ctx->population_size ||
+        header->chrom_array_size != ctx->chrom_array_size ||
+        header->chrom_size != ctx->chrom_size)
+        return 0;
+    for (size_t i = 0; i < genes * 2; i++) {
+        if ((evlearn_gene) decode_gene(map + header->min_max_offset, i, EVLEARN_GENES_DOUBLE, 0, 0)
+                != ctx->min_max_matrix[i])
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief Checks if a file starts like a checkpoint.
+ *
+ * \param file_path path of the file
+ *
+ * \return 1 if it is a checkpoint, 0 otherwise
+ */
+int is_checkpoint(const char* file_path)
+{
+    char magic[8] = {0};
+    FILE* file = fopen(file_path, "rb");
+
+    if (file == NULL)
+        return 0;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)) {
+        magic[0] = 0;
+    }
+    fclose(file);
+
+    return memcmp(magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0;
+}
+
+/**
+ * \brief Loads a checkpoint into the context. The file is mapped in
+ * memory and copied straight into the arena. Nothing is written to
+ * the context before the whole checkpoint is checked, so it is left
+ * as it was if the file is not valid. If it is allocated again and
+ * there is no memory, it is left released.
+ *
+ * \param ctx the context
+ * \param file_path path of the checkpoint
+ * \param keep_sizes if not 0 the sizes and bounds of the context are
+ * kept and have to match the checkpoint, otherwise it is allocated
+ * again with the sizes of the checkpoint and takes its bounds
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int restore_checkpoint(evlearn_ctx* ctx, const char* file_path, int keep_sizes)
+{
+    struct stat st;
+    const checkpoint_header* header = NULL;
+    const char* map = NULL;
+    const char* chromosomes = NULL;
+    const double* fitness = NULL;
+    evlearn_gene_format format = EVLEARN_GENES_DOUBLE;
+    evlearn_engine_state engine = {EVLEARN_ENGINE_GA, NULL, NULL};
+    int has_engine = 0;
+    size_t genes = 0;
+    size_t cs = 0;
+    int fd = -1;
+    int result = 1;
+
+    STATS_START(start);
+    fd = open(file_path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+    if (fstat(fd, &st) || (size_t) st.st_size < HEADER_V1_SIZE) {
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+    madvise((void*) map, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    header = (const checkpoint_header*) map;
+    if (!valid_header(header, st.st_size) || !fits_context(ctx, header, map, keep_sizes))
+        goto unmap;
+    // The engine is built before anything is written, a state that does not fit leaves the
+    // context as it was.
+    has_engine = header->version == EVLEARN_CHECKPOINT_VERSION;
+    if (has_engine && engine_load(&engine, (evlearn_engine) header->engine,
+            header->population_size, header->chrom_array_size * header->chrom_size,
+            (const double*) (map + header->engine_offset), header->engine_count))
+        goto unmap;
+    if (!keep_sizes && allocate_ctx(ctx, header->population_size, header->chrom_array_size,
+            header->chrom_size))
+        goto unmap;
+
+    format = header_format(header);
+    cs = ctx->chrom_size;
+    genes = ctx->chrom_array_size * cs;
+    chromosomes = map + header->chromosomes_offset;
+    fitness = (const double*) (map + header->fitness_offset);
+
+    if (!keep_sizes) {
+        for (size_t i = 0; i < genes * 2; i++) {
+            ctx->min_max_matrix[i] = (evlearn_gene) decode_gene(
+                map + header->min_max_offset, i, EVLEARN_GENES_DOUBLE, 0, 0);
+        }
+    }
+    if (format == NATIVE_FORMAT && header->chrom_stride == ctx->chrom_stride) {
+        memcpy(ctx->chromosomes, chromosomes, 
+            ctx->population_size * ctx->chrom_stride * sizeof(evlearn_gene));
+    }
+    else if (format == NATIVE_FORMAT) {
+        for (size_t i = 0; i < ctx->population_size; i++) {
+            memcpy(ctx->chromosomes + i * ctx->chrom_stride, 
+                chromosomes + i * header->chrom_stride * sizeof(evlearn_gene), 
+                genes * sizeof(evlearn_gene));
+        }
+    }
+    else {
+        for (size_t i = 0; i < ctx->population_size; i++) {
+            for (size_t j = 0; j < genes; j++) {
+                ctx->chromosomes[i * ctx->chrom_stride + j] = (evlearn_gene) decode_gene(
+                    chromosomes, i * header->chrom_stride + j, format, 
+                    ctx->min_max_matrix[(j / cs * 2) * cs + j % cs],
+                    ctx->min_max_matrix[(j / cs * 2 + 1) * cs + j % cs]);
+            }
+        }
+    }
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        ctx->population[i].chromosome = ctx->chromosomes + i * ctx->chrom_stride;
+        ctx->population[i].fitness = fitness[i];
+        ctx->population[i].s_count = 0;
+    }
+    refresh_ranking(ctx);
+    if (has_engine) {
+        engine_swap(ctx, &engine);
+    }
+
+    ctx->generation = header->generation;
+    ctx->seed = header->seed;
+    memcpy(ctx->rng.s, header->rng, sizeof(header->rng));
+    ctx->ask_cursor = 0;
+    result = 0;
+
+unmap:
+    engine_discard(&engine);
+    munmap((void*) map, st.st_size);
+    STATS_TIME(ctx, EVLEARN_TIMER_IO, start);
+    return result;
+}
+
+/**
+ * \brief Loads a checkpoint written by save_checkpoint(). The
+ * context takes the sizes, bounds, seed and generation stored in it,
+ * so it does not need to be initialized before. If the checkpoint is
+ * not valid the context is left as it was.
+ *
+ * \param ctx the context
+ * \param file_path path of the checkpoint
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int load_checkpoint(evlearn_ctx* ctx, const char* file_path)
+{
+    if (ctx == NULL || file_path == NULL)
+        return 1;
+
+    return restore_checkpoint(ctx, file_path, 0);
+}
+
+/**
+ * \brief Chooses the format of the genes written by save_checkpoint().
+ * Writing them in a smaller format than evlearn_gene loses precision,
+ * FIXED16 keeps about 5 significant digits within the bounds of every
+ * gene.
+ *
+ * \param ctx the context
+ * \param format the format
+ *
+ * \return 0 for success, 1 if the format is not valid
+ */
+int set_checkpoint_format(evlearn_ctx* ctx, evlearn_gene_format format)
+{
+    if (format < EVLEARN_GENES_DOUBLE || format > EVLEARN_GENES_FIXED16)
+        return 1;
+
+    ctx->checkpoint_format = format;
+    return 0;
+}
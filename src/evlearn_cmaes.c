@@ -0,0 +1,510 @@
+/**
+ * File: evlearn_cmaes.c
+ * Description: This is the implementation of the CMA-ES engine,
+ *              the covariance matrix adaptation evolution
+ *              strategy, selected with set_engine() in
+ *              evlearn.h.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Values of the state saved before the vectors.
+#define CMAES_HEADER 5
+
+// Sweeps of the Jacobi eigendecomposition, it converges in far fewer.
+#define MAX_SWEEPS 64
+
+/**
+ * The search runs in the box of the bounds scaled to [0, 1] in every
+ * gene, lower and range map it back. The last individual of the
+ * population is the elite, the best one so far evaluated again, and
+ * the others the lambda samples of N(mean, sigma^2 C).
+ *
+ * weights, mu_eff and the rates are the constants of the strategy
+ * for the sizes, from Hansen's tutorial. C is kept whole but only its
+ * upper triangle is computed, B and D are its eigenvectors, in the
+ * columns, and the square roots of its eigenvalues. They are computed
+ * again every few updates, decomposed is the update they are of.
+ *
+ * started is 0 until the first update, the population evaluated before
+ * set_engine() was not drawn from the distribution. order, steps,
+ * z and work are scratch buffers.
+ */
+struct evlearn_cmaes {
+    size_t n;
+    size_t lambda;
+    size_t mu;
+    double* weights;
+    double mu_eff;
+    double c_sigma;
+    double d_sigma;
+    double c_c;
+    double c_1;
+    double c_mu;
+    double chi_n;
+
+    double step;
+    double sigma;
+    int started;
+    uint64_t updates;
+    uint64_t decomposed;
+    double* mean;
+    double* pc;
+    double* ps;
+    double* C;
+    double* B;
+    double* D;
+
+    double* lower;
+    double* range;
+
+    size_t* order;
+    double* steps;
+    double* z;
+    double* work;
+};
+
+/**
+ * \brief Frees the state of CMA-ES.
+ *
+ * \param cmaes the state, NULL is ignored
+ */
+void cmaes_destroy(evlearn_cmaes* cmaes)
+{
+    if (cmaes == NULL)
+        return;
+
+    free(cmaes->weights);
+    free(cmaes->mean);
+    free(cmaes->pc);
+    free(cmaes->ps);
+    free(cmaes->C);
+    free(cmaes->B);
+    free(cmaes->D);
+    free(cmaes->lower);
+    free(cmaes->range);
+    free(cmaes->order);
+    free(cmaes->steps);
+    free(cmaes->z);
+    free(cmaes->work);
+    free(cmaes);
+}
+
+/**
+ * \brief Gets gene j of a chromosome in the [0, 1] box.
+ */
+static double normalize(const evlearn_cmaes* cmaes, const evlearn_gene* chromosome, size_t j)
+{
+    return cmaes->range[j] > 0 ? (chromosome[j] - cmaes->lower[j]) / cmaes->range[j] : 0;
+}
+
+/**
+ * \brief Allocates the state of CMA-ES for a population of the given
+ * sizes, with the constants of the strategy and nothing else set.
+ *
+ * \return the state, NULL on error
+ */
+static evlearn_cmaes* cmaes_allocate(size_t population_size, size_t n, double step)
+{
+    evlearn_cmaes* cmaes = NULL;
+    size_t lambda = population_size - 1;
+    size_t mu = lambda / 2;
+    double sum = 0;
+    double squares = 0;
+
+    if (!(step > 0) || population_size < 4 || n == 0)
+        return NULL;
+
+    cmaes = calloc(1, sizeof(evlearn_cmaes));
+    if (cmaes == NULL)
+        return NULL;
+    cmaes->n = n;
+    cmaes->lambda = lambda;
+    cmaes->mu = mu;
+    cmaes->step = step;
+    cmaes->sigma = step;
+    cmaes->weights = malloc(sizeof(double) * mu);
+    cmaes->mean = calloc(n, sizeof(double));
+    cmaes->pc = calloc(n, sizeof(double));
+    cmaes->ps = calloc(n, sizeof(double));
+    cmaes->C = calloc(n * n, sizeof(double));
+    cmaes->B = calloc(n * n, sizeof(double));
+    cmaes->D = malloc(sizeof(double) * n);
+    cmaes->lower = malloc(sizeof(double) * n);
+    cmaes->range = malloc(sizeof(double) * n);
+    cmaes->order = malloc(sizeof(size_t) * population_size);
+    cmaes->steps = malloc(sizeof(double) * mu * n);
+    cmaes->z = malloc(sizeof(double) * n);
+    cmaes->work = malloc(sizeof(double) * n * n);
+    if (cmaes->weights == NULL || cmaes->mean == NULL || cmaes->pc == NULL ||
+        cmaes->ps == NULL || cmaes->C == NULL || cmaes->B == NULL || cmaes->D == NULL ||
+        cmaes->lower == NULL || cmaes->range == NULL || cmaes->order == NULL ||
+        cmaes->steps == NULL || cmaes->z == NULL || cmaes->work == NULL) {
+        cmaes_destroy(cmaes);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < mu; i++) {
+        cmaes->weights[i] = log(mu + 0.5) - log(i + 1.0);
+        sum += cmaes->weights[i];
+    }
+    for (size_t i = 0; i < mu; i++) {
+        cmaes->weights[i] /= sum;
+        squares += cmaes->weights[i] * cmaes->weights[i];
+    }
+    cmaes->mu_eff = 1 / squares;
+    cmaes->c_sigma = (cmaes->mu_eff + 2) / (n + cmaes->mu_eff + 5);
+    cmaes->d_sigma = 1 + cmaes->c_sigma +
+        2 * fmax(0, sqrt((cmaes->mu_eff - 1) / (n + 1.0)) - 1);
+    cmaes->c_c = (4 + cmaes->mu_eff / n) / (n + 4 + 2 * cmaes->mu_eff / n);
+    cmaes->c_1 = 2 / ((n + 1.3) * (n + 1.3) + cmaes->mu_eff);
+    cmaes->c_mu = fmin(1 - cmaes->c_1,
+        2 * (cmaes->mu_eff - 2 + 1 / cmaes->mu_eff) / ((n + 2.0) * (n + 2.0) + cmaes->mu_eff));
+    cmaes->chi_n = sqrt((double) n) * (1 - 1 / (4.0 * n) + 1 / (21.0 * n * n));
+    return cmaes;
+}
+
+/**
+ * \brief Takes the bounds of the context, which map the genes to the
+ * [0, 1] box the strategy works in.
+ */
+void cmaes_bounds(evlearn_cmaes* cmaes, const evlearn_ctx* ctx)
+{
+    size_t cs = ctx->chrom_size;
+
+    for (size_t j = 0; j < cmaes->n; j++) {
+        cmaes->lower[j] = ctx->min_max_matrix[(j / cs * 2) * cs + j % cs];
+        cmaes->range[j] = ctx->min_max_matrix[(j / cs * 2 + 1) * cs + j % cs] - cmaes->lower[j];
+    }
+}
+
+/**
+ * \brief Creates the state of CMA-ES for the population of the
+ * context, centred on the mean of the population with C = I.
+ *
+ * \param ctx the context
+ * \param step initial sigma, a fraction of the range of the bounds
+ *
+ * \return the state, NULL on error
+ */
+evlearn_cmaes* cmaes_create(const evlearn_ctx* ctx, double step)
+{
+    size_t n = ctx->chrom_array_size * ctx->chrom_size;
+    evlearn_cmaes* cmaes = cmaes_allocate(ctx->population_size, n, step);
+
+    if (cmaes == NULL)
+        return NULL;
+    cmaes_bounds(cmaes, ctx);
+
+    for (size_t j = 0; j < n; j++) {
+        cmaes->C[j * n + j] = 1;
+        cmaes->B[j * n + j] = 1;
+        cmaes->D[j] = 1;
+        for (size_t i = 0; i < ctx->population_size; i++) {
+            cmaes->mean[j] += normalize(cmaes, ctx->population[i].chromosome, j);
+        }
+        cmaes->mean[j] /= ctx->population_size;
+    }
+    return cmaes;
+}
+
+/**
+ * \brief Decomposes C into B diag(D^2) B^T with the cyclic Jacobi
+ * method, which is exact enough for a symmetric matrix of this size
+ * and needs no other buffer than work.
+ */
+static void decompose(evlearn_cmaes* cmaes)
+{
+    size_t n = cmaes->n;
+    double* a = cmaes->work;
+    double* v = cmaes->B;
+
+    memcpy(a, cmaes->C, sizeof(double) * n * n);
+    for (size_t i = 0; i < n * n; i++) {
+        v[i] = i % (n + 1) == 0;
+    }
+
+    for (int sweep = 0; sweep < MAX_SWEEPS; sweep++) {
+        double off = 0;
+        double diagonal = 0;
+
+        for (size_t p = 0; p < n; p++) {
+            diagonal += a[p * n + p] * a[p * n + p];
+            for (size_t q = p + 1; q < n; q++) {
+                off += a[p * n + q] * a[p * n + q];
+            }
+        }
+        if (off <= 1e-30 * diagonal)
+            break;
+
+        for (size_t p = 0; p < n; p++) {
+            for (size_t q = p + 1; q < n; q++) {
+                double apq = a[p * n + q];
+                double theta = 0;
+                double t = 0;
+                double c = 0;
+                double s = 0;
+
+                if (apq == 0)
+                    continue;
+                theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+                t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                c = 1 / sqrt(t * t + 1);
+                s = t * c;
+                for (size_t k = 0; k < n; k++) {
+                    double akp = a[k * n + p];
+                    double akq = a[k * n + q];
+
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (size_t k = 0; k < n; k++) {
+                    double apk = a[p * n + k];
+                    double aqk = a[q * n + k];
+
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (size_t k = 0; k < n; k++) {
+                    double vkp = v[k * n + p];
+                    double vkq = v[k * n + q];
+
+                    v[k * n + p] = c * vkp - s * vkq;
+                    v[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        cmaes->D[i] = sqrt(fmax(a[i * n + i], 1e-20));
+    }
+    cmaes->decomposed = cmaes->updates;
+}
+
+/**
+ * \brief Moves the distribution towards the mu best samples of the
+ * evaluated population: the weighted recombination of the mean, the
+ * evolution paths, the rank one and rank mu updates of C and the step
+ * size control of sigma. C costs O(mu n^2), only its upper triangle is
+ * computed, and it is decomposed again once it changed enough for
+ * sampling, every 1 / (10 n (c_1 + c_mu)) updates.
+ */
+static void update(evlearn_ctx* ctx, evlearn_cmaes* cmaes)
+{
+    size_t n = cmaes->n;
+    size_t elite = ctx->population_size - 1;
+    double* old_mean = cmaes->z;
+    double* y = cmaes->work;
+    double ps_norm = 0;
+    double hsig = 0;
+    double rank_one = 0;
+    double keep = 1 - cmaes->c_1 - cmaes->c_mu;
+
+    // The mu best samples, the elite is not one of them.
+    rank_population(ctx, cmaes->order);
+    for (size_t i = 0, k = 0; k < cmaes->mu; i++) {
+        if (cmaes->order[i] != elite) {
+            cmaes->order[k] = cmaes->order[i];
+            k++;
+        }
+    }
+
+    memcpy(old_mean, cmaes->mean, sizeof(double) * n);
+    for (size_t j = 0; j < n; j++) {
+        cmaes->mean[j] = 0;
+    }
+    for (size_t k = 0; k < cmaes->mu; k++) {
+        const evlearn_gene* x = ctx->population[cmaes->order[k]].chromosome;
+
+        for (size_t j = 0; j < n; j++) {
+            double gene = normalize(cmaes, x, j);
+
+            cmaes->steps[k * n + j] = (gene - old_mean[j]) / cmaes->sigma;
+            cmaes->mean[j] += cmaes->weights[k] * gene;
+        }
+    }
+
+    // y is the step of the mean, C^(-1/2) y = B D^-1 B^T y goes through the old mean buffer.
+    for (size_t j = 0; j < n; j++) {
+        y[j] = (cmaes->mean[j] - old_mean[j]) / cmaes->sigma;
+    }
+    for (size_t i = 0; i < n; i++) {
+        double sum = 0;
+
+        for (size_t j = 0; j < n; j++) {
+            sum += cmaes->B[j * n + i] * y[j];
+        }
+        old_mean[i] = sum / cmaes->D[i];
+    }
+    for (size_t j = 0; j < n; j++) {
+        double sum = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            sum += cmaes->B[j * n + i] * old_mean[i];
+        }
+        cmaes->ps[j] = (1 - cmaes->c_sigma) * cmaes->ps[j] +
+            sqrt(cmaes->c_sigma * (2 - cmaes->c_sigma) * cmaes->mu_eff) * sum;
+        ps_norm += cmaes->ps[j] * cmaes->ps[j];
+    }
+    ps_norm = sqrt(ps_norm);
+    hsig = ps_norm / sqrt(1 - pow(1 - cmaes->c_sigma, 2.0 * (cmaes->updates + 1))) <
+        (1.4 + 2 / (n + 1.0)) * cmaes->chi_n;
+    for (size_t j = 0; j < n; j++) {
+        cmaes->pc[j] = (1 - cmaes->c_c) * cmaes->pc[j] +
+            hsig * sqrt(cmaes->c_c * (2 - cmaes->c_c) * cmaes->mu_eff) * y[j];
+    }
+
+    rank_one = (1 - hsig) * cmaes->c_c * (2 - cmaes->c_c);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i; j < n; j++) {
+            double rank_mu = 0;
+
+            for (size_t k = 0; k < cmaes->mu; k++) {
+                rank_mu += cmaes->weights[k] * cmaes->steps[k * n + i] * cmaes->steps[k * n + j];
+            }
+            cmaes->C[i * n + j] = keep * cmaes->C[i * n + j] +
+                cmaes->c_1 * (cmaes->pc[i] * cmaes->pc[j] + rank_one * cmaes->C[i * n + j]) +
+                cmaes->c_mu * rank_mu;
+            cmaes->C[j * n + i] = cmaes->C[i * n + j];
+        }
+    }
+
+    cmaes->sigma *= exp(cmaes->c_sigma / cmaes->d_sigma * (ps_norm / cmaes->chi_n - 1));
+    cmaes->sigma = fmin(fmax(cmaes->sigma, 1e-12), 1e3);
+    cmaes->updates++;
+    if ((cmaes->updates - cmaes->decomposed) * 10.0 * n * (cmaes->c_1 + cmaes->c_mu) >= 1) {
+        decompose(cmaes);
+    }
+}
+
+/**
+ * \brief Runs a generation of CMA-ES. The evaluated samples update
+ * the distribution, then the best individual is kept as the elite and
+ * the rest of the population is drawn from N(mean, sigma^2 C) as
+ * mean + sigma B D z, truncated to the bounds. They are drawn into the
+ * spare chromosome buffer, which is swapped in.
+ */
+void cmaes_next_generation(evlearn_ctx* ctx)
+{
+    evlearn_cmaes* cmaes = ctx->cmaes;
+    size_t n = cmaes->n;
+    evlearn_rng rng;
+
+    if (cmaes->started) {
+        update(ctx, cmaes);
+    }
+    cmaes->started = 1;
+
+    for (size_t s = 0; s < cmaes->lambda; s++) {
+        evlearn_gene* x = ctx->offspring + s * ctx->chrom_stride;
+
+        rng_seed(&rng, ctx->seed, ctx->generation,
+            (uint64_t) s * EVLEARN_STREAMS + EVLEARN_STREAM_MUTATE);
+        rng_fill_normal(&rng, cmaes->z, n);
+        for (size_t i = 0; i < n; i++) {
+            cmaes->z[i] *= cmaes->D[i];
+        }
+        for (size_t j = 0; j < n; j++) {
+            double y = 0;
+
+            for (size_t i = 0; i < n; i++) {
+                y += cmaes->B[j * n + i] * cmaes->z[i];
+            }
+            y = truncate_value(cmaes->mean[j] + cmaes->sigma * y, 0, 1);
+            x[j] = (evlearn_gene) (cmaes->lower[j] + y * cmaes->range[j]);
+        }
+        ctx->mutations += n;
+    }
+    memcpy(ctx->offspring + cmaes->lambda * ctx->chrom_stride,
+        ctx->population[ctx->best].chromosome, sizeof(evlearn_gene) * n);
+
+    swap_chromosomes(ctx);
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        ctx->population[i].fitness = 0;
+    }
+}
+
+/**
+ * \brief Gets the number of values of the state for n genes, or
+ * SIZE_MAX if it does not fit in a size_t.
+ */
+size_t cmaes_count(size_t n)
+{
+    if (n > 0 && n > SIZE_MAX / 4 / n)
+        return SIZE_MAX;
+    return CMAES_HEADER + 4 * n + 2 * n * n;
+}
+
+/**
+ * \brief Copies the state to a checkpoint: the initial step, sigma,
+ * started, the updates, the update B and D are of, the mean, the
+ * paths, C, B and D. B and D are saved rather than computed again so
+ * that a run goes on exactly as if it had not stopped.
+ *
+ * \param ctx the context
+ * \param state where the values are stored, NULL to count them
+ *
+ * \return the number of values
+ */
+size_t cmaes_save(const evlearn_ctx* ctx, double* state)
+{
+    const evlearn_cmaes* cmaes = ctx->cmaes;
+    size_t n = cmaes->n;
+    double* vectors = NULL;
+
+    if (state == NULL)
+        return cmaes_count(n);
+    vectors = state + CMAES_HEADER;
+    state[0] = cmaes->step;
+    state[1] = cmaes->sigma;
+    state[2] = cmaes->started;
+    state[3] = (double) cmaes->updates;
+    state[4] = (double) cmaes->decomposed;
+    memcpy(vectors, cmaes->mean, sizeof(double) * n);
+    memcpy(vectors + n, cmaes->pc, sizeof(double) * n);
+    memcpy(vectors + 2 * n, cmaes->ps, sizeof(double) * n);
+    memcpy(vectors + 3 * n, cmaes->D, sizeof(double) * n);
+    memcpy(vectors + 4 * n, cmaes->C, sizeof(double) * n * n);
+    memcpy(vectors + 4 * n + n * n, cmaes->B, sizeof(double) * n * n);
+
+    return cmaes_count(n);
+}
+
+/**
+ * \brief Builds the state saved by cmaes_save() for a population of
+ * the given sizes. The bounds are not part of it, cmaes_bounds() takes
+ * them from the context it is loaded into.
+ *
+ * \return the state, NULL if it does not fit the sizes
+ */
+evlearn_cmaes* cmaes_load(size_t population_size, size_t n, const double* state, size_t count)
+{
+    const double* vectors = NULL;
+    evlearn_cmaes* cmaes = NULL;
+
+    if (count != cmaes_count(n) || !(state[1] > 0))
+        return NULL;
+    vectors = state + CMAES_HEADER;
+    cmaes = cmaes_allocate(population_size, n, state[0]);
+    if (cmaes == NULL)
+        return NULL;
+    cmaes->sigma = state[1];
+    cmaes->started = state[2] != 0;
+    cmaes->updates = (uint64_t) state[3];
+    cmaes->decomposed = (uint64_t) state[4];
+    memcpy(cmaes->mean, vectors, sizeof(double) * n);
+    memcpy(cmaes->pc, vectors + n, sizeof(double) * n);
+    memcpy(cmaes->ps, vectors + 2 * n, sizeof(double) * n);
+    memcpy(cmaes->D, vectors + 3 * n, sizeof(double) * n);
+    memcpy(cmaes->C, vectors + 4 * n, sizeof(double) * n * n);
+    memcpy(cmaes->B, vectors + 4 * n + n * n, sizeof(double) * n * n);
+    return cmaes;
+}
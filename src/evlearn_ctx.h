@@ -0,0 +1,291 @@
+/**
+ * File: evlearn_ctx.h
+ * Description: This is a private header with the definition
+ *              of the evlearn context, shared by the source
+ *              files of the library.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "../include/evlearn.h"
+#include "evlearn_pool.h"
+#include "evlearn_stats.h"
+
+#include <stdio.h>
+
+#pragma once
+
+typedef struct evlearn_telemetry evlearn_telemetry;
+typedef struct evlearn_cache evlearn_cache;
+typedef struct evlearn_steady evlearn_steady;
+typedef struct evlearn_racing evlearn_racing;
+typedef struct evlearn_farm evlearn_farm;
+typedef struct evlearn_surrogate evlearn_surrogate;
+typedef struct evlearn_de evlearn_de;
+typedef struct evlearn_cmaes evlearn_cmaes;
+
+/**
+ * This is the state of one run of the algorithm. Every public
+ * function takes it, so several runs can live in the same process
+ * as long as each context is used by one thread at a time.
+ *
+ * population_size, chrom_array_size and chrom_size are the relevant
+ * user defined sizes, then there is the population itself and the
+ * pointers to the files that store the chromosomes of the best
+ * generation, so that it can be reused. The population will be 
+ * initialized to random values or to the values in the best
+ * generation on the file. 
+ *
+ * The population, two chromosome buffers and the min max matrix
+ * live in a single arena allocated by init() and sized to the
+ * user given sizes. chromosomes is the buffer the population
+ * points to and offspring the one the next generation is bred
+ * into, they are swapped every generation. chrom_stride is the
+ * number of genes reserved for every chromosome, rounded up so
+ * that each one starts at an EVLEARN_ALIGNMENT boundary.
+ *
+ * min_max_matrix contains the limits of the chromosome values so that the
+ * initialize population function provides a random value for each chromosome
+ * component within the given range. There are two vectors for each chromosome,
+ * the first one contains the lower limit and the second the upper limit.
+ * They should be changed depending of the specific application. By default, the
+ * init function initializes every even vector to -1, (min_value) and every odd 
+ * to 1 (max_value) if the NULL value is passed.
+ * Example:
+ * Chromosome -> 
+ * [
+ *  [0, 0, 0], first chromosome row
+ *  [0, 0, 0]  second chromosome row
+ * ]
+ * 
+ * min_max -> 
+ * [
+ *  [-1, -1, -1], first chromosome row min
+ *  [ 1,  1,  1], first chromosome row max
+ *  [-1, -1, -1], second chromosome row min
+ *  [ 1,  1,  1]  secord chromosome row max
+ * ]
+ * 
+ * Note that this would be the default min max matrix but elements of every vector
+ * can be different.
+ *
+ * seed identifies the run, rng is the stream of the current
+ * generation used by the selection. The crossover and the mutation
+ * seed their own stream per individual, drawing in bulk into
+ * uniform and bits, two scratch buffers of the arena. round is the
+ * candidate being bred when the surrogate oversamples the offspring,
+ * every one has streams of its own, and 0 otherwise.
+ *
+ * selection is the method used by select_population(), working on
+ * order, a scratch buffer of population_size indices in the arena.
+ * engine is the algorithm breeding the generations, de and cmaes
+ * are the state of the one in use, NULL for the others.
+ *
+ * best is the index of the best individual, kept up to date by
+ * set_fitness(). ranking holds the indices of the population from the
+ * best to the worst, it is sorted again when needed if ranked is 0.
+ *
+ * The last fields are the state of the ask / tell interface. ask_cursor
+ * is the next individual of the generation to be handed out by ask(),
+ * evaluate() keeps the indices and results of its batch in batch and
+ * batch_fitness (both in the arena) and runs it on pool.
+ *
+ * telemetry is NULL unless open_telemetry() was called, mutations
+ * counts the genes mutated in the current generation for it.
+ * cache is NULL unless set_cache() enabled it. checkpoint_format
+ * is the format of the genes written by save_checkpoint(). steady is
+ * NULL unless start_steady_state() was called, racing unless
+ * set_racing() was, farm unless open_farm() was and surrogate unless
+ * set_surrogate() was.
+ *
+ * instruments holds the timers and counters of the STATS_* macros,
+ * it only exists if the library is built with EVLEARN_STATS.
+ */
+struct evlearn_ctx {
+    size_t population_size;
+    size_t chrom_array_size;
+    size_t chrom_size;
+    size_t chrom_stride;
+    size_t generation;
+    Individual* population;
+    evlearn_gene* chromosomes;
+    evlearn_gene* offspring;
+    evlearn_gene* min_max_matrix;
+    void* arena;
+    FILE* output_file;
+    FILE* input_file;
+
+    uint64_t seed;
+    evlearn_rng rng;
+    evlearn_gene* uniform;
+    uint64_t* bits;
+    size_t round;
+
+    evlearn_selection selection;
+    double rank_pressure;
+    size_t* order;
+    evlearn_engine engine;
+    evlearn_de* de;
+    evlearn_cmaes* cmaes;
+
+    size_t best;
+    size_t* ranking;
+    int ranked;
+
+    size_t ask_cursor;
+    size_t* batch;
+    double* batch_fitness;
+    evlearn_pool* pool;
+
+    evlearn_telemetry* telemetry;
+    size_t mutations;
+
+    evlearn_cache* cache;
+    evlearn_gene_format checkpoint_format;
+    evlearn_steady* steady;
+    evlearn_racing* racing;
+    evlearn_farm* farm;
+    evlearn_surrogate* surrogate;
+
+#ifdef EVLEARN_STATS
+    evlearn_instruments* instruments;
+#endif
+};
+
+// Format of evlearn_gene in a checkpoint.
+#ifdef EVLEARN_FLOAT_GENES
+#define NATIVE_FORMAT EVLEARN_GENES_FLOAT
+#else
+#define NATIVE_FORMAT EVLEARN_GENES_DOUBLE
+#endif
+
+// Releases the context and allocates its arena for the given sizes, which are stored in it.
+int allocate_ctx(
+    evlearn_ctx* ctx, size_t population_size, size_t chrom_array_size, size_t chrom_size);
+
+// Checks if the file starts with the magic of a checkpoint.
+int is_checkpoint(const char* file_path);
+
+// Loads a checkpoint, keeping the sizes of the context if keep_sizes is not 0.
+int restore_checkpoint(evlearn_ctx* ctx, const char* file_path, int keep_sizes);
+
+// Starts the record of the evaluated generation for the telemetry thread, which computes its
+// statistics, or drops it if the thread fell behind.
+void begin_record(evlearn_ctx* ctx);
+
+// Hands the record of begin_record() to the telemetry thread, with the mutations of the generation
+// and the evaluated chromosomes, which the generation left in ctx->offspring.
+void end_record(evlearn_ctx* ctx);
+
+// Waits for the telemetry thread and gives the arena back the chromosome buffers it holds.
+void return_chromosomes(evlearn_ctx* ctx);
+
+// Looks a chromosome up in the cache, storing its fitness if it is found. It returns 1 on a hit.
+int cache_lookup(evlearn_cache* cache, const evlearn_gene* genes, size_t count, double* fitness);
+
+// Stores the fitness of a chromosome in the cache.
+void cache_insert(evlearn_cache* cache, const evlearn_gene* genes, size_t count, double fitness);
+
+// Frees the cache, NULL is ignored.
+void cache_destroy(evlearn_cache* cache);
+
+// Frees the state of the steady state mode, NULL is ignored.
+void steady_destroy(evlearn_steady* steady);
+
+// Frees the state of the racing, NULL is ignored.
+void racing_destroy(evlearn_racing* racing);
+
+// Takes the final fitness of an individual for the elite. It returns 1 if it is an estimate.
+int racing_tell(evlearn_racing* racing, size_t index, double fitness);
+
+// Frees the surrogate, NULL is ignored.
+void surrogate_destroy(evlearn_surrogate* surrogate);
+
+// Archives an evaluated chromosome for the surrogate.
+void surrogate_insert(evlearn_ctx* ctx, const evlearn_gene* chromosome, double fitness);
+
+// Crosses and mutates the selected population, oversampled and screened by the surrogate.
+void breed_screened(evlearn_ctx* ctx, double mutation_probability);
+
+// Frees the state of the engine and goes back to the genetic algorithm.
+void engine_destroy(evlearn_ctx* ctx);
+
+// Breeds the next generation with the engine of the context, DE or CMA-ES.
+void engine_next_generation(evlearn_ctx* ctx);
+
+// Copies the state of the engine to state, if it is not NULL, and returns the number of values.
+size_t engine_save(const evlearn_ctx* ctx, double* state);
+
+// Gets the number of values engine_save() stores for an engine and the given sizes.
+size_t engine_count(evlearn_engine engine, size_t population_size, size_t genes);
+
+// Engine built from a checkpoint before it is put into the context.
+typedef struct evlearn_engine_state {
+    evlearn_engine engine;
+    evlearn_de* de;
+    evlearn_cmaes* cmaes;
+} evlearn_engine_state;
+
+// Builds the engine from the values saved by engine_save() for a population of the given sizes. It
+// returns 1 if they do not fit. engine_swap() moves it into the context and engine_discard() frees
+// it otherwise.
+int engine_load(evlearn_engine_state* loaded, evlearn_engine engine,
+    size_t population_size, size_t genes, const double* state, size_t count);
+void engine_swap(evlearn_ctx* ctx, evlearn_engine_state* loaded);
+void engine_discard(evlearn_engine_state* loaded);
+
+// The same for DE/rand/1/bin, de_create() returns NULL if F, CR or the population are not valid.
+evlearn_de* de_create(const evlearn_ctx* ctx, double weight, double crossover);
+void de_destroy(evlearn_de* de);
+void de_next_generation(evlearn_ctx* ctx);
+size_t de_count(size_t population_size, size_t genes);
+size_t de_save(const evlearn_ctx* ctx, double* state);
+evlearn_de* de_load(size_t population_size, size_t genes, const double* state, size_t count);
+
+// The same for CMA-ES, cmaes_create() returns NULL if the step or the population are not valid.
+evlearn_cmaes* cmaes_create(const evlearn_ctx* ctx, double step);
+void cmaes_destroy(evlearn_cmaes* cmaes);
+void cmaes_next_generation(evlearn_ctx* ctx);
+size_t cmaes_count(size_t n);
+size_t cmaes_save(const evlearn_ctx* ctx, double* state);
+evlearn_cmaes* cmaes_load(size_t population_size, size_t n, const double* state, size_t count);
+void cmaes_bounds(evlearn_cmaes* cmaes, const evlearn_ctx* ctx);
+
+// Adds to the s_count of every individual the times it is selected, population_size in total.
+void select_population(evlearn_ctx* ctx, size_t k);
+
+// Runs one tournament of k contestants drawn from rng and returns the winner, or the loser. The
+// individuals set in skip, if it is not NULL, are passed over.
+size_t run_tournament(evlearn_ctx* ctx, evlearn_rng* rng, size_t k, int replacement, int loser,
+    const unsigned char* skip);
+
+// Sorts the indices of the population from the best to the worst fitness into order.
+void rank_population(const evlearn_ctx* ctx, size_t* order);
+
+// Sets the fitness of an individual, keeping the best one up to date.
+void set_fitness(evlearn_ctx* ctx, size_t index, double fitness);
+
+// Finds the best individual again after the fitness of the population changed at once.
+void refresh_ranking(evlearn_ctx* ctx);
+
+// A generation is begin_generation(), select_population(), cross_population(),
+// mutate_population(ctx, mutation_probability) and end_generation().
+void begin_generation(evlearn_ctx* ctx);
+
+// Breeds the offspring of the selected individuals and swaps them in, keeping the best one.
+void cross_population(evlearn_ctx* ctx);
+
+// Makes the chromosomes bred into ctx->offspring the population, leaving the evaluated ones there.
+void swap_chromosomes(evlearn_ctx* ctx);
+
+// Mutates every individual but the best and resets the fitness of the population.
+void mutate_population(evlearn_ctx* ctx, double m_prob);
+
+// Like mutate_population(), also storing the genes mutated in every individual if mutated is set.
+void mutate_counting(evlearn_ctx* ctx, double m_prob, size_t* mutated);
+
+// Mutation probability of an individual of the given fitness, m_prob if the best fitness is 0.
+double mutation_rate(double fitness, double best_fitness, double m_prob);
+
+void end_generation(evlearn_ctx* ctx);
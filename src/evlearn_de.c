@@ -0,0 +1,236 @@
+/**
+ * File: evlearn_de.c
+ * Description: This is the implementation of the differential
+ *              evolution engine, DE/rand/1/bin, selected with
+ *              set_engine() in evlearn.h.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Values of the state saved before the targets.
+#define DE_HEADER 3
+
+/**
+ * The population holds the trial vectors to evaluate, the targets
+ * they compete with are kept apart with their fitness. started is 0
+ * until the first evaluated population becomes the targets.
+ */
+struct evlearn_de {
+    double weight;
+    double crossover;
+    int started;
+    evlearn_gene* targets;
+    double* target_fitness;
+};
+
+/**
+ * \brief Frees the state of the differential evolution.
+ *
+ * \param de the state, NULL is ignored
+ */
+void de_destroy(evlearn_de* de)
+{
+    if (de == NULL)
+        return;
+
+    free(de->targets);
+    free(de->target_fitness);
+    free(de);
+}
+
+/**
+ * \brief Allocates the state of the differential evolution for a
+ * population of the given sizes.
+ *
+ * \return the state, NULL on error
+ */
+static evlearn_de* de_allocate(
+    size_t population_size, size_t genes, double weight, double crossover)
+{
+    evlearn_de* de = NULL;
+
+    if (!(weight > 0 && weight <= 2) || !(crossover >= 0 && crossover <= 1) ||
+        population_size < 4)
+        return NULL;
+
+    de = calloc(1, sizeof(evlearn_de));
+    if (de == NULL)
+        return NULL;
+    de->weight = weight;
+    de->crossover = crossover;
+    de->targets = malloc(sizeof(evlearn_gene) * population_size * genes);
+    de->target_fitness = malloc(sizeof(double) * population_size);
+    if (de->targets == NULL || de->target_fitness == NULL) {
+        de_destroy(de);
+        return NULL;
+    }
+    return de;
+}
+
+/**
+ * \brief Creates the state of the differential evolution for the
+ * population of the context.
+ *
+ * \param ctx the context
+ * \param weight differential weight F, within (0, 2]
+ * \param crossover crossover rate CR, within [0, 1]
+ *
+ * \return the state, NULL on error
+ */
+evlearn_de* de_create(const evlearn_ctx* ctx, double weight, double crossover)
+{
+    return de_allocate(
+        ctx->population_size, ctx->chrom_array_size * ctx->chrom_size, weight, crossover);
+}
+
+/**
+ * \brief Draws an individual other than the ones in taken.
+ */
+static size_t draw_other(evlearn_rng* rng, size_t n, const size_t* taken, size_t count)
+{
+    for (;;) {
+        size_t index = (size_t) (rng_uniform(rng) * n);
+        size_t t = 0;
+
+        while (t < count && taken[t] != index) {
+            t++;
+        }
+        if (t == count)
+            return index;
+    }
+}
+
+/**
+ * \brief Runs a generation of DE/rand/1/bin. Every trial that is at
+ * least as good as its target replaces it, then every individual gets
+ * a new trial: a random target plus F times the difference of two
+ * others, crossed with its own target gene by gene with probability
+ * CR, at least one gene, and truncated to the bounds. The slot of the
+ * best target evaluates it again instead, so the best individual is
+ * never lost, like the elite of the genetic algorithm. The trials are
+ * bred into the spare chromosome buffer, which is swapped in.
+ */
+void de_next_generation(evlearn_ctx* ctx)
+{
+    evlearn_de* de = ctx->de;
+    size_t n = ctx->population_size;
+    size_t cs = ctx->chrom_size;
+    size_t genes = ctx->chrom_array_size * cs;
+    size_t best = 0;
+    evlearn_rng rng;
+
+    for (size_t i = 0; i < n; i++) {
+        if (!de->started || ctx->population[i].fitness >= de->target_fitness[i]) {
+            memcpy(de->targets + i * genes, ctx->population[i].chromosome,
+                sizeof(evlearn_gene) * genes);
+            de->target_fitness[i] = ctx->population[i].fitness;
+        }
+        if (de->target_fitness[i] > de->target_fitness[best]) {
+            best = i;
+        }
+    }
+    de->started = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        evlearn_gene* trial = ctx->offspring + i * ctx->chrom_stride;
+        const evlearn_gene* target = de->targets + i * genes;
+        size_t taken[4] = {i};
+        size_t forced = 0;
+
+        ctx->population[i].fitness = 0;
+        if (i == best) {
+            memcpy(trial, target, sizeof(evlearn_gene) * genes);
+            continue;
+        }
+
+        rng_seed(&rng, ctx->seed, ctx->generation,
+            (uint64_t) i * EVLEARN_STREAMS + EVLEARN_STREAM_MUTATE);
+        for (size_t t = 1; t < 4; t++) {
+            taken[t] = draw_other(&rng, n, taken, t);
+        }
+        forced = (size_t) (rng_uniform(&rng) * genes);
+        for (size_t j = 0; j < genes; j++) {
+            const evlearn_gene* base = de->targets + taken[1] * genes;
+            const evlearn_gene* plus = de->targets + taken[2] * genes;
+            const evlearn_gene* minus = de->targets + taken[3] * genes;
+            double value = target[j];
+
+            if (j == forced || rng_uniform(&rng) < de->crossover) {
+                value = truncate_value(base[j] + de->weight * ((double) plus[j] - minus[j]),
+                    ctx->min_max_matrix[(j / cs * 2) * cs + j % cs],
+                    ctx->min_max_matrix[(j / cs * 2 + 1) * cs + j % cs]);
+                ctx->mutations++;
+            }
+            trial[j] = (evlearn_gene) value;
+        }
+    }
+    swap_chromosomes(ctx);
+}
+
+/**
+ * \brief Gets the number of values of the state for the given sizes.
+ */
+size_t de_count(size_t population_size, size_t genes)
+{
+    return DE_HEADER + population_size * (genes + 1);
+}
+
+/**
+ * \brief Copies the state to a checkpoint: F, CR, started, the
+ * fitness of the targets and their genes.
+ *
+ * \param ctx the context
+ * \param state where the values are stored, NULL to count them
+ *
+ * \return the number of values
+ */
+size_t de_save(const evlearn_ctx* ctx, double* state)
+{
+    const evlearn_de* de = ctx->de;
+    size_t n = ctx->population_size;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+
+    if (state != NULL) {
+        state[0] = de->weight;
+        state[1] = de->crossover;
+        state[2] = de->started;
+        for (size_t i = 0; i < n; i++) {
+            state[DE_HEADER + i] = de->target_fitness[i];
+        }
+        for (size_t i = 0; i < n * genes; i++) {
+            state[DE_HEADER + n + i] = de->targets[i];
+        }
+    }
+    return de_count(n, genes);
+}
+
+/**
+ * \brief Builds the state saved by de_save() for a population of the
+ * given sizes.
+ *
+ * \return the state, NULL if it does not fit the sizes
+ */
+evlearn_de* de_load(size_t n, size_t genes, const double* state, size_t count)
+{
+    evlearn_de* de = NULL;
+
+    if (count != de_count(n, genes))
+        return NULL;
+    de = de_allocate(n, genes, state[0], state[1]);
+    if (de == NULL)
+        return NULL;
+    de->started = state[2] != 0;
+    for (size_t i = 0; i < n; i++) {
+        de->target_fitness[i] = state[DE_HEADER + i];
+    }
+    for (size_t i = 0; i < n * genes; i++) {
+        de->targets[i] = (evlearn_gene) state[DE_HEADER + n + i];
+    }
+    return de;
+}
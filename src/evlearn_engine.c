@@ -0,0 +1,192 @@
+/**
+ * File: evlearn_engine.c
+ * Description: This is the implementation of the choice of the
+ *              engine declared in evlearn.h, the algorithm that
+ *              breeds every generation.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+/**
+ * \brief Frees the state of the engine and goes back to the genetic
+ * algorithm.
+ */
+void engine_destroy(evlearn_ctx* ctx)
+{
+    de_destroy(ctx->de);
+    ctx->de = NULL;
+    cmaes_destroy(ctx->cmaes);
+    ctx->cmaes = NULL;
+    ctx->engine = EVLEARN_ENGINE_GA;
+}
+
+/**
+ * \brief Chooses the algorithm compute_next_generation() runs, with
+ * a state that starts from the current population. Everything else
+ * works the same with every engine, as they only change the genes of
+ * the population and reset its fitness.
+ *
+ * \param ctx the context, initialized
+ * \param engine the engine
+ * \param step F of DE, within (0, 2], or the initial sigma of CMA-ES as
+ * a fraction of the range of the bounds
+ * \param crossover CR of DE, within [0, 1], ignored by the others
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int set_engine(evlearn_ctx* ctx, evlearn_engine engine, double step, double crossover)
+{
+    if (ctx->population == NULL)
+        return 1;
+
+    engine_destroy(ctx);
+    switch (engine) {
+    case EVLEARN_ENGINE_GA:
+        return 0;
+    case EVLEARN_ENGINE_DE:
+        ctx->de = de_create(ctx, step, crossover);
+        if (ctx->de == NULL)
+            return 1;
+        break;
+    case EVLEARN_ENGINE_CMAES:
+        ctx->cmaes = cmaes_create(ctx, step);
+        if (ctx->cmaes == NULL)
+            return 1;
+        break;
+    default:
+        return 1;
+    }
+
+    ctx->engine = engine;
+    return 0;
+}
+
+evlearn_engine get_engine(const evlearn_ctx* ctx)
+{
+    return ctx->engine;
+}
+
+/**
+ * \brief Breeds the next generation with DE or CMA-ES.
+ */
+void engine_next_generation(evlearn_ctx* ctx)
+{
+    switch (ctx->engine) {
+    case EVLEARN_ENGINE_DE:
+        de_next_generation(ctx);
+        break;
+    case EVLEARN_ENGINE_CMAES:
+        cmaes_next_generation(ctx);
+        break;
+    case EVLEARN_ENGINE_GA:
+        break;
+    }
+}
+
+/**
+ * \brief Copies the state of the engine to a checkpoint, nothing for
+ * the genetic algorithm, which only needs the population.
+ *
+ * \param ctx the context
+ * \param state where the values are stored, NULL to count them
+ *
+ * \return the number of values
+ */
+size_t engine_save(const evlearn_ctx* ctx, double* state)
+{
+    switch (ctx->engine) {
+    case EVLEARN_ENGINE_DE:
+        return de_save(ctx, state);
+    case EVLEARN_ENGINE_CMAES:
+        return cmaes_save(ctx, state);
+    case EVLEARN_ENGINE_GA:
+        break;
+    }
+    return 0;
+}
+
+/**
+ * \brief Gets the number of values engine_save() stores for an engine
+ * and the given sizes, so a checkpoint can be checked before it is
+ * loaded into the context.
+ */
+size_t engine_count(evlearn_engine engine, size_t population_size, size_t genes)
+{
+    switch (engine) {
+    case EVLEARN_ENGINE_DE:
+        return de_count(population_size, genes);
+    case EVLEARN_ENGINE_CMAES:
+        return cmaes_count(genes);
+    case EVLEARN_ENGINE_GA:
+        break;
+    }
+    return 0;
+}
+
+/**
+ * \brief Builds the engine of a checkpoint for a population of the
+ * given sizes, without touching any context, so that a checkpoint
+ * with a state that does not fit is rejected before anything is
+ * loaded. engine_swap() puts it into the context afterwards.
+ *
+ * \param loaded where the state is built
+ * \param engine the engine of the checkpoint
+ * \param population_size the number of individuals
+ * \param genes the number of genes of every individual
+ * \param state the values stored by engine_save()
+ * \param count the number of values
+ *
+ * \return 0 for success, 1 if the state does not fit the sizes
+ */
+int engine_load(evlearn_engine_state* loaded, evlearn_engine engine,
+    size_t population_size, size_t genes, const double* state, size_t count)
+{
+    loaded->engine = engine;
+    loaded->de = NULL;
+    loaded->cmaes = NULL;
+    switch (engine) {
+    case EVLEARN_ENGINE_GA:
+        return count != 0;
+    case EVLEARN_ENGINE_DE:
+        loaded->de = de_load(population_size, genes, state, count);
+        return loaded->de == NULL;
+    case EVLEARN_ENGINE_CMAES:
+        loaded->cmaes = cmaes_load(population_size, genes, state, count);
+        return loaded->cmaes == NULL;
+    }
+    return 1;
+}
+
+/**
+ * \brief Replaces the engine of the context with one built by
+ * engine_load(), once the population and bounds of its checkpoint are
+ * loaded. It cannot fail, and loaded is left empty.
+ */
+void engine_swap(evlearn_ctx* ctx, evlearn_engine_state* loaded)
+{
+    engine_destroy(ctx);
+    ctx->engine = loaded->engine;
+    ctx->de = loaded->de;
+    ctx->cmaes = loaded->cmaes;
+    if (ctx->cmaes != NULL) {
+        cmaes_bounds(ctx->cmaes, ctx);
+    }
+    loaded->engine = EVLEARN_ENGINE_GA;
+    loaded->de = NULL;
+    loaded->cmaes = NULL;
+}
+
+/**
+ * \brief Frees an engine built by engine_load() that was not swapped
+ * into a context.
+ */
+void engine_discard(evlearn_engine_state* loaded)
+{
+    de_destroy(loaded->de);
+    loaded->de = NULL;
+    cmaes_destroy(loaded->cmaes);
+    loaded->cmaes = NULL;
+}
@@ -0,0 +1,757 @@
+/**
+ * File: evlearn_farm.c
+ * Description: This is the implementation of the evaluator
+ *              farm declared in evlearn.h, a coordinator that
+ *              hands the chromosomes to worker processes over
+ *              a Unix socket and survives their crashes.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#define _GNU_SOURCE
+
+#include "evlearn_ctx.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FARM_MAGIC 0x464c5645u
+
+// Types of the messages.
+#define FARM_WORK 1
+#define FARM_RESULT 2
+
+// Longest payload accepted, a bigger length is taken as a broken stream.
+#define FARM_MAX_PAYLOAD (64u << 20)
+
+// Longest timeout of a worker, in seconds, so that any wait fits the milliseconds of poll().
+#define FARM_MAX_TIMEOUT (24 * 60 * 60.0)
+
+/**
+ * Every message is this header followed by length bytes of payload,
+ * in the byte order of the machine, as both ends run on the same box.
+ *
+ * The payload of FARM_WORK is a work_header and count entries of an
+ * uint64_t id and rows * cols genes as double. The payload of
+ * FARM_RESULT is a result_header and count entries of an uint64_t id
+ * and a double fitness, for some or all of the ids of the work.
+ */
+typedef struct farm_header {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t length;
+} farm_header;
+
+typedef struct work_header {
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t count;
+    uint32_t reserved;
+} work_header;
+
+typedef struct result_header {
+    uint32_t count;
+    uint32_t reserved;
+} result_header;
+
+/**
+ * A connected worker. assigned holds the positions in the batch of
+ * the individuals it is evaluating, it is idle if there are none, and
+ * deadline is when they are taken back if it does not answer. input
+ * keeps the bytes received that do not make a whole message yet and
+ * output the work from output_sent on that the socket did not take
+ * yet, as it never blocks.
+ */
+typedef struct farm_worker {
+    int fd;
+    size_t* assigned;
+    size_t assigned_count;
+    double deadline;
+    unsigned char* input;
+    size_t input_used;
+    size_t input_size;
+    unsigned char* output;
+    size_t output_used;
+    size_t output_sent;
+    size_t output_size;
+} farm_worker;
+
+/**
+ * The coordinator side of the farm, listening on path. workers grows
+ * as they connect. pending is the stack of positions in the batch not
+ * handed out, it grows with the batch.
+ */
+struct evlearn_farm {
+    int listen_fd;
+    char* path;
+    size_t batch_size;
+    double timeout;
+
+    farm_worker* workers;
+    size_t worker_count;
+    size_t worker_capacity;
+
+    size_t* pending;
+    size_t capacity;
+
+    evlearn_farm_stats stats;
+};
+
+static double now_seconds()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * \brief Makes buffer hold size bytes at least, doubling it.
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int reserve(unsigned char** buffer, size_t* capacity, size_t size)
+{
+    size_t grown = *capacity > 0 ? *capacity : 256;
+    unsigned char* resized = NULL;
+
+    if (size <= *capacity)
+        return 0;
+    while (grown < size) {
+        grown *= 2;
+    }
+    resized = realloc(*buffer, grown);
+    if (resized == NULL)
+        return 1;
+    *buffer = resized;
+    *capacity = grown;
+    return 0;
+}
+
+/**
+ * \brief Writes size bytes, retrying short writes, for the blocking
+ * socket of a worker. A peer that is gone makes it fail instead of
+ * raising SIGPIPE.
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int send_all(int fd, const void* data, size_t size)
+{
+    const char* bytes = data;
+
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return 1;
+        bytes += sent;
+        size -= (size_t) sent;
+    }
+    return 0;
+}
+
+/**
+ * \brief Reads size bytes, retrying short reads.
+ *
+ * \return 0 for success, 1 on error, -1 if the peer closed the
+ * connection before the first byte
+ */
+static int recv_all(int fd, void* data, size_t size)
+{
+    char* bytes = data;
+    size_t got = 0;
+
+    while (got < size) {
+        ssize_t n = recv(fd, bytes + got, size - got, 0);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 && got == 0)
+            return -1;
+        if (n <= 0)
+            return 1;
+        got += (size_t) n;
+    }
+    return 0;
+}
+
+static void close_worker(farm_worker* worker)
+{
+    close(worker->fd);
+    free(worker->assigned);
+    free(worker->input);
+    free(worker->output);
+}
+
+/**
+ * \brief Sends what the socket of a worker takes of its output
+ * without blocking, the rest is sent when poll() finds room for it.
+ *
+ * \return 0 for success, 1 if the worker has to be dropped
+ */
+static int flush_worker(farm_worker* worker)
+{
+    while (worker->output_sent < worker->output_used) {
+        ssize_t sent = send(worker->fd, worker->output + worker->output_sent,
+            worker->output_used - worker->output_sent, MSG_NOSIGNAL);
+
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (sent <= 0)
+            return 1;
+        worker->output_sent += (size_t) sent;
+    }
+    worker->output_used = 0;
+    worker->output_sent = 0;
+    return 0;
+}
+
+/**
+ * \brief Drops a worker that died, timed out or broke the protocol,
+ * putting the individuals it was evaluating back in pending.
+ */
+static void drop_worker(evlearn_farm* farm, size_t w, size_t* pending_count)
+{
+    farm_worker* worker = &farm->workers[w];
+
+    for (size_t i = 0; i < worker->assigned_count; i++) {
+        farm->pending[(*pending_count)++] = worker->assigned[i];
+    }
+    farm->stats.requeued += worker->assigned_count;
+    farm->stats.lost++;
+    close_worker(worker);
+    farm->workers[w] = farm->workers[--farm->worker_count];
+    farm->stats.workers = farm->worker_count;
+}
+
+/**
+ * \brief Accepts the workers waiting to connect, with sockets that do
+ * not block so that a stopped worker cannot stop the coordinator.
+ */
+static void accept_workers(evlearn_farm* farm)
+{
+    for (;;) {
+        int fd = accept4(farm->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        farm_worker* worker = NULL;
+
+        if (fd < 0)
+            return;
+        if (farm->worker_count == farm->worker_capacity) {
+            size_t capacity = farm->worker_capacity > 0 ? farm->worker_capacity * 2 : 8;
+            farm_worker* workers = realloc(farm->workers, capacity * sizeof(farm_worker));
+
+            if (workers == NULL) {
+                close(fd);
+                return;
+            }
+            farm->workers = workers;
+            farm->worker_capacity = capacity;
+        }
+        worker = &farm->workers[farm->worker_count];
+        memset(worker, 0, sizeof(farm_worker));
+        worker->fd = fd;
+        worker->assigned = malloc(farm->batch_size * sizeof(size_t));
+        if (worker->assigned == NULL) {
+            close(fd);
+            return;
+        }
+        farm->worker_count++;
+        farm->stats.workers = farm->worker_count;
+    }
+}
+
+/**
+ * \brief Sends an idle worker up to batch_size pending individuals in
+ * a single message, queued in its output.
+ *
+ * \return 0 for success, 1 if the worker has to be dropped
+ */
+static int send_work(evlearn_ctx* ctx, evlearn_farm* farm, farm_worker* worker,
+    size_t* pending_count)
+{
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t count = *pending_count < farm->batch_size ? *pending_count : farm->batch_size;
+    size_t entry = sizeof(uint64_t) + genes * sizeof(double);
+    size_t length = sizeof(work_header) + count * entry;
+    farm_header header = {FARM_MAGIC, FARM_WORK, length};
+    work_header work = {(uint32_t) ctx->chrom_array_size, (uint32_t) ctx->chrom_size,
+        (uint32_t) count, 0};
+    unsigned char* out = NULL;
+
+    if (reserve(&worker->output, &worker->output_size, sizeof(header) + length))
+        return 1;
+    out = worker->output;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), &work, sizeof(work));
+    out += sizeof(header) + sizeof(work);
+    for (size_t i = 0; i < count; i++) {
+        size_t position = farm->pending[--(*pending_count)];
+        const evlearn_gene* chromosome = ctx->population[ctx->batch[position]].chromosome;
+        uint64_t id = position;
+
+        memcpy(out, &id, sizeof(id));
+        out += sizeof(id);
+        for (size_t j = 0; j < genes; j++) {
+            double gene = chromosome[j];
+
+            memcpy(out, &gene, sizeof(gene));
+            out += sizeof(gene);
+        }
+        worker->assigned[worker->assigned_count++] = position;
+    }
+    worker->output_used = sizeof(header) + length;
+    worker->output_sent = 0;
+    worker->deadline = now_seconds() + farm->timeout;
+    farm->stats.batches++;
+    return flush_worker(worker);
+}
+
+/**
+ * \brief Takes the results of a FARM_RESULT payload. Every id has to
+ * be one the worker is evaluating.
+ *
+ * \return the number of results taken, or -1 if the message is broken
+ */
+static long take_results(
+    evlearn_ctx* ctx, farm_worker* worker, const unsigned char* payload, uint64_t length)
+{
+    result_header results;
+    const unsigned char* in = payload + sizeof(results);
+
+    if (length < sizeof(results))
+        return -1;
+    memcpy(&results, payload, sizeof(results));
+    if (length != sizeof(results) + (uint64_t) results.count * (sizeof(uint64_t) + sizeof(double)))
+        return -1;
+
+    for (uint32_t r = 0; r < results.count; r++) {
+        uint64_t id = 0;
+        double fitness = 0;
+        size_t a = 0;
+
+        memcpy(&id, in, sizeof(id));
+        memcpy(&fitness, in + sizeof(id), sizeof(fitness));
+        in += sizeof(id) + sizeof(fitness);
+        while (a < worker->assigned_count && worker->assigned[a] != id) {
+            a++;
+        }
+        if (a == worker->assigned_count)
+            return -1;
+        worker->assigned[a] = worker->assigned[--worker->assigned_count];
+        ctx->batch_fitness[id] = fitness;
+    }
+    return results.count;
+}
+
+/**
+ * \brief Reads what a worker sent and takes every whole message.
+ *
+ * \return the number of results taken, or -1 if the worker has to be
+ * dropped
+ */
+static long read_worker(evlearn_ctx* ctx, evlearn_farm* farm, farm_worker* worker)
+{
+    long taken = 0;
+    size_t offset = 0;
+
+    for (;;) {
+        ssize_t n = 0;
+
+        if (reserve(&worker->input, &worker->input_size, worker->input_used + 4096))
+            return -1;
+        n = recv(worker->fd, worker->input + worker->input_used,
+            worker->input_size - worker->input_used, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        worker->input_used += (size_t) n;
+    }
+
+    while (worker->input_used - offset >= sizeof(farm_header)) {
+        farm_header header;
+        long results = 0;
+
+        memcpy(&header, worker->input + offset, sizeof(header));
+        if (header.magic != FARM_MAGIC || header.type != FARM_RESULT ||
+            header.length > FARM_MAX_PAYLOAD)
+            return -1;
+        if (worker->input_used - offset < sizeof(header) + header.length)
+            break;
+        results = take_results(ctx, worker, worker->input + offset + sizeof(header), header.length);
+        if (results < 0)
+            return -1;
+        taken += results;
+        offset += sizeof(header) + header.length;
+    }
+    memmove(worker->input, worker->input + offset, worker->input_used - offset);
+    worker->input_used -= offset;
+    if (worker->assigned_count > 0) {
+        worker->deadline = now_seconds() + farm->timeout;
+    }
+    return taken;
+}
+
+/**
+ * \brief Starts the coordinator of an evaluator farm, listening on a
+ * Unix socket at socket_path. Worker processes connect with
+ * run_worker() at any time, before or during evaluate_farm(), and
+ * stay connected between generations.
+ *
+ * \param ctx the context
+ * \param socket_path path of the socket, replaced if it exists
+ * \param batch_size individuals sent to a worker in every message
+ * \param timeout seconds a worker has to answer before it is dropped
+ * and its individuals are handed to another one, a day at most
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int open_farm(evlearn_ctx* ctx, const char* socket_path, size_t batch_size, double timeout)
+{
+    evlearn_farm* farm = NULL;
+    struct sockaddr_un address;
+
+    if (socket_path == NULL || batch_size == 0 || !(timeout > 0 && timeout <= FARM_MAX_TIMEOUT) ||
+        strlen(socket_path) >= sizeof(address.sun_path))
+        return 1;
+
+    close_farm(ctx);
+    farm = calloc(1, sizeof(evlearn_farm));
+    if (farm == NULL)
+        return 1;
+    farm->batch_size = batch_size;
+    farm->timeout = timeout;
+    farm->path = malloc(strlen(socket_path) + 1);
+    farm->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (farm->path == NULL || farm->listen_fd < 0) {
+        goto fail;
+    }
+    strcpy(farm->path, socket_path);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(farm->listen_fd, (struct sockaddr*) &address, sizeof(address)) ||
+        listen(farm->listen_fd, SOMAXCONN)) {
+        goto fail;
+    }
+
+    ctx->farm = farm;
+    return 0;
+
+fail:
+    if (farm->listen_fd >= 0) {
+        close(farm->listen_fd);
+    }
+    free(farm->path);
+    free(farm);
+    return 1;
+}
+
+/**
+ * \brief Disconnects the workers, which makes run_worker() return,
+ * and removes the socket. It does nothing if there is no farm.
+ */
+void close_farm(evlearn_ctx* ctx)
+{
+    evlearn_farm* farm = ctx->farm;
+
+    if (farm == NULL)
+        return;
+
+    for (size_t w = 0; w < farm->worker_count; w++) {
+        close_worker(&farm->workers[w]);
+    }
+    close(farm->listen_fd);
+    unlink(farm->path);
+    free(farm->path);
+    free(farm->workers);
+    free(farm->pending);
+    free(farm);
+    ctx->farm = NULL;
+}
+
+/**
+ * \brief Evaluates every individual not handed out yet by ask() on the
+ * workers of the farm and tells the results. It waits for workers if
+ * there are none, for timeout seconds at most. The individuals of a
+ * worker that closes the connection, sends a broken message or does
+ * not answer in time are handed to the next idle worker.
+ *
+ * \param ctx the context, with a farm opened
+ *
+ * \return 0 for success, 1 otherwise, in which case no fitness is told
+ * and the individuals are handed out again by the next call
+ */
+int evaluate_farm(evlearn_ctx* ctx)
+{
+    evlearn_farm* farm = ctx->farm;
+    struct pollfd* fds = NULL;
+    size_t first = 0;
+    size_t count = 0;
+    size_t pending_count = 0;
+    size_t remaining = 0;
+    double alone_since = -1;
+    int result = 1;
+
+    if (farm == NULL || ctx->population == NULL)
+        return 1;
+    if (farm->capacity < ctx->population_size) {
+        size_t* pending = realloc(farm->pending, ctx->population_size * sizeof(size_t));
+
+        if (pending == NULL)
+            return 1;
+        farm->pending = pending;
+        farm->capacity = ctx->population_size;
+    }
+
+    STATS_START(start);
+    first = ctx->ask_cursor;
+    count = ask(ctx, ctx->batch, ctx->population_size);
+    for (size_t i = 0; i < count; i++) {
+        farm->pending[i] = count - 1 - i;
+    }
+    pending_count = count;
+    remaining = count;
+
+    while (remaining > 0) {
+        double now = now_seconds();
+        double wait = -1;
+        struct pollfd* grown = NULL;
+        int ready = 0;
+
+        // A dropped worker is replaced by the last one, which is looked at next. The late ones
+        // are dropped before any work is sent, so that every idle worker can take theirs.
+        for (size_t w = 0; w < farm->worker_count;) {
+            if (farm->workers[w].assigned_count > 0 && now >= farm->workers[w].deadline) {
+                drop_worker(farm, w, &pending_count);
+            }
+            else {
+                w++;
+            }
+        }
+        for (size_t w = 0; w < farm->worker_count;) {
+            farm_worker* worker = &farm->workers[w];
+
+            if (worker->assigned_count == 0 && pending_count > 0 &&
+                send_work(ctx, farm, worker, &pending_count)) {
+                drop_worker(farm, w, &pending_count);
+            }
+            else {
+                w++;
+            }
+        }
+
+        if (farm->worker_count > 0) {
+            alone_since = -1;
+        }
+        else if (alone_since < 0) {
+            alone_since = now;
+        }
+        if (alone_since >= 0) {
+            wait = alone_since + farm->timeout - now;
+            if (wait <= 0)
+                goto done;
+        }
+
+        grown = realloc(fds, (farm->worker_count + 1) * sizeof(struct pollfd));
+        if (grown == NULL)
+            goto done;
+        fds = grown;
+        fds[0].fd = farm->listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t w = 0; w < farm->worker_count; w++) {
+            const farm_worker* worker = &farm->workers[w];
+            double left = worker->deadline - now;
+
+            fds[w + 1].fd = worker->fd;
+            fds[w + 1].events = worker->output_used > 0 ? POLLIN | POLLOUT : POLLIN;
+            if (worker->assigned_count > 0 && (wait < 0 || left < wait)) {
+                wait = left > 0 ? left : 0;
+            }
+        }
+
+        ready = poll(fds, farm->worker_count + 1, wait < 0 ? -1 : (int) (wait * 1000) + 1);
+        if (ready < 0 && errno != EINTR)
+            goto done;
+        if (ready <= 0)
+            continue;
+
+        // Back to front, so dropping a worker does not move the ones not read yet.
+        for (size_t w = farm->worker_count; w-- > 0;) {
+            long taken = 0;
+
+            if ((fds[w + 1].revents & POLLOUT) && flush_worker(&farm->workers[w])) {
+                drop_worker(farm, w, &pending_count);
+                continue;
+            }
+            if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            taken = read_worker(ctx, farm, &farm->workers[w]);
+            if (taken < 0) {
+                drop_worker(farm, w, &pending_count);
+            }
+            else {
+                remaining -= (size_t) taken;
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_workers(farm);
+        }
+    }
+
+    tell(ctx, ctx->batch, ctx->batch_fitness, count);
+    result = 0;
+
+done:
+    free(fds);
+    if (result) {
+        // The work of the workers left is given up, and them with it.
+        for (size_t w = 0; w < farm->worker_count; w++) {
+            close_worker(&farm->workers[w]);
+        }
+        farm->stats.lost += farm->worker_count;
+        farm->worker_count = 0;
+        farm->stats.workers = 0;
+        ctx->ask_cursor = first;
+    }
+    STATS_TIME(ctx, EVLEARN_TIMER_EVALUATE, start);
+    return result;
+}
+
+/**
+ * \brief Gets the counters of the farm, all 0 if there is none.
+ */
+evlearn_farm_stats get_farm_stats(const evlearn_ctx* ctx)
+{
+    evlearn_farm_stats stats = {0};
+
+    if (ctx->farm != NULL) {
+        stats = ctx->farm->stats;
+    }
+    return stats;
+}
+
+/**
+ * \brief Main loop of a worker process. It connects to the farm at
+ * socket_path and evaluates every chromosome it is sent with
+ * fitness_fn until the coordinator closes the connection, answering
+ * each message with the fitness of all of its individuals.
+ *
+ * \param socket_path path of the socket of open_farm()
+ * \param fitness_fn function computing the fitness of a chromosome
+ * \param user_data pointer passed to every call of fitness_fn
+ *
+ * \return 0 when the farm is closed, 1 on error
+ */
+int run_worker(const char* socket_path, evlearn_fitness_fn fitness_fn, void* user_data)
+{
+    struct sockaddr_un address;
+    unsigned char* payload = NULL;
+    size_t payload_size = 0;
+    unsigned char* reply = NULL;
+    size_t reply_size = 0;
+    evlearn_gene* chromosome = NULL;
+    size_t chromosome_size = 0;
+    int result = 1;
+    int fd = -1;
+
+    if (socket_path == NULL || fitness_fn == NULL ||
+        strlen(socket_path) >= sizeof(address.sun_path))
+        return 1;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return 1;
+    if (connect(fd, (struct sockaddr*) &address, sizeof(address))) {
+        close(fd);
+        return 1;
+    }
+
+    for (;;) {
+        farm_header header;
+        work_header work;
+        result_header results = {0, 0};
+        size_t genes = 0;
+        size_t entry = 0;
+        const unsigned char* in = NULL;
+        unsigned char* out = NULL;
+        int status = recv_all(fd, &header, sizeof(header));
+
+        if (status < 0) {
+            result = 0;
+            break;
+        }
+        if (status || header.magic != FARM_MAGIC || header.type != FARM_WORK ||
+            header.length < sizeof(work) || header.length > FARM_MAX_PAYLOAD ||
+            reserve(&payload, &payload_size, header.length) ||
+            recv_all(fd, payload, header.length))
+            break;
+
+        memcpy(&work, payload, sizeof(work));
+        genes = (size_t) work.rows * work.cols;
+        entry = sizeof(uint64_t) + genes * sizeof(double);
+        if (header.length != sizeof(work) + work.count * entry)
+            break;
+        if (genes > chromosome_size) {
+            evlearn_gene* grown = realloc(chromosome, genes * sizeof(evlearn_gene));
+
+            if (grown == NULL)
+                break;
+            chromosome = grown;
+            chromosome_size = genes;
+        }
+        if (reserve(&reply, &reply_size, sizeof(header) + sizeof(result_header) +
+                work.count * (sizeof(uint64_t) + sizeof(double))))
+            break;
+
+        in = payload + sizeof(work);
+        out = reply + sizeof(header) + sizeof(result_header);
+        for (uint32_t i = 0; i < work.count; i++) {
+            double fitness = 0;
+
+            for (size_t j = 0; j < genes; j++) {
+                double gene = 0;
+
+                memcpy(&gene, in + sizeof(uint64_t) + j * sizeof(double), sizeof(gene));
+                chromosome[j] = (evlearn_gene) gene;
+            }
+            fitness = fitness_fn(chromosome, work.rows, work.cols, user_data);
+            memcpy(out, in, sizeof(uint64_t));
+            memcpy(out + sizeof(uint64_t), &fitness, sizeof(fitness));
+            in += entry;
+            out += sizeof(uint64_t) + sizeof(double);
+        }
+
+        header.type = FARM_RESULT;
+        header.length = sizeof(result_header) + work.count * (sizeof(uint64_t) + sizeof(double));
+        results.count = work.count;
+        memcpy(reply, &header, sizeof(header));
+        memcpy(reply + sizeof(header), &results, sizeof(results));
+        if (send_all(fd, reply, sizeof(header) + header.length))
+            break;
+    }
+
+    close(fd);
+    free(payload);
+    free(reply);
+    free(chromosome);
+    return result;
+}
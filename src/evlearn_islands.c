@@ -0,0 +1,522 @@
+/**
+ * File: evlearn_islands.c
+ * Description: This is the implementation of the island
+ *              model declared in evlearn.h, subpopulations
+ *              evolving on their own threads that exchange
+ *              their best individuals every few generations.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The migrants an island sends, in two slots used by turns, so it
+ * can fill the next one while its neighbours still read the last one.
+ * Migration e is in the slot e % 2, with generation the generation of
+ * the island when it was sent. published is the last migration
+ * written and reads[slot] the islands that finished reading the slot,
+ * the island waits for all of them before writing it again. They are
+ * atomic, so the migrants are exchanged without a lock: the genes and
+ * generation are written before published and read after it, and
+ * read before reads and written again after it.
+ */
+typedef struct island_outbox {
+    evlearn_gene* genes;
+    double* fitness;
+    size_t generation[2];
+    atomic_size_t published;
+    atomic_size_t reads[2];
+} island_outbox;
+
+/**
+ * Every island is a context of its own, only used by its thread while
+ * evolving. epoch counts the migrations, the same on every island,
+ * and generation the generations evolve_islands() bred, which set
+ * when they are due whatever the generation of every island is.
+ * failed is set if an evaluation failed, the islands go on anyway so
+ * that their neighbours never wait for them forever. start is 0 while
+ * the threads are created, then 1, or -1 if one could not be so that
+ * the others return at once, and it is only used under lock.
+ *
+ * A thread that has to wait for start or a counter of an outbox
+ * sleeps on changed, under lock, instead of spinning, and counts
+ * itself in sleepers. A thread that changes a counter only takes the
+ * lock to wake them if there are sleepers.
+ */
+struct evlearn_islands {
+    size_t n_islands;
+    evlearn_ctx** islands;
+    island_outbox* outboxes;
+    size_t epoch;
+    size_t generation;
+
+    size_t interval;
+    size_t migrants;
+    evlearn_topology topology;
+
+    evlearn_fitness_fn fitness_fn;
+    void* user_data;
+    size_t generations;
+    size_t tournament_size;
+    double mutation_probability;
+    atomic_int failed;
+    int start;
+    atomic_size_t sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+/**
+ * Argument of the thread of an island, with its buffers. order holds
+ * the ranking of the population, taken the individuals replaced by
+ * migrants followed by the islands they came from and skipped the
+ * islands whose migrants are not taken. epoch is the last migration
+ * of the island.
+ */
+typedef struct island_job {
+    evlearn_islands* islands;
+    size_t index;
+    size_t* order;
+    size_t* taken;
+    unsigned char* skipped;
+    size_t epoch;
+} island_job;
+
+/**
+ * \brief Number of islands reading the migrants of every island.
+ */
+static size_t readers(const evlearn_islands* islands)
+{
+    if (islands->n_islands < 2 || islands->migrants == 0)
+        return 0;
+    return islands->topology == EVLEARN_TOPOLOGY_RING ? 1 : islands->n_islands - 1;
+}
+
+static void free_outboxes(evlearn_islands* islands)
+{
+    for (size_t i = 0; islands->outboxes != NULL && i < islands->n_islands; i++) {
+        free(islands->outboxes[i].genes);
+        free(islands->outboxes[i].fitness);
+    }
+    free(islands->outboxes);
+    islands->outboxes = NULL;
+}
+
+/**
+ * \brief Creates n_islands contexts initialized like init(), the
+ * island i seeded with seed + i, and migration every 5 generations
+ * of the 2 best individuals of every island to the next one.
+ *
+ * \return the islands, NULL on error
+ */
+evlearn_islands* create_islands(
+    size_t n_islands,
+    size_t population_size,
+    size_t chrom_array_size,
+    size_t chrom_size,
+    double** min_max_matrix,
+    uint64_t seed)
+{
+    evlearn_islands* islands = NULL;
+
+    if (n_islands == 0)
+        return NULL;
+    islands = calloc(1, sizeof(evlearn_islands));
+    if (islands == NULL)
+        return NULL;
+    islands->islands = calloc(n_islands, sizeof(evlearn_ctx*));
+    if (islands->islands == NULL || pthread_mutex_init(&islands->lock, NULL)) {
+        free(islands->islands);
+        free(islands);
+        return NULL;
+    }
+    if (pthread_cond_init(&islands->changed, NULL)) {
+        pthread_mutex_destroy(&islands->lock);
+        free(islands->islands);
+        free(islands);
+        return NULL;
+    }
+    islands->n_islands = n_islands;
+
+    for (size_t i = 0; i < n_islands; i++) {
+        islands->islands[i] = create_ctx();
+        if (islands->islands[i] == NULL) {
+            destroy_islands(islands);
+            return NULL;
+        }
+        set_seed(islands->islands[i], seed + i);
+        if (init(islands->islands[i], population_size, chrom_array_size, chrom_size,
+                min_max_matrix, NULL)) {
+            destroy_islands(islands);
+            return NULL;
+        }
+    }
+    if (set_migration(islands, 5, 2, EVLEARN_TOPOLOGY_RING)) {
+        destroy_islands(islands);
+        return NULL;
+    }
+    return islands;
+}
+
+void destroy_islands(evlearn_islands* islands)
+{
+    if (islands == NULL)
+        return;
+
+    for (size_t i = 0; i < islands->n_islands; i++) {
+        destroy_ctx(islands->islands[i]);
+    }
+    free_outboxes(islands);
+    pthread_cond_destroy(&islands->changed);
+    pthread_mutex_destroy(&islands->lock);
+    free(islands->islands);
+    free(islands);
+}
+
+/**
+ * \brief Sets the migration. Every interval generations each island
+ * sends its migrants best individuals to the next island of a ring
+ * or to all of them, where they replace the worst ones. With all of
+ * them, an island takes the best migrants sent to it.
+ *
+ * \param islands the islands
+ * \param interval generations between migrations, 0 for none
+ * \param migrants individuals sent, less than the population size
+ * \param topology where they are sent
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int set_migration(
+    evlearn_islands* islands, size_t interval, size_t migrants, evlearn_topology topology)
+{
+    size_t genes = islands->islands[0]->chrom_array_size * islands->islands[0]->chrom_size;
+    size_t n_readers = 0;
+
+    if (migrants >= islands->islands[0]->population_size)
+        return 1;
+
+    free_outboxes(islands);
+    islands->interval = migrants > 0 ? interval : 0;
+    islands->migrants = interval > 0 ? migrants : 0;
+    islands->topology = topology;
+    islands->epoch = 0;
+    if (islands->migrants == 0)
+        return 0;
+
+    islands->outboxes = calloc(islands->n_islands, sizeof(island_outbox));
+    if (islands->outboxes == NULL)
+        return 1;
+    n_readers = readers(islands);
+    for (size_t i = 0; i < islands->n_islands; i++) {
+        island_outbox* outbox = &islands->outboxes[i];
+
+        outbox->genes = malloc(sizeof(evlearn_gene) * 2 * migrants * genes);
+        outbox->fitness = malloc(sizeof(double) * 2 * migrants);
+        if (outbox->genes == NULL || outbox->fitness == NULL) {
+            free_outboxes(islands);
+            return 1;
+        }
+        atomic_init(&outbox->published, 0);
+        atomic_init(&outbox->reads[0], n_readers);
+        atomic_init(&outbox->reads[1], n_readers);
+    }
+    return 0;
+}
+
+evlearn_ctx* get_island(evlearn_islands* islands, size_t index)
+{
+    return index < islands->n_islands ? islands->islands[index] : NULL;
+}
+
+/**
+ * \brief Gets the island with the best individual, the first one if
+ * there are several.
+ */
+size_t get_best_island(const evlearn_islands* islands)
+{
+    size_t best = 0;
+
+    for (size_t i = 1; i < islands->n_islands; i++) {
+        if (get_best(islands->islands[i]).fitness > get_best(islands->islands[best]).fitness) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/**
+ * \brief Sleeps until a counter of an outbox reaches a value. The
+ * sequentially consistent sleepers and counter make sure that either
+ * the thread sees the new value or the one changing it sees the
+ * sleeper and wakes it.
+ */
+static void wait_for(evlearn_islands* islands, atomic_size_t* counter, size_t value)
+{
+    if (atomic_load(counter) >= value)
+        return;
+
+    pthread_mutex_lock(&islands->lock);
+    atomic_fetch_add(&islands->sleepers, 1);
+    while (atomic_load(counter) < value) {
+        pthread_cond_wait(&islands->changed, &islands->lock);
+    }
+    atomic_fetch_sub(&islands->sleepers, 1);
+    pthread_mutex_unlock(&islands->lock);
+}
+
+/**
+ * \brief Wakes the threads sleeping in wait_for() after a counter
+ * changed, if there are any.
+ */
+static void wake(evlearn_islands* islands)
+{
+    if (atomic_load(&islands->sleepers) == 0)
+        return;
+
+    pthread_mutex_lock(&islands->lock);
+    pthread_cond_broadcast(&islands->changed);
+    pthread_mutex_unlock(&islands->lock);
+}
+
+/**
+ * \brief Copies the best migrants of an island into its outbox, once
+ * its readers are done with the migration that used the same slot.
+ */
+static void publish(island_job* job)
+{
+    evlearn_islands* islands = job->islands;
+    evlearn_ctx* ctx = islands->islands[job->index];
+    island_outbox* outbox = &islands->outboxes[job->index];
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t migrants = islands->migrants;
+    size_t slot = job->epoch % 2;
+    size_t n_readers = readers(islands);
+
+    wait_for(islands, &outbox->reads[slot], n_readers);
+    atomic_store(&outbox->reads[slot], 0);
+
+    for (size_t m = 0; m < migrants; m++) {
+        const Individual* individual = &ctx->population[job->order[m]];
+
+        memcpy(outbox->genes + (slot * migrants + m) * genes, individual->chromosome,
+            genes * sizeof(evlearn_gene));
+        outbox->fitness[slot * migrants + m] = individual->fitness;
+    }
+
+    outbox->generation[slot] = ctx->generation;
+    atomic_store(&outbox->published, job->epoch);
+    wake(islands);
+}
+
+/**
+ * \brief Replaces the worst individuals of an island with the best
+ * migrants sent to it, with their fitness, so that they take part in
+ * the selection of the next generation. The migrants of every source
+ * are sorted, so the best one left is always the next of a source.
+ * The migrants of an island at another generation, stepped on its own
+ * with get_island(), are skipped.
+ */
+static void receive(island_job* job)
+{
+    evlearn_islands* islands = job->islands;
+    evlearn_ctx* ctx = islands->islands[job->index];
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t n = islands->n_islands;
+    size_t migrants = islands->migrants;
+    size_t slot = job->epoch % 2;
+    int ring = islands->topology == EVLEARN_TOPOLOGY_RING;
+    size_t first = ring ? (job->index + n - 1) % n : 0;
+    size_t last = ring ? first + 1 : n;
+    size_t* sources = job->taken + migrants;
+    unsigned char* skipped = job->skipped;
+
+    for (size_t s = first; s < last; s++) {
+        if (s == job->index)
+            continue;
+        wait_for(islands, &islands->outboxes[s].published, job->epoch);
+        skipped[s] = islands->outboxes[s].generation[slot] != ctx->generation;
+    }
+
+    // The worst individuals are chosen from the ranking before any of them is replaced.
+    for (size_t m = 0; m < migrants; m++) {
+        size_t from = n;
+        size_t k = 0;
+
+        job->taken[m] = job->order[ctx->population_size - 1 - m];
+        for (size_t s = first; s < last; s++) {
+            const double* fitness = islands->outboxes[s].fitness + slot * migrants;
+            size_t next = 0;
+
+            if (s == job->index || skipped[s])
+                continue;
+            for (size_t t = 0; t < m; t++) {
+                next += sources[t] == s;
+            }
+            if (next < migrants && (from == n ||
+                    fitness[next] > islands->outboxes[from].fitness[slot * migrants + k])) {
+                from = s;
+                k = next;
+            }
+        }
+        if (from == n)
+            break;
+        sources[m] = from;
+        memcpy(ctx->population[job->taken[m]].chromosome,
+            islands->outboxes[from].genes + (slot * migrants + k) * genes,
+            genes * sizeof(evlearn_gene));
+        set_fitness(ctx, job->taken[m], islands->outboxes[from].fitness[slot * migrants + k]);
+    }
+
+    for (size_t s = first; s < last; s++) {
+        if (s != job->index) {
+            atomic_fetch_add(&islands->outboxes[s].reads[slot], 1);
+        }
+    }
+    wake(islands);
+}
+
+/**
+ * \brief Thread of an island: it evaluates the population, then for
+ * every generation migrates if it is due, breeds the next one and
+ * evaluates it.
+ */
+static void* evolve_island(void* arg)
+{
+    island_job* job = arg;
+    evlearn_islands* islands = job->islands;
+    evlearn_ctx* ctx = islands->islands[job->index];
+    int start = 0;
+
+    pthread_mutex_lock(&islands->lock);
+    while (islands->start == 0) {
+        pthread_cond_wait(&islands->changed, &islands->lock);
+    }
+    start = islands->start;
+    pthread_mutex_unlock(&islands->lock);
+    if (start < 0)
+        return NULL;
+
+    if (evaluate(ctx, islands->fitness_fn, islands->user_data, 1)) {
+        atomic_store(&islands->failed, 1);
+    }
+    for (size_t g = 0; g < islands->generations; g++) {
+        if (readers(islands) > 0 && (islands->generation + g + 1) % islands->interval == 0) {
+            job->epoch++;
+            rank_population(ctx, job->order);
+            publish(job);
+            receive(job);
+        }
+        compute_next_generation(ctx, islands->tournament_size, islands->mutation_probability);
+        if (evaluate(ctx, islands->fitness_fn, islands->user_data, 1)) {
+            atomic_store(&islands->failed, 1);
+        }
+    }
+    return NULL;
+}
+
+static void free_jobs(island_job* jobs, size_t n)
+{
+    for (size_t i = 0; jobs != NULL && i < n; i++) {
+        free(jobs[i].order);
+        free(jobs[i].taken);
+        free(jobs[i].skipped);
+    }
+    free(jobs);
+}
+
+/**
+ * \brief Evolves every island for a number of generations, each one
+ * on its own thread, with the migrations set by set_migration(). The
+ * results only depend on the seeds, not on how the threads run, as
+ * every island waits for the migrants of the same migration. The
+ * migrations are due every interval generations of this function, so
+ * an island stepped on its own does not leave the others waiting, its
+ * migrants are skipped. The islands end evaluated, so it can be
+ * called again to go on.
+ *
+ * \param islands the islands
+ * \param fitness_fn function computing the fitness of a chromosome,
+ * called from every island at the same time
+ * \param user_data pointer passed to every call of fitness_fn
+ * \param generations generations bred on every island
+ * \param tournament_size like in compute_next_generation()
+ * \param mutation_probability like in compute_next_generation()
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int evolve_islands(
+    evlearn_islands* islands,
+    evlearn_fitness_fn fitness_fn,
+    void* user_data,
+    size_t generations,
+    size_t tournament_size,
+    double mutation_probability)
+{
+    size_t n = islands->n_islands;
+    size_t population_size = islands->islands[0]->population_size;
+    pthread_t* threads = NULL;
+    island_job* jobs = NULL;
+    size_t started = 1;
+
+    if (fitness_fn == NULL)
+        return 1;
+    threads = malloc(sizeof(pthread_t) * n);
+    jobs = calloc(n, sizeof(island_job));
+    for (size_t i = 0; jobs != NULL && i < n; i++) {
+        jobs[i].islands = islands;
+        jobs[i].index = i;
+        jobs[i].order = malloc(sizeof(size_t) * population_size);
+        jobs[i].taken = malloc(sizeof(size_t) * (2 * islands->migrants + 1));
+        jobs[i].skipped = calloc(n, 1);
+        jobs[i].epoch = islands->epoch;
+        if (jobs[i].order == NULL || jobs[i].taken == NULL || jobs[i].skipped == NULL) {
+            free_jobs(jobs, n);
+            jobs = NULL;
+        }
+    }
+    if (threads == NULL || jobs == NULL) {
+        free(threads);
+        free_jobs(jobs, n);
+        return 1;
+    }
+
+    islands->fitness_fn = fitness_fn;
+    islands->user_data = user_data;
+    islands->generations = generations;
+    islands->tournament_size = tournament_size;
+    islands->mutation_probability = mutation_probability;
+    atomic_store(&islands->failed, 0);
+    islands->start = 0;
+
+    // The island 0 runs on the calling thread. The others wait for every thread to be created,
+    // as an island missing its thread would leave its neighbours waiting for its migrants.
+    for (; started < n; started++) {
+        if (pthread_create(&threads[started], NULL, evolve_island, &jobs[started]))
+            break;
+    }
+    pthread_mutex_lock(&islands->lock);
+    islands->start = started == n ? 1 : -1;
+    pthread_cond_broadcast(&islands->changed);
+    pthread_mutex_unlock(&islands->lock);
+    if (started == n) {
+        evolve_island(&jobs[0]);
+    }
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (started == n) {
+        islands->epoch = jobs[0].epoch;
+        islands->generation += generations;
+    }
+
+    free(threads);
+    free_jobs(jobs, n);
+    return started < n || atomic_load(&islands->failed);
+}
@@ -0,0 +1,209 @@
+/**
+ * File: evlearn_pool.c
+ * Description: This is the implementation of the
+ *              evlearn_pool.h header.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/**
+ * The workers sleep on work_cond until the batch counter changes. Tasks
+ * of a batch are claimed with an atomic counter so that no lock is taken
+ * per task. pool_run() waits on done_cond until every task is done and
+ * no worker is still inside the batch, so a late worker can never claim
+ * tasks of the next one.
+ */
+struct evlearn_pool {
+    pthread_t* threads;
+    size_t n_threads;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    size_t batch;
+    size_t active;
+    int shutdown;
+
+    evlearn_task_fn task;
+    void* arg;
+    size_t count;
+    atomic_size_t next;
+    atomic_size_t done;
+};
+
+/**
+ * \brief Claims and runs tasks of the current batch until there
+ * are none left. The batch is the one read under the mutex, never
+ * the fields of the pool, which the next batch overwrites.
+ *
+ * \param pool the pool running the batch
+ * \param task function of the batch
+ * \param arg argument of the batch
+ * \param count number of tasks of the batch
+ */
+static void run_tasks(evlearn_pool* pool, evlearn_task_fn task, void* arg, size_t count)
+{
+    size_t index = atomic_fetch_add(&pool->next, 1);
+
+    while (index < count) {
+        task(index, arg);
+
+        if (atomic_fetch_add(&pool->done, 1) + 1 == count) {
+            pthread_mutex_lock(&pool->mutex);
+            pthread_cond_signal(&pool->done_cond);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+        index = atomic_fetch_add(&pool->next, 1);
+    }
+}
+
+/**
+ * \brief Main loop of every worker thread.
+ */
+static void* worker(void* arg)
+{
+    evlearn_pool* pool = arg;
+    size_t seen = 0;
+    evlearn_task_fn task = NULL;
+    void* task_arg = NULL;
+    size_t count = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (!pool->shutdown && pool->batch == seen) {
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->batch;
+        task = pool->task;
+        task_arg = pool->arg;
+        count = pool->count;
+        pool->active++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_tasks(pool, task, task_arg, count);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->active--;
+        if (pool->active == 0) {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/**
+ * \brief Creates the pool. The thread calling pool_run() works as
+ * well, so n_threads - 1 threads are started.
+ *
+ * \param n_threads number of threads running the tasks, at least 1
+ *
+ * \return the pool or NULL on error
+ */
+evlearn_pool* pool_create(size_t n_threads)
+{
+    evlearn_pool* pool = NULL;
+
+    if (n_threads == 0)
+        return NULL;
+
+    pool = calloc(1, sizeof(evlearn_pool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->threads = calloc(n_threads, sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    atomic_init(&pool->next, 0);
+    atomic_init(&pool->done, 0);
+
+    for (size_t i = 1; i < n_threads; i++) {
+        if (pthread_create(&pool->threads[i - 1], NULL, worker, pool)) {
+            pool_destroy(pool);
+            return NULL;
+        }
+        pool->n_threads = i + 1;
+    }
+    pool->n_threads = n_threads;
+
+    return pool;
+}
+
+/**
+ * \brief Runs the tasks 0 to count - 1 on the pool threads and on
+ * the calling thread. It returns when all of them are finished.
+ *
+ * \param pool the pool
+ * \param task function called once per task
+ * \param arg argument passed to every task
+ * \param count number of tasks
+ */
+void pool_run(evlearn_pool* pool, evlearn_task_fn task, void* arg, size_t count)
+{
+    if (count == 0)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    atomic_store(&pool->done, 0);
+    pool->batch++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_tasks(pool, task, arg, count);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (atomic_load(&pool->done) < count || pool->active > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+size_t pool_size(const evlearn_pool* pool)
+{
+    return pool->n_threads;
+}
+
+/**
+ * \brief Stops and joins the workers and frees the pool.
+ *
+ * \param pool the pool, NULL is ignored
+ */
+void pool_destroy(evlearn_pool* pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 1; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i - 1], NULL);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
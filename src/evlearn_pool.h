@@ -0,0 +1,29 @@
+/**
+ * File: evlearn_pool.h
+ * Description: This is a header for the thread pool used
+ *              internally by evlearn to run tasks in parallel.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include <stddef.h>
+
+#pragma once
+
+typedef struct evlearn_pool evlearn_pool;
+
+// A task of a batch. index goes from 0 to the size of the batch - 1.
+typedef void (*evlearn_task_fn)(size_t index, void* arg);
+
+// Creates a pool running batches on n_threads threads, the caller included.
+evlearn_pool* pool_create(size_t n_threads);
+
+// Runs count tasks and blocks until all of them are done.
+void pool_run(evlearn_pool* pool, evlearn_task_fn task, void* arg, size_t count);
+
+// Number of threads the pool was created with.
+size_t pool_size(const evlearn_pool* pool);
+
+// Joins the worker threads and frees the pool.
+void pool_destroy(evlearn_pool* pool);
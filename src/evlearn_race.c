@@ -0,0 +1,290 @@
+/**
+ * File: evlearn_race.c
+ * Description: This is the implementation of the racing
+ *              declared in evlearn.h, which stops the episodes
+ *              of individuals that can't reach the elite from
+ *              the partial fitness reported during them.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * partials holds checkpoints partial fitness values per individual
+ * of the population, reported is the next checkpoint it reports and
+ * aborted marks the individuals told to stop. An individual only
+ * writes its own slots, so the evaluator threads can race at the same
+ * time.
+ *
+ * The elite are the distinct trajectories of the best individuals
+ * that ran every checkpoint, elite_partials holds their partial
+ * fitness and elite_fitness their final one. They only change in
+ * tell(), never while the individuals of a batch are racing.
+ */
+struct evlearn_racing {
+    size_t checkpoints;
+    size_t elite;
+    double margin;
+
+    double* partials;
+    size_t* reported;
+    unsigned char* aborted;
+
+    size_t elite_count;
+    double* elite_partials;
+    double* elite_fitness;
+
+    atomic_uint_fast64_t partials_reported;
+    atomic_uint_fast64_t aborted_count;
+    atomic_uint_fast64_t checkpoints_skipped;
+    uint64_t completed;
+};
+
+/**
+ * \brief Frees the state of the racing.
+ *
+ * \param racing the state, NULL is ignored
+ */
+void racing_destroy(evlearn_racing* racing)
+{
+    if (racing == NULL)
+        return;
+
+    free(racing->partials);
+    free(racing->reported);
+    free(racing->aborted);
+    free(racing->elite_partials);
+    free(racing->elite_fitness);
+    free(racing);
+}
+
+/**
+ * \brief Starts racing the individuals of the current population.
+ * Their episodes report the partial fitness at every checkpoint with
+ * race(), which tells them to stop once they fall behind the elite.
+ * It has to be called after init(), which ends it. Calling it again
+ * starts over with an empty elite.
+ *
+ * \param ctx the context
+ * \param checkpoints checkpoints of every episode, 0 stops racing
+ * \param elite trajectories compared with, the best ones completed
+ * \param margin fraction of the elite partial fitness an individual
+ * can fall behind without being stopped
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int set_racing(evlearn_ctx* ctx, size_t checkpoints, size_t elite, double margin)
+{
+    evlearn_racing* racing = NULL;
+    size_t n = ctx->population_size;
+
+    racing_destroy(ctx->racing);
+    ctx->racing = NULL;
+
+    if (checkpoints == 0)
+        return 0;
+    if (ctx->population == NULL || elite == 0 || margin < 0)
+        return 1;
+
+    racing = calloc(1, sizeof(evlearn_racing));
+    if (racing == NULL)
+        return 1;
+    racing->checkpoints = checkpoints;
+    racing->elite = elite;
+    racing->margin = margin;
+    racing->partials = malloc(sizeof(double) * n * checkpoints);
+    racing->reported = calloc(n, sizeof(size_t));
+    racing->aborted = calloc(n, 1);
+    racing->elite_partials = malloc(sizeof(double) * elite * checkpoints);
+    racing->elite_fitness = malloc(sizeof(double) * elite);
+    if (racing->partials == NULL || racing->reported == NULL || racing->aborted == NULL ||
+        racing->elite_partials == NULL || racing->elite_fitness == NULL) {
+        racing_destroy(racing);
+        return 1;
+    }
+
+    ctx->racing = racing;
+    return 0;
+}
+
+/**
+ * \brief Index of the individual a chromosome of the population
+ * belongs to, population_size if it is not one of them. The addresses
+ * are compared as integers, as any buffer can be given.
+ */
+static size_t find_index(const evlearn_ctx* ctx, const evlearn_gene* chromosome)
+{
+    uintptr_t first = (uintptr_t) ctx->population[0].chromosome;
+    uintptr_t address = (uintptr_t) chromosome;
+    uintptr_t stride = ctx->chrom_stride * sizeof(evlearn_gene);
+
+    if (address < first || (address - first) % stride != 0 ||
+        (address - first) / stride >= ctx->population_size)
+        return ctx->population_size;
+    return (size_t) ((address - first) / stride);
+}
+
+/**
+ * \brief Reports the partial fitness of an individual at a checkpoint
+ * of its episode. It is stopped if the elite is full and its partial
+ * fitness is below the lowest partial fitness of the elite at the same
+ * checkpoint by more than margin times it. The estimate is then the
+ * partial fitness scaled by the lowest ratio of the final over the
+ * partial fitness of the elite from that checkpoint, the most
+ * pessimistic way the elite went on. It can be called from several
+ * threads at the same time for different individuals.
+ *
+ * Only the chromosomes of the population can be raced, as evaluate()
+ * gives them to the fitness function and get_chromosome() to ask /
+ * tell. The copies of evaluate_steady(), steady_ask() and the farm
+ * workers are not.
+ *
+ * \param ctx the context
+ * \param chromosome the chromosome of the individual, in the
+ * population
+ * \param checkpoint the checkpoint, the one after the last reported
+ * \param partial the fitness of the episode so far
+ * \param estimate where the fitness to tell is stored if it is stopped
+ *
+ * \return 1 if the episode has to stop, 0 otherwise, -1 if the
+ * chromosome is not in the population or the checkpoint is out of
+ * order, which is not raced
+ */
+int race(
+    evlearn_ctx* ctx,
+    const evlearn_gene* chromosome,
+    size_t checkpoint,
+    double partial,
+    double* estimate)
+{
+    evlearn_racing* racing = ctx->racing;
+    size_t index = 0;
+    double reference = 0;
+    double ratio = 0;
+
+    if (racing == NULL)
+        return 0;
+    index = find_index(ctx, chromosome);
+    if (index == ctx->population_size || checkpoint >= racing->checkpoints ||
+        checkpoint != racing->reported[index] || racing->aborted[index])
+        return -1;
+
+    racing->partials[index * racing->checkpoints + checkpoint] = partial;
+    racing->reported[index]++;
+    atomic_fetch_add_explicit(&racing->partials_reported, 1, memory_order_relaxed);
+    if (racing->elite_count < racing->elite)
+        return 0;
+
+    for (size_t e = 0; e < racing->elite_count; e++) {
+        double elite_partial = racing->elite_partials[e * racing->checkpoints + checkpoint];
+        double elite_ratio = elite_partial != 0 ? racing->elite_fitness[e] / elite_partial : 1;
+
+        if (e == 0 || elite_partial < reference) {
+            reference = elite_partial;
+        }
+        if (e == 0 || elite_ratio < ratio) {
+            ratio = elite_ratio;
+        }
+    }
+    if (partial >= reference - racing->margin * (reference > 0 ? reference : -reference))
+        return 0;
+
+    racing->aborted[index] = 1;
+    atomic_fetch_add_explicit(&racing->aborted_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&racing->checkpoints_skipped,
+        racing->checkpoints - checkpoint - 1, memory_order_relaxed);
+    *estimate = partial * ratio;
+    return 1;
+}
+
+/**
+ * \brief Checks if the trajectory of an individual is already in the
+ * elite, as the best individual kept from one generation to the next
+ * is evaluated again with the same partial and final fitness.
+ */
+static int in_elite(const evlearn_racing* racing, size_t index, double fitness)
+{
+    size_t c = racing->checkpoints;
+
+    for (size_t e = 0; e < racing->elite_count; e++) {
+        size_t i = 0;
+
+        if (racing->elite_fitness[e] != fitness)
+            continue;
+        while (i < c && racing->elite_partials[e * c + i] == racing->partials[index * c + i]) {
+            i++;
+        }
+        if (i == c)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Takes the final fitness of a raced individual. If it ran
+ * every checkpoint, its trajectory is not in the elite yet and it is
+ * better than the worst of the elite, it replaces that one, then its
+ * slots are cleared for the next episode. Without the check for
+ * copies the elite would fill with the best individual alone and stop
+ * everything below it.
+ *
+ * \return 1 if the fitness is an estimate of a stopped individual
+ */
+int racing_tell(evlearn_racing* racing, size_t index, double fitness)
+{
+    size_t c = racing->checkpoints;
+    int aborted = racing->aborted[index];
+    size_t slot = racing->elite_count;
+
+    if (!aborted && racing->reported[index] == c) {
+        racing->completed++;
+        if (in_elite(racing, index, fitness)) {
+            slot = racing->elite;
+        }
+        else if (racing->elite_count == racing->elite) {
+            slot = 0;
+            for (size_t e = 1; e < racing->elite; e++) {
+                if (racing->elite_fitness[e] < racing->elite_fitness[slot]) {
+                    slot = e;
+                }
+            }
+            slot = fitness > racing->elite_fitness[slot] ? slot : racing->elite;
+        }
+        else {
+            racing->elite_count++;
+        }
+        if (slot < racing->elite) {
+            racing->elite_fitness[slot] = fitness;
+            for (size_t i = 0; i < c; i++) {
+                racing->elite_partials[slot * c + i] = racing->partials[index * c + i];
+            }
+        }
+    }
+    racing->reported[index] = 0;
+    racing->aborted[index] = 0;
+    return aborted;
+}
+
+/**
+ * \brief Gets the counters of the racing, all 0 if it is not enabled.
+ */
+evlearn_racing_stats get_racing_stats(const evlearn_ctx* ctx)
+{
+    evlearn_racing_stats stats = {0};
+    evlearn_racing* racing = ctx->racing;
+
+    if (racing != NULL) {
+        stats.completed = racing->completed;
+        stats.aborted = atomic_load_explicit(&racing->aborted_count, memory_order_relaxed);
+        stats.partials = atomic_load_explicit(&racing->partials_reported, memory_order_relaxed);
+        stats.skipped = atomic_load_explicit(&racing->checkpoints_skipped, memory_order_relaxed);
+        stats.elite = racing->elite_count;
+    }
+    return stats;
+}
@@ -0,0 +1,200 @@
+/**
+ * File: evlearn_rng.c
+ * Description: This is the implementation of the random
+ *              number generator declared in evlearn.h.
+ *              It is xoshiro256** seeded with splitmix64.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "../include/evlearn.h"
+
+#include <math.h>
+
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+#define PI 3.14159265358979323846
+
+/**
+ * \brief Step of the splitmix64 generator, used to expand the
+ * seed into the xoshiro state.
+ *
+ * \param x state of the splitmix64 generator
+ *
+ * \return the next value
+ */
+static uint64_t splitmix64(uint64_t* x)
+{
+    uint64_t z = (*x += GOLDEN_GAMMA);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * \brief Seeds the generator with the stream identified by the
+ * triple (seed, generation, individual). Different triples give
+ * independent streams, so every individual of every generation can
+ * draw its own numbers in any order or thread and the run stays
+ * reproducible.
+ *
+ * \param rng the generator
+ * \param seed seed of the run
+ * \param generation generation the numbers are drawn for
+ * \param individual individual the numbers are drawn for
+ */
+void rng_seed(evlearn_rng* rng, uint64_t seed, uint64_t generation, uint64_t individual)
+{
+    uint64_t x = seed;
+    uint64_t key = splitmix64(&x);
+
+    x = key ^ generation;
+    key = splitmix64(&x);
+    x = key ^ individual;
+    key = splitmix64(&x);
+
+    x = key;
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&x);
+    }
+}
+
+/**
+ * \brief Draws 64 random bits.
+ */
+uint64_t rng_next(evlearn_rng* rng)
+{
+    uint64_t* s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+/**
+ * \brief Draws a double uniformly distributed in [0, 1).
+ */
+double rng_uniform(evlearn_rng* rng)
+{
+    return (double) (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * \brief Fills a buffer with doubles uniformly distributed in [0, 1).
+ *
+ * \param rng the generator
+ * \param out buffer to fill
+ * \param count number of values
+ */
+void rng_fill_uniform(evlearn_rng* rng, double* out, size_t count)
+{
+    uint64_t s0 = rng->s[0];
+    uint64_t s1 = rng->s[1];
+    uint64_t s2 = rng->s[2];
+    uint64_t s3 = rng->s[3];
+
+    // The state is kept in registers for the whole buffer.
+    for (size_t i = 0; i < count; i++) {
+        uint64_t result = rotl(s1 * 5, 7) * 9;
+        uint64_t t = s1 << 17;
+
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = rotl(s3, 45);
+
+        out[i] = (double) (result >> 11) * 0x1.0p-53;
+    }
+    rng->s[0] = s0;
+    rng->s[1] = s1;
+    rng->s[2] = s2;
+    rng->s[3] = s3;
+}
+
+/**
+ * \brief Fills a buffer with floats uniformly distributed in [0, 1).
+ * Every draw gives two of them, from its upper and lower 24 bits, so
+ * it takes half the draws of rng_fill_uniform().
+ *
+ * \param rng the generator
+ * \param out buffer to fill
+ * \param count number of values
+ */
+void rng_fill_uniform_float(evlearn_rng* rng, float* out, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        uint64_t result = rng_next(rng);
+
+        out[i] = (float) (result >> 40) * 0x1.0p-24f;
+        out[i + 1] = (float) ((result >> 8) & 0xffffff) * 0x1.0p-24f;
+    }
+    if (i < count) {
+        out[i] = (float) (rng_next(rng) >> 40) * 0x1.0p-24f;
+    }
+}
+
+/**
+ * \brief Fills a buffer with genes uniformly distributed in [0, 1),
+ * using the function of the type of evlearn_gene.
+ */
+void rng_fill_uniform_genes(evlearn_rng* rng, evlearn_gene* out, size_t count)
+{
+#ifdef EVLEARN_FLOAT_GENES
+    rng_fill_uniform_float(rng, out, count);
+#else
+    rng_fill_uniform(rng, out, count);
+#endif
+}
+
+/**
+ * \brief Fills a buffer with random bits, 64 per word.
+ *
+ * \param rng the generator
+ * \param out buffer to fill
+ * \param count number of 64 bit words
+ */
+void rng_fill_bits(evlearn_rng* rng, uint64_t* out, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = rng_next(rng);
+    }
+}
+
+/**
+ * \brief Fills a buffer with doubles normally distributed with mean
+ * 0 and deviation 1, two per pair of uniform draws by the Box-Muller
+ * transform.
+ *
+ * \param rng the generator
+ * \param out buffer to fill
+ * \param count number of values
+ */
+void rng_fill_normal(evlearn_rng* rng, double* out, size_t count)
+{
+    for (size_t i = 0; i < count; i += 2) {
+        double radius = sqrt(-2 * log(1 - rng_uniform(rng)));
+        double angle = 2 * PI * rng_uniform(rng);
+
+        out[i] = radius * cos(angle);
+        if (i + 1 < count) {
+            out[i + 1] = radius * sin(angle);
+        }
+    }
+}
@@ -0,0 +1,286 @@
+/**
+ * File: evlearn_select.c
+ * Description: This is the implementation of the selection
+ *              methods of the genetic algorithm.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+/**
+ * \brief Draws an index in the range [0, n).
+ */
+static size_t draw_index(evlearn_rng* rng, size_t n)
+{
+    size_t r = (size_t) (rng_uniform(rng) * n);
+
+    return r < n ? r : n - 1;
+}
+
+/**
+ * \brief Runs one tournament of k contestants. Without replacement
+ * the contestants are distinct, they are drawn with a partial
+ * Fisher-Yates shuffle of ctx->order, which has to hold a permutation
+ * of the population, so it costs O(k) and k is capped to the
+ * population size. With replacement any k is allowed.
+ *
+ * The individuals set in skip are passed over: without replacement
+ * the draws go on until k others are found or the population runs
+ * out, with replacement they take k draws anyway.
+ *
+ * \param ctx the context
+ * \param rng the generator the contestants are drawn from
+ * \param k number of contestants
+ * \param replacement 1 to draw with replacement, 0 otherwise
+ * \param loser 1 to get the worst contestant instead of the best one
+ * \param skip the individuals that cannot take part, or NULL
+ *
+ * \return the index of the winner, or of the loser, the best
+ * individual if every contestant drawn is skipped
+ */
+size_t run_tournament(evlearn_ctx* ctx, evlearn_rng* rng, size_t k, int replacement, int loser,
+    const unsigned char* skip)
+{
+    size_t n = ctx->population_size;
+    size_t* order = ctx->order;
+    size_t winner = ctx->best;
+    double winner_f = 0;
+    size_t found = 0;
+    size_t drawn = 0;
+
+    if (k == 0) {
+        k = 1;
+    }
+    if (!replacement && k > n) {
+        k = n;
+    }
+
+    for (; found < k && drawn < (replacement ? k : n); drawn++) {
+        size_t contestant = 0;
+        double f = 0;
+
+        if (replacement) {
+            contestant = draw_index(rng, n);
+        }
+        else {
+            size_t r = drawn + draw_index(rng, n - drawn);
+
+            contestant = order[r];
+            order[r] = order[drawn];
+            order[drawn] = contestant;
+        }
+        if (skip != NULL && skip[contestant])
+            continue;
+        f = ctx->population[contestant].fitness;
+        if (found == 0 || (loser ? f < winner_f : f > winner_f)) {
+            winner = contestant;
+            winner_f = f;
+        }
+        found++;
+    }
+    STATS_ADD(ctx, selection_draws, found);
+    STATS_ADD(ctx, rng_draws, drawn);
+    return winner;
+}
+
+/**
+ * \brief Tournament selection, one tournament of k contestants per
+ * individual.
+ */
+static void select_tournament(evlearn_ctx* ctx, size_t k, int replacement)
+{
+    size_t n = ctx->population_size;
+
+    for (size_t i = 0; i < n; i++) {
+        ctx->order[i] = i;
+    }
+    for (size_t t = 0; t < n; t++) {
+        ctx->population[run_tournament(ctx, &ctx->rng, k, replacement, 0, NULL)].s_count++;
+    }
+}
+
+/**
+ * \brief Checks if the individual a ranks below the individual b,
+ * by fitness and then by index, so that the ranking is total and
+ * its first individual is the one find_best() gives.
+ */
+static int worse(const evlearn_ctx* ctx, size_t a, size_t b)
+{
+    double a_f = ctx->population[a].fitness;
+    double b_f = ctx->population[b].fitness;
+
+    return a_f < b_f || (a_f == b_f && a > b);
+}
+
+/**
+ * \brief Restores the heap property of order[root..size), the root
+ * being the worst individual.
+ */
+static void sift_down(const evlearn_ctx* ctx, size_t* order, size_t root, size_t size)
+{
+    while (root * 2 + 1 < size) {
+        size_t child = root * 2 + 1;
+        size_t swap = 0;
+
+        if (child + 1 < size && worse(ctx, order[child + 1], order[child])) {
+            child++;
+        }
+        if (!worse(ctx, order[child], order[root]))
+            return;
+        swap = order[root];
+        order[root] = order[child];
+        order[child] = swap;
+        root = child;
+    }
+}
+
+/**
+ * \brief Sorts the indices of the population from the best to the
+ * worst fitness. It is a heapsort, so it is O(N log N) and needs no
+ * memory but the given buffer.
+ *
+ * \param ctx the context
+ * \param order buffer of population_size indices
+ */
+void rank_population(const evlearn_ctx* ctx, size_t* order)
+{
+    size_t n = ctx->population_size;
+
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (size_t i = n / 2; i > 0; i--) {
+        sift_down(ctx, order, i - 1, n);
+    }
+    for (size_t end = n - 1; end > 0; end--) {
+        size_t swap = order[0];
+        order[0] = order[end];
+        order[end] = swap;
+        sift_down(ctx, order, 0, end);
+    }
+}
+
+/**
+ * \brief Stochastic universal sampling over the weights of the
+ * individuals in ctx->order, given by weight_of. N equally spaced
+ * pointers with a single random offset go through the cumulative
+ * weights once, so the whole mating list costs O(N).
+ */
+static void sample_universal(
+    evlearn_ctx* ctx, double (*weight_of)(const evlearn_ctx*, size_t, double), double offset)
+{
+    size_t n = ctx->population_size;
+    double total = 0;
+    double step = 0;
+    double pointer = 0;
+    double cumulative = 0;
+    size_t i = 0;
+
+    for (size_t j = 0; j < n; j++) {
+        total += weight_of(ctx, j, offset);
+    }
+    if (!(total > 0)) {
+        for (size_t j = 0; j < n; j++) {
+            ctx->population[j].s_count++;
+        }
+        return;
+    }
+
+    step = total / n;
+    pointer = rng_uniform(&ctx->rng) * step;
+    STATS_ADD(ctx, selection_draws, 1);
+    STATS_ADD(ctx, rng_draws, 1);
+    cumulative = weight_of(ctx, 0, offset);
+    for (size_t p = 0; p < n; p++) {
+        while (pointer >= cumulative && i < n - 1) {
+            i++;
+            cumulative += weight_of(ctx, i, offset);
+        }
+        ctx->population[ctx->order[i]].s_count++;
+        pointer += step;
+    }
+}
+
+/**
+ * \brief Weight of the individual at the position i of the ranking
+ * in linear rank selection, from pressure for the best to
+ * 2 - pressure for the worst.
+ */
+static double rank_weight(const evlearn_ctx* ctx, size_t i, double pressure)
+{
+    size_t n = ctx->population_size;
+
+    if (n == 1)
+        return 1;
+    return pressure - (2 * pressure - 2) * i / (n - 1);
+}
+
+/**
+ * \brief Weight of an individual in fitness proportional selection,
+ * its fitness over the worst one.
+ */
+static double fitness_weight(const evlearn_ctx* ctx, size_t i, double worst)
+{
+    return ctx->population[ctx->order[i]].fitness - worst;
+}
+
+/**
+ * \brief Implements the selection method of the genetic algorithm.
+ * It adds to the s_count of every individual the number of times it
+ * is selected, population_size selections in total, using the method
+ * chosen with set_selection(). It works on the order buffer of the
+ * arena, so it does not allocate.
+ *
+ * \param ctx the context
+ * \param k number of individuals in every tournament
+ */
+void select_population(evlearn_ctx* ctx, size_t k)
+{
+    double worst = 0;
+
+    switch (ctx->selection) {
+    case EVLEARN_SELECT_TOURNAMENT:
+        select_tournament(ctx, k, 0);
+        break;
+    case EVLEARN_SELECT_TOURNAMENT_REPLACEMENT:
+        select_tournament(ctx, k, 1);
+        break;
+    case EVLEARN_SELECT_RANK:
+        rank_population(ctx, ctx->order);
+        sample_universal(ctx, rank_weight, ctx->rank_pressure);
+        break;
+    case EVLEARN_SELECT_SUS:
+        worst = ctx->population[0].fitness;
+        for (size_t i = 0; i < ctx->population_size; i++) {
+            ctx->order[i] = i;
+            if (ctx->population[i].fitness < worst) {
+                worst = ctx->population[i].fitness;
+            }
+        }
+        sample_universal(ctx, fitness_weight, worst);
+        break;
+    }
+}
+
+/**
+ * \brief Chooses the selection method used by compute_next_generation().
+ *
+ * \param ctx the context
+ * \param selection the method
+ * \param rank_pressure expected number of selections of the best
+ * individual in rank selection, within {1, 2}
+ *
+ * \return 0 for success, 1 if the arguments are not valid
+ */
+int set_selection(evlearn_ctx* ctx, evlearn_selection selection, double rank_pressure)
+{
+    if (selection < EVLEARN_SELECT_TOURNAMENT || selection > EVLEARN_SELECT_SUS ||
+        !(rank_pressure >= 1 && rank_pressure <= 2))
+        return 1;
+
+    ctx->selection = selection;
+    ctx->rank_pressure = rank_pressure;
+    return 0;
+}
@@ -0,0 +1,358 @@
+/**
+ * File: evlearn_sim.c
+ * Description: This is the implementation of the headless
+ *              simulator declared in evlearn.h, a truck with
+ *              bicycle kinematics driving along a road with
+ *              barriers, seen through a ray cast LiDAR.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "../include/evlearn.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define PI 3.14159265358979323846
+
+// Metres between two points of the centreline.
+#define SEGMENT 2.0
+
+// Points of the centreline at the start of the road that are straight.
+#define STRAIGHT_POINTS 10
+
+/**
+ * The road is a polyline of points every SEGMENT metres, with the
+ * barriers at road_half_width on both sides of it. Nothing changes
+ * after create_sim(), so any number of threads can run episodes on
+ * the same simulator at the same time.
+ */
+struct evlearn_sim {
+    evlearn_sim_config config;
+    size_t points;
+    size_t window;
+    double* center;
+    double* left;
+    double* right;
+    double* left_length;
+    double* right_length;
+};
+
+/**
+ * State of the truck in an episode. segment is the index of the
+ * centreline segment the truck is on, it only moves a few segments
+ * per step, so the projection on the road is O(1).
+ */
+typedef struct truck {
+    double x;
+    double y;
+    double heading;
+    double speed;
+    size_t segment;
+    double progress;
+    double lateral;
+} truck;
+
+/**
+ * \brief Fills the config with the default simulator, a road of 1 km
+ * with curves down to a radius of 50 m and a LiDAR of 9 bundles, the
+ * columns of the chromosome of the truck controller.
+ */
+void sim_default_config(evlearn_sim_config* config)
+{
+    config->bundles = 9;
+    config->rays_per_bundle = 1;
+    config->fov = PI;
+    config->lidar_range = 30;
+    config->road_length = 1000;
+    config->road_half_width = 4;
+    config->max_curvature = 0.02;
+    config->truck_half_width = 1.2;
+    config->wheelbase = 5;
+    config->max_steering = 0.5;
+    config->max_speed = 25;
+    config->max_acceleration = 3;
+    config->dt = 0.1;
+    config->duration = 60;
+    config->seed = EVLEARN_DEFAULT_SEED;
+}
+
+/**
+ * \brief Builds the road. The curvature is a random walk that decays
+ * towards a straight road, so the curves change smoothly, and it is
+ * integrated into the heading and the points of the centreline.
+ *
+ * \return the simulator, NULL if the config is not valid or on error
+ */
+evlearn_sim* create_sim(const evlearn_sim_config* config)
+{
+    evlearn_sim* sim = NULL;
+    evlearn_rng rng;
+    double curvature = 0;
+    double heading = 0;
+
+    if (config == NULL || config->bundles == 0 || config->bundles > EVLEARN_SIM_MAX_BUNDLES ||
+        config->rays_per_bundle == 0 ||
+        config->road_length < 2 * SEGMENT || config->road_half_width <= config->truck_half_width ||
+        config->lidar_range <= 0 || config->wheelbase <= 0 || config->dt <= 0) {
+        return NULL;
+    }
+    sim = malloc(sizeof(evlearn_sim));
+    if (sim == NULL) {
+        return NULL;
+    }
+    sim->config = *config;
+    sim->points = (size_t) (config->road_length / SEGMENT) + 1;
+    sim->window = (size_t) (config->lidar_range / SEGMENT) + 4;
+    sim->center = malloc(sizeof(double) * sim->points * 8);
+    if (sim->center == NULL) {
+        free(sim);
+        return NULL;
+    }
+    sim->left = sim->center + sim->points * 2;
+    sim->right = sim->left + sim->points * 2;
+    sim->left_length = sim->right + sim->points * 2;
+    sim->right_length = sim->left_length + sim->points;
+
+    rng_seed(&rng, config->seed, 0, 0);
+    sim->center[0] = 0;
+    sim->center[1] = 0;
+    for (size_t i = 0; i < sim->points; i++) {
+        double nx = -sin(heading);
+        double ny = cos(heading);
+
+        if (i > 0) {
+            sim->center[i * 2] = sim->center[(i - 1) * 2] + cos(heading) * SEGMENT;
+            sim->center[i * 2 + 1] = sim->center[(i - 1) * 2 + 1] + sin(heading) * SEGMENT;
+        }
+        sim->left[i * 2] = sim->center[i * 2] + nx * config->road_half_width;
+        sim->left[i * 2 + 1] = sim->center[i * 2 + 1] + ny * config->road_half_width;
+        sim->right[i * 2] = sim->center[i * 2] - nx * config->road_half_width;
+        sim->right[i * 2 + 1] = sim->center[i * 2 + 1] - ny * config->road_half_width;
+
+        if (i >= STRAIGHT_POINTS) {
+            curvature = curvature * 0.95 + (rng_uniform(&rng) - 0.5) * config->max_curvature * 0.4;
+            curvature = truncate_value(curvature, -config->max_curvature, config->max_curvature);
+        }
+        heading += curvature * SEGMENT;
+    }
+    for (size_t i = 0; i + 1 < sim->points; i++) {
+        sim->left_length[i] = hypot(
+            sim->left[i * 2 + 2] - sim->left[i * 2], sim->left[i * 2 + 3] - sim->left[i * 2 + 1]);
+        sim->right_length[i] = hypot(
+            sim->right[i * 2 + 2] - sim->right[i * 2], sim->right[i * 2 + 3] - sim->right[i * 2 + 1]);
+    }
+
+    return sim;
+}
+
+void destroy_sim(evlearn_sim* sim)
+{
+    if (sim != NULL) {
+        free(sim->center);
+        free(sim);
+    }
+}
+
+/**
+ * \brief Distance along the ray from (x, y) with direction (dx, dy)
+ * to the segment a-b, or limit if it does not hit it before. It only
+ * divides once it knows that the ray hits.
+ */
+static double hit_segment(
+    double x, double y, double dx, double dy, const double* a, const double* b, double limit)
+{
+    double ex = b[0] - a[0];
+    double ey = b[1] - a[1];
+    double denom = dx * ey - dy * ex;
+    double px = a[0] - x;
+    double py = a[1] - y;
+    double t = px * ey - py * ex;
+    double u = px * dy - py * dx;
+
+    if (denom < 0) {
+        denom = -denom;
+        t = -t;
+        u = -u;
+    }
+    return denom > 0 && t >= 0 && t < limit * denom && u >= 0 && u <= denom ? t / denom : limit;
+}
+
+static double distance(const double* point, const truck* t)
+{
+    double dx = point[0] - t->x;
+    double dy = point[1] - t->y;
+
+    return sqrt(dx * dx + dy * dy);
+}
+
+/**
+ * \brief Reads the LiDAR into readings, one per bundle from the right
+ * to the left of the truck. A bundle is the nearest hit of its rays
+ * divided by the range, 1 if nothing is in range. Only the barrier
+ * segments from just behind the truck to the range ahead are tested,
+ * and reach, the distance to the truck of the nearest point any of
+ * them can have, is found once for all the rays, so a ray skips the
+ * segments farther than its nearest hit with a single comparison.
+ */
+static void read_lidar(const evlearn_sim* sim, const truck* t, double* reach, double* readings)
+{
+    const evlearn_sim_config* c = &sim->config;
+    size_t rays = c->bundles * c->rays_per_bundle;
+    size_t first = t->segment > 2 ? t->segment - 2 : 0;
+    size_t last = first + sim->window;
+
+    last = last < sim->points - 1 ? last : sim->points - 1;
+    for (size_t i = first; i < last; i++) {
+        reach[(i - first) * 2] = distance(sim->left + i * 2, t) - sim->left_length[i];
+        reach[(i - first) * 2 + 1] = distance(sim->right + i * 2, t) - sim->right_length[i];
+    }
+    for (size_t b = 0; b < c->bundles; b++) {
+        double nearest = c->lidar_range;
+
+        for (size_t r = b * c->rays_per_bundle; r < (b + 1) * c->rays_per_bundle; r++) {
+            double angle = t->heading - c->fov / 2 + c->fov * (r + 0.5) / rays;
+            double dx = cos(angle);
+            double dy = sin(angle);
+
+            for (size_t i = first; i < last; i++) {
+                if (reach[(i - first) * 2] < nearest) {
+                    nearest = hit_segment(t->x, t->y, dx, dy,
+                        sim->left + i * 2, sim->left + i * 2 + 2, nearest);
+                }
+                if (reach[(i - first) * 2 + 1] < nearest) {
+                    nearest = hit_segment(t->x, t->y, dx, dy,
+                        sim->right + i * 2, sim->right + i * 2 + 2, nearest);
+                }
+            }
+        }
+        readings[b] = nearest / c->lidar_range;
+    }
+}
+
+/**
+ * \brief Position of the projection of (x, y) on a centreline
+ * segment, 0 at its start and 1 at its end.
+ */
+static double segment_position(const evlearn_sim* sim, size_t segment, double x, double y)
+{
+    const double* a = sim->center + segment * 2;
+
+    return ((x - a[0]) * (a[2] - a[0]) + (y - a[1]) * (a[3] - a[1])) / (SEGMENT * SEGMENT);
+}
+
+/**
+ * \brief Projects the truck on the centreline, moving to the segment
+ * it is on, and updates its progress along the road and its distance
+ * to the centreline, positive to the left.
+ *
+ * \return 1 if the truck went past the end of the road, 0 otherwise
+ */
+static int project(const evlearn_sim* sim, truck* t)
+{
+    double u = segment_position(sim, t->segment, t->x, t->y);
+    const double* a = NULL;
+
+    while (u > 1 && t->segment + 2 < sim->points) {
+        t->segment++;
+        u = segment_position(sim, t->segment, t->x, t->y);
+    }
+    // Outside of a curve the truck can be past one segment and before the next one.
+    while (u < 0 && t->segment > 0 && segment_position(sim, t->segment - 1, t->x, t->y) <= 1) {
+        t->segment--;
+        u = segment_position(sim, t->segment, t->x, t->y);
+    }
+    a = sim->center + t->segment * 2;
+    t->progress = (t->segment + (u < 0 && t->segment > 0 ? 0 : u)) * SEGMENT;
+    t->lateral = ((a[2] - a[0]) * (t->y - a[1]) - (a[3] - a[1]) * (t->x - a[0])) / SEGMENT;
+    return u > 1;
+}
+
+/**
+ * \brief Drives the truck with a chromosome until it hits a barrier,
+ * reaches the end of the road or the duration of the episode. The
+ * LiDAR readings are the inputs of evlearn_apply(), the row 0 of the
+ * chromosome gives the steering and the row 1 the throttle, both
+ * through a tanh, and the rest of the rows are not used. The fitness
+ * is tt * av², the time travelled by the average velocity along the
+ * road squared.
+ *
+ * A truck stopped with the throttle not pushing sees the same readings
+ * and gives the same outputs at every step, so it never moves again
+ * and the episode skips to its end.
+ *
+ * \return 0 for success, 1 if the chromosome does not have 2 rows of
+ * bundles genes at least or on error
+ */
+int sim_episode(
+    const evlearn_sim* sim,
+    const evlearn_gene* chromosome,
+    size_t rows,
+    size_t cols,
+    evlearn_sim_result* result)
+{
+    static const evlearn_activation activation[2] = {
+        EVLEARN_ACTIVATION_TANH, EVLEARN_ACTIVATION_TANH
+    };
+    const evlearn_sim_config* c = &sim->config;
+    size_t steps = (size_t) (c->duration / c->dt);
+    double readings[EVLEARN_SIM_MAX_BUNDLES];
+    double outputs[2];
+    double* reach = NULL;
+    truck t = {0};
+    size_t step = 0;
+    double velocity = 0;
+
+    if (rows < 2 || cols != c->bundles || cols > EVLEARN_SIM_MAX_BUNDLES) {
+        return 1;
+    }
+    reach = malloc(sizeof(double) * sim->window * 2);
+    if (reach == NULL) {
+        return 1;
+    }
+    result->crashed = 0;
+    result->finished = 0;
+
+    for (step = 0; step < steps && !result->crashed && !result->finished; step++) {
+        double steering = 0;
+
+        read_lidar(sim, &t, reach, readings);
+        evlearn_apply(chromosome, 2, cols, readings, outputs, activation, NULL, NULL);
+        if (t.speed == 0 && outputs[1] <= 0) {
+            step = steps;
+            break;
+        }
+        steering = outputs[0] * c->max_steering;
+
+        t.speed = truncate_value(
+            t.speed + outputs[1] * c->max_acceleration * c->dt, 0, c->max_speed);
+        t.heading += t.speed / c->wheelbase * tan(steering) * c->dt;
+        t.x += t.speed * cos(t.heading) * c->dt;
+        t.y += t.speed * sin(t.heading) * c->dt;
+
+        result->finished = project(sim, &t);
+        result->crashed = fabs(t.lateral) > c->road_half_width - c->truck_half_width;
+    }
+    free(reach);
+
+    result->time = step * c->dt;
+    result->distance = t.progress > 0 ? t.progress : 0;
+    velocity = result->time > 0 ? result->distance / result->time : 0;
+    result->fitness = result->time * velocity * velocity;
+    return 0;
+}
+
+/**
+ * \brief Fitness function for evaluate(), user_data is the simulator.
+ * It returns 0 if the episode can't be run.
+ */
+double sim_fitness(const evlearn_gene* chromosome, size_t rows, size_t cols, void* user_data)
+{
+    evlearn_sim_result result;
+
+    if (sim_episode((const evlearn_sim*) user_data, chromosome, rows, cols, &result)) {
+        return 0;
+    }
+    return result.fitness;
+}
@@ -0,0 +1,929 @@
+/**
+ * File: evlearn_simd.c
+ * Description: This is the implementation of the gene
+ *              kernels declared in evlearn.h, with SSE2,
+ *              AVX2 and AVX-512 versions picked at runtime
+ *              and a scalar fallback. The vector versions
+ *              are written for double or float genes.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "../include/evlearn.h"
+
+#include <stdatomic.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EVLEARN_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * Every version of the kernels gives exactly the same genes as the
+ * scalar one: the masks select the same values and the mutation
+ * does the same operations in the same order, which is why this
+ * file is built without floating point contraction. The distance and
+ * the dot products are exactly the same as well: whatever the width
+ * of the registers, they sum the blocks of PARTIAL_SUMS genes into
+ * as many partial sums, reduce them with reduce_sums() and add the
+ * genes left after the last block one by one.
+ */
+typedef struct kernels {
+    void (*cross)(
+        evlearn_gene*, const evlearn_gene*, const evlearn_gene*, const uint64_t*, size_t);
+    size_t (*mutate)(
+        evlearn_gene*, 
+        const evlearn_gene*, 
+        const evlearn_gene*, 
+        const evlearn_gene*, 
+        const evlearn_gene*, 
+        double, 
+        size_t);
+    void (*truncate)(evlearn_gene*, const evlearn_gene*, const evlearn_gene*, size_t);
+    double (*distance)(const evlearn_gene*, const evlearn_gene*, size_t);
+    double (*dot)(const evlearn_gene*, const double*, size_t);
+    void (*dot4)(const evlearn_gene*, const double*, size_t, size_t, double*);
+} kernels;
+
+//SCALAR-------------------------------------------------------------------------------------------
+
+static void cross_scalar(
+    evlearn_gene* son,
+    const evlearn_gene* mother,
+    const evlearn_gene* father,
+    const uint64_t* bits,
+    size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+static size_t mutate_scalar(
+    evlearn_gene* genes,
+    const evlearn_gene* min,
+    const evlearn_gene* max,
+    const evlearn_gene* threshold,
+    const evlearn_gene* random,
+    double omega,
+    size_t count)
+{
+    evlearn_gene o = (evlearn_gene) omega;
+    size_t mutated = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (threshold[i] < o) {
+            genes[i] = min[i] + random[i] * (max[i] - min[i]);
+            mutated++;
+        }
+    }
+    return mutated;
+}
+
+static void truncate_scalar(
+    evlearn_gene* genes, const evlearn_gene* min, const evlearn_gene* max, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        genes[i] = truncate_value(genes[i], min[i], max[i]);
+    }
+}
+
+#define PARTIAL_SUMS 8
+
+/**
+ * \brief Adds up the partial sums of the distance and dot kernels, in
+ * the order a vector of 8, then 4, then 2 lanes halves in.
+ */
+static double reduce_sums(const double* sums)
+{
+    return ((sums[0] + sums[4]) + (sums[2] + sums[6])) +
+        ((sums[1] + sums[5]) + (sums[3] + sums[7]));
+}
+
+static double distance_tail(const evlearn_gene* a, const evlearn_gene* b, size_t count)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        double sub = (double) a[i] - b[i];
+        sum += sub * sub;
+    }
+    return sum;
+}
+
+static double dot_tail(const evlearn_gene* weights, const double* inputs, size_t count)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        sum += weights[i] * inputs[i];
+    }
+    return sum;
+}
+
+static double distance_scalar(const evlearn_gene* a, const evlearn_gene* b, size_t count)
+{
+    double sums[PARTIAL_SUMS] = {0};
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (size_t j = 0; j < PARTIAL_SUMS; j++) {
+            double sub = (double) a[i + j] - b[i + j];
+            sums[j] += sub * sub;
+        }
+    }
+    return reduce_sums(sums) + distance_tail(a + i, b + i, count - i);
+}
+
+static double dot_scalar(const evlearn_gene* weights, const double* inputs, size_t count)
+{
+    double sums[PARTIAL_SUMS] = {0};
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (size_t j = 0; j < PARTIAL_SUMS; j++) {
+            sums[j] += weights[i + j] * inputs[i + j];
+        }
+    }
+    return reduce_sums(sums) + dot_tail(weights + i, inputs + i, count - i);
+}
+
+static void dot4_scalar(
+    const evlearn_gene* weights, const double* inputs, size_t stride, size_t count, double* out)
+{
+    for (int k = 0; k < 4; k++) {
+        out[k] = dot_scalar(weights, inputs + k * stride, count);
+    }
+}
+
+static const kernels scalar_kernels = {
+    cross_scalar, mutate_scalar, truncate_scalar, distance_scalar, dot_scalar, dot4_scalar
+};
+
+#ifdef EVLEARN_X86
+
+/**
+ * Loads of 2, 4 or 8 genes as doubles, so that the distance is
+ * summed as double whatever the type of the genes.
+ */
+#ifdef EVLEARN_FLOAT_GENES
+#define LOAD2_PD(p) _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*) (p))))
+#define LOAD4_PD(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define LOAD8_PD(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+#else
+#define LOAD2_PD(p) _mm_loadu_pd(p)
+#define LOAD4_PD(p) _mm256_loadu_pd(p)
+#define LOAD8_PD(p) _mm512_loadu_pd(p)
+#endif
+
+#ifndef EVLEARN_FLOAT_GENES
+
+//SSE2---------------------------------------------------------------------------------------------
+
+/**
+ * Masks selecting the father for the 4 combinations of 2 bits.
+ */
+static const uint64_t sse2_masks[4][2] = {
+    {0, 0}, {~0ULL, 0}, {0, ~0ULL}, {~0ULL, ~0ULL}
+};
+
+__attribute__((target("sse2")))
+static __m128d select_sse2(__m128d mask, __m128d if_false, __m128d if_true)
+{
+    return _mm_or_pd(_mm_and_pd(mask, if_true), _mm_andnot_pd(mask, if_false));
+}
+
+__attribute__((target("sse2")))
+static void cross_sse2(
+    double* son, const double* mother, const double* father, const uint64_t* bits, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        unsigned pair = (bits[i / 64] >> (i % 64)) & 3;
+        __m128d mask = _mm_castsi128_pd(_mm_loadu_si128((const __m128i*) sse2_masks[pair]));
+
+        _mm_storeu_pd(son + i,
+            select_sse2(mask, _mm_loadu_pd(mother + i), _mm_loadu_pd(father + i)));
+    }
+    for (; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+__attribute__((target("sse2")))
+static size_t mutate_sse2(
+    double* genes,
+    const double* min,
+    const double* max,
+    const double* threshold,
+    const double* random,
+    double omega,
+    size_t count)
+{
+    __m128d o = _mm_set1_pd(omega);
+    size_t mutated = 0;
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m128d lo = _mm_loadu_pd(min + i);
+        __m128d value = _mm_add_pd(lo,
+            _mm_mul_pd(_mm_loadu_pd(random + i), _mm_sub_pd(_mm_loadu_pd(max + i), lo)));
+        __m128d mask = _mm_cmplt_pd(_mm_loadu_pd(threshold + i), o);
+
+        _mm_storeu_pd(genes + i, select_sse2(mask, _mm_loadu_pd(genes + i), value));
+        mutated += __builtin_popcount(_mm_movemask_pd(mask));
+    }
+    return mutated +
+        mutate_scalar(genes + i, min + i, max + i, threshold + i, random + i, omega, count - i);
+}
+
+__attribute__((target("sse2")))
+static void truncate_sse2(double* genes, const double* min, const double* max, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 2 <= count; i += 2) {
+        __m128d value = _mm_loadu_pd(genes + i);
+        __m128d lo = _mm_loadu_pd(min + i);
+        __m128d hi = _mm_loadu_pd(max + i);
+
+        value = select_sse2(_mm_cmpgt_pd(value, hi), value, hi);
+        value = select_sse2(_mm_cmplt_pd(value, lo), value, lo);
+        _mm_storeu_pd(genes + i, value);
+    }
+    truncate_scalar(genes + i, min + i, max + i, count - i);
+}
+
+//AVX2---------------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void cross_avx2(
+    double* son, const double* mother, const double* father, const uint64_t* bits, size_t count)
+{
+    __m256i select = _mm256_setr_epi64x(1, 2, 4, 8);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        long long nibble = (bits[i / 64] >> (i % 64)) & 15;
+        __m256i set = _mm256_and_si256(_mm256_set1_epi64x(nibble), select);
+        __m256d mask = _mm256_castsi256_pd(_mm256_cmpeq_epi64(set, select));
+
+        _mm256_storeu_pd(son + i,
+            _mm256_blendv_pd(_mm256_loadu_pd(mother + i), _mm256_loadu_pd(father + i), mask));
+    }
+    for (; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t mutate_avx2(
+    double* genes,
+    const double* min,
+    const double* max,
+    const double* threshold,
+    const double* random,
+    double omega,
+    size_t count)
+{
+    __m256d o = _mm256_set1_pd(omega);
+    size_t mutated = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256d lo = _mm256_loadu_pd(min + i);
+        __m256d value = _mm256_add_pd(lo,
+            _mm256_mul_pd(_mm256_loadu_pd(random + i), _mm256_sub_pd(_mm256_loadu_pd(max + i), lo)));
+        __m256d mask = _mm256_cmp_pd(_mm256_loadu_pd(threshold + i), o, _CMP_LT_OQ);
+
+        _mm256_storeu_pd(genes + i, _mm256_blendv_pd(_mm256_loadu_pd(genes + i), value, mask));
+        mutated += __builtin_popcount(_mm256_movemask_pd(mask));
+    }
+    return mutated +
+        mutate_scalar(genes + i, min + i, max + i, threshold + i, random + i, omega, count - i);
+}
+
+__attribute__((target("avx2")))
+static void truncate_avx2(double* genes, const double* min, const double* max, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m256d value = _mm256_loadu_pd(genes + i);
+        __m256d lo = _mm256_loadu_pd(min + i);
+        __m256d hi = _mm256_loadu_pd(max + i);
+
+        value = _mm256_blendv_pd(value, hi, _mm256_cmp_pd(value, hi, _CMP_GT_OQ));
+        value = _mm256_blendv_pd(value, lo, _mm256_cmp_pd(value, lo, _CMP_LT_OQ));
+        _mm256_storeu_pd(genes + i, value);
+    }
+    truncate_scalar(genes + i, min + i, max + i, count - i);
+}
+
+//AVX-512------------------------------------------------------------------------------------------
+
+__attribute__((target("avx512f")))
+static void cross_avx512(
+    double* son, const double* mother, const double* father, const uint64_t* bits, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __mmask8 mask = (__mmask8) (bits[i / 64] >> (i % 64));
+
+        _mm512_storeu_pd(son + i,
+            _mm512_mask_blend_pd(mask, _mm512_loadu_pd(mother + i), _mm512_loadu_pd(father + i)));
+    }
+    for (; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+__attribute__((target("avx512f")))
+static size_t mutate_avx512(
+    double* genes,
+    const double* min,
+    const double* max,
+    const double* threshold,
+    const double* random,
+    double omega,
+    size_t count)
+{
+    __m512d o = _mm512_set1_pd(omega);
+    size_t mutated = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m512d lo = _mm512_loadu_pd(min + i);
+        __m512d value = _mm512_add_pd(lo,
+            _mm512_mul_pd(_mm512_loadu_pd(random + i), _mm512_sub_pd(_mm512_loadu_pd(max + i), lo)));
+        __mmask8 mask = _mm512_cmp_pd_mask(_mm512_loadu_pd(threshold + i), o, _CMP_LT_OQ);
+
+        _mm512_mask_storeu_pd(genes + i, mask, value);
+        mutated += __builtin_popcount(mask);
+    }
+    return mutated +
+        mutate_scalar(genes + i, min + i, max + i, threshold + i, random + i, omega, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void truncate_avx512(double* genes, const double* min, const double* max, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m512d value = _mm512_loadu_pd(genes + i);
+        __m512d lo = _mm512_loadu_pd(min + i);
+        __m512d hi = _mm512_loadu_pd(max + i);
+
+        value = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(value, hi, _CMP_GT_OQ), value, hi);
+        value = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(value, lo, _CMP_LT_OQ), value, lo);
+        _mm512_storeu_pd(genes + i, value);
+    }
+    truncate_scalar(genes + i, min + i, max + i, count - i);
+}
+
+#else
+
+//SSE2---------------------------------------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static __m128 select_sse2(__m128 mask, __m128 if_false, __m128 if_true)
+{
+    return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false));
+}
+
+__attribute__((target("sse2")))
+static void cross_sse2(
+    float* son, const float* mother, const float* father, const uint64_t* bits, size_t count)
+{
+    __m128i select = _mm_setr_epi32(1, 2, 4, 8);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        int nibble = (bits[i / 64] >> (i % 64)) & 15;
+        __m128i set = _mm_and_si128(_mm_set1_epi32(nibble), select);
+        __m128 mask = _mm_castsi128_ps(_mm_cmpeq_epi32(set, select));
+
+        _mm_storeu_ps(son + i,
+            select_sse2(mask, _mm_loadu_ps(mother + i), _mm_loadu_ps(father + i)));
+    }
+    for (; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+__attribute__((target("sse2")))
+static size_t mutate_sse2(
+    float* genes,
+    const float* min,
+    const float* max,
+    const float* threshold,
+    const float* random,
+    double omega,
+    size_t count)
+{
+    __m128 o = _mm_set1_ps((float) omega);
+    size_t mutated = 0;
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 lo = _mm_loadu_ps(min + i);
+        __m128 value = _mm_add_ps(lo,
+            _mm_mul_ps(_mm_loadu_ps(random + i), _mm_sub_ps(_mm_loadu_ps(max + i), lo)));
+        __m128 mask = _mm_cmplt_ps(_mm_loadu_ps(threshold + i), o);
+
+        _mm_storeu_ps(genes + i, select_sse2(mask, _mm_loadu_ps(genes + i), value));
+        mutated += __builtin_popcount(_mm_movemask_ps(mask));
+    }
+    return mutated +
+        mutate_scalar(genes + i, min + i, max + i, threshold + i, random + i, omega, count - i);
+}
+
+__attribute__((target("sse2")))
+static void truncate_sse2(float* genes, const float* min, const float* max, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4) {
+        __m128 value = _mm_loadu_ps(genes + i);
+        __m128 lo = _mm_loadu_ps(min + i);
+        __m128 hi = _mm_loadu_ps(max + i);
+
+        value = select_sse2(_mm_cmpgt_ps(value, hi), value, hi);
+        value = select_sse2(_mm_cmplt_ps(value, lo), value, lo);
+        _mm_storeu_ps(genes + i, value);
+    }
+    truncate_scalar(genes + i, min + i, max + i, count - i);
+}
+
+//AVX2---------------------------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static void cross_avx2(
+    float* son, const float* mother, const float* father, const uint64_t* bits, size_t count)
+{
+    __m256i select = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        int byte = (bits[i / 64] >> (i % 64)) & 255;
+        __m256i set = _mm256_and_si256(_mm256_set1_epi32(byte), select);
+        __m256 mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(set, select));
+
+        _mm256_storeu_ps(son + i,
+            _mm256_blendv_ps(_mm256_loadu_ps(mother + i), _mm256_loadu_ps(father + i), mask));
+    }
+    for (; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+__attribute__((target("avx2")))
+static size_t mutate_avx2(
+    float* genes,
+    const float* min,
+    const float* max,
+    const float* threshold,
+    const float* random,
+    double omega,
+    size_t count)
+{
+    __m256 o = _mm256_set1_ps((float) omega);
+    size_t mutated = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 lo = _mm256_loadu_ps(min + i);
+        __m256 value = _mm256_add_ps(lo,
+            _mm256_mul_ps(_mm256_loadu_ps(random + i), _mm256_sub_ps(_mm256_loadu_ps(max + i), lo)));
+        __m256 mask = _mm256_cmp_ps(_mm256_loadu_ps(threshold + i), o, _CMP_LT_OQ);
+
+        _mm256_storeu_ps(genes + i, _mm256_blendv_ps(_mm256_loadu_ps(genes + i), value, mask));
+        mutated += __builtin_popcount(_mm256_movemask_ps(mask));
+    }
+    return mutated +
+        mutate_scalar(genes + i, min + i, max + i, threshold + i, random + i, omega, count - i);
+}
+
+__attribute__((target("avx2")))
+static void truncate_avx2(float* genes, const float* min, const float* max, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256 value = _mm256_loadu_ps(genes + i);
+        __m256 lo = _mm256_loadu_ps(min + i);
+        __m256 hi = _mm256_loadu_ps(max + i);
+
+        value = _mm256_blendv_ps(value, hi, _mm256_cmp_ps(value, hi, _CMP_GT_OQ));
+        value = _mm256_blendv_ps(value, lo, _mm256_cmp_ps(value, lo, _CMP_LT_OQ));
+        _mm256_storeu_ps(genes + i, value);
+    }
+    truncate_scalar(genes + i, min + i, max + i, count - i);
+}
+
+//AVX-512------------------------------------------------------------------------------------------
+
+__attribute__((target("avx512f")))
+static void cross_avx512(
+    float* son, const float* mother, const float* father, const uint64_t* bits, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __mmask16 mask = (__mmask16) (bits[i / 64] >> (i % 64));
+
+        _mm512_storeu_ps(son + i,
+            _mm512_mask_blend_ps(mask, _mm512_loadu_ps(mother + i), _mm512_loadu_ps(father + i)));
+    }
+    for (; i < count; i++) {
+        son[i] = (bits[i / 64] >> (i % 64)) & 1 ? father[i] : mother[i];
+    }
+}
+
+__attribute__((target("avx512f")))
+static size_t mutate_avx512(
+    float* genes,
+    const float* min,
+    const float* max,
+    const float* threshold,
+    const float* random,
+    double omega,
+    size_t count)
+{
+    __m512 o = _mm512_set1_ps((float) omega);
+    size_t mutated = 0;
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m512 lo = _mm512_loadu_ps(min + i);
+        __m512 value = _mm512_add_ps(lo,
+            _mm512_mul_ps(_mm512_loadu_ps(random + i), _mm512_sub_ps(_mm512_loadu_ps(max + i), lo)));
+        __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(threshold + i), o, _CMP_LT_OQ);
+
+        _mm512_mask_storeu_ps(genes + i, mask, value);
+        mutated += __builtin_popcount(mask);
+    }
+    return mutated +
+        mutate_scalar(genes + i, min + i, max + i, threshold + i, random + i, omega, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void truncate_avx512(float* genes, const float* min, const float* max, size_t count)
+{
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m512 value = _mm512_loadu_ps(genes + i);
+        __m512 lo = _mm512_loadu_ps(min + i);
+        __m512 hi = _mm512_loadu_ps(max + i);
+
+        value = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(value, hi, _CMP_GT_OQ), value, hi);
+        value = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(value, lo, _CMP_LT_OQ), value, lo);
+        _mm512_storeu_ps(genes + i, value);
+    }
+    truncate_scalar(genes + i, min + i, max + i, count - i);
+}
+
+#endif
+
+//DISTANCE-----------------------------------------------------------------------------------------
+
+/**
+ * The vector versions keep the PARTIAL_SUMS partial sums in 4, 2 or
+ * 1 registers, lane j of register r holding sum r * lanes + j, and
+ * store them in that order for reduce_sums().
+ */
+
+__attribute__((target("sse2")))
+static double distance_sse2(const evlearn_gene* a, const evlearn_gene* b, size_t count)
+{
+    __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (int r = 0; r < 4; r++) {
+            __m128d sub = _mm_sub_pd(LOAD2_PD(a + i + r * 2), LOAD2_PD(b + i + r * 2));
+            sum[r] = _mm_add_pd(sum[r], _mm_mul_pd(sub, sub));
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        _mm_storeu_pd(sums + r * 2, sum[r]);
+    }
+    return reduce_sums(sums) + distance_tail(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double distance_avx2(const evlearn_gene* a, const evlearn_gene* b, size_t count)
+{
+    __m256d sum[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (int r = 0; r < 2; r++) {
+            __m256d sub = _mm256_sub_pd(LOAD4_PD(a + i + r * 4), LOAD4_PD(b + i + r * 4));
+            sum[r] = _mm256_add_pd(sum[r], _mm256_mul_pd(sub, sub));
+        }
+    }
+    _mm256_storeu_pd(sums, sum[0]);
+    _mm256_storeu_pd(sums + 4, sum[1]);
+    return reduce_sums(sums) + distance_tail(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static double distance_avx512(const evlearn_gene* a, const evlearn_gene* b, size_t count)
+{
+    __m512d sum = _mm512_setzero_pd();
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        __m512d sub = _mm512_sub_pd(LOAD8_PD(a + i), LOAD8_PD(b + i));
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(sub, sub));
+    }
+    _mm512_storeu_pd(sums, sum);
+    return reduce_sums(sums) + distance_tail(a + i, b + i, count - i);
+}
+
+//DOT----------------------------------------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static double dot_sse2(const evlearn_gene* weights, const double* inputs, size_t count)
+{
+    __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (int r = 0; r < 4; r++) {
+            sum[r] = _mm_add_pd(sum[r],
+                _mm_mul_pd(LOAD2_PD(weights + i + r * 2), _mm_loadu_pd(inputs + i + r * 2)));
+        }
+    }
+    for (int r = 0; r < 4; r++) {
+        _mm_storeu_pd(sums + r * 2, sum[r]);
+    }
+    return reduce_sums(sums) + dot_tail(weights + i, inputs + i, count - i);
+}
+
+__attribute__((target("sse2")))
+static void dot4_sse2(
+    const evlearn_gene* weights, const double* inputs, size_t stride, size_t count, double* out)
+{
+    __m128d sum[4][4];
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (int k = 0; k < 4; k++) {
+        for (int r = 0; r < 4; r++) {
+            sum[k][r] = _mm_setzero_pd();
+        }
+    }
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (int r = 0; r < 4; r++) {
+            __m128d w = LOAD2_PD(weights + i + r * 2);
+
+            for (int k = 0; k < 4; k++) {
+                sum[k][r] = _mm_add_pd(sum[k][r],
+                    _mm_mul_pd(w, _mm_loadu_pd(inputs + k * stride + i + r * 2)));
+            }
+        }
+    }
+    for (int k = 0; k < 4; k++) {
+        for (int r = 0; r < 4; r++) {
+            _mm_storeu_pd(sums + r * 2, sum[k][r]);
+        }
+        out[k] = reduce_sums(sums) + dot_tail(weights + i, inputs + k * stride + i, count - i);
+    }
+}
+
+__attribute__((target("avx2")))
+static double dot_avx2(const evlearn_gene* weights, const double* inputs, size_t count)
+{
+    __m256d sum[2] = {_mm256_setzero_pd(), _mm256_setzero_pd()};
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (int r = 0; r < 2; r++) {
+            sum[r] = _mm256_add_pd(sum[r],
+                _mm256_mul_pd(LOAD4_PD(weights + i + r * 4), _mm256_loadu_pd(inputs + i + r * 4)));
+        }
+    }
+    _mm256_storeu_pd(sums, sum[0]);
+    _mm256_storeu_pd(sums + 4, sum[1]);
+    return reduce_sums(sums) + dot_tail(weights + i, inputs + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void dot4_avx2(
+    const evlearn_gene* weights, const double* inputs, size_t stride, size_t count, double* out)
+{
+    __m256d sum[4][2];
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (int k = 0; k < 4; k++) {
+        sum[k][0] = _mm256_setzero_pd();
+        sum[k][1] = _mm256_setzero_pd();
+    }
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        for (int r = 0; r < 2; r++) {
+            __m256d w = LOAD4_PD(weights + i + r * 4);
+
+            for (int k = 0; k < 4; k++) {
+                sum[k][r] = _mm256_add_pd(sum[k][r],
+                    _mm256_mul_pd(w, _mm256_loadu_pd(inputs + k * stride + i + r * 4)));
+            }
+        }
+    }
+    for (int k = 0; k < 4; k++) {
+        _mm256_storeu_pd(sums, sum[k][0]);
+        _mm256_storeu_pd(sums + 4, sum[k][1]);
+        out[k] = reduce_sums(sums) + dot_tail(weights + i, inputs + k * stride + i, count - i);
+    }
+}
+
+__attribute__((target("avx512f")))
+static double dot_avx512(const evlearn_gene* weights, const double* inputs, size_t count)
+{
+    __m512d sum = _mm512_setzero_pd();
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        sum = _mm512_add_pd(sum, _mm512_mul_pd(LOAD8_PD(weights + i), _mm512_loadu_pd(inputs + i)));
+    }
+    _mm512_storeu_pd(sums, sum);
+    return reduce_sums(sums) + dot_tail(weights + i, inputs + i, count - i);
+}
+
+__attribute__((target("avx512f")))
+static void dot4_avx512(
+    const evlearn_gene* weights, const double* inputs, size_t stride, size_t count, double* out)
+{
+    __m512d sum[4] = {
+        _mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd(), _mm512_setzero_pd()
+    };
+    double sums[PARTIAL_SUMS];
+    size_t i = 0;
+
+    for (; i + PARTIAL_SUMS <= count; i += PARTIAL_SUMS) {
+        __m512d w = LOAD8_PD(weights + i);
+
+        for (int k = 0; k < 4; k++) {
+            sum[k] = _mm512_add_pd(sum[k],
+                _mm512_mul_pd(w, _mm512_loadu_pd(inputs + k * stride + i)));
+        }
+    }
+    for (int k = 0; k < 4; k++) {
+        _mm512_storeu_pd(sums, sum[k]);
+        out[k] = reduce_sums(sums) + dot_tail(weights + i, inputs + k * stride + i, count - i);
+    }
+}
+
+static const kernels sse2_kernels = {
+    cross_sse2, mutate_sse2, truncate_sse2, distance_sse2, dot_sse2, dot4_sse2
+};
+
+static const kernels avx2_kernels = {
+    cross_avx2, mutate_avx2, truncate_avx2, distance_avx2, dot_avx2, dot4_avx2
+};
+
+static const kernels avx512_kernels = {
+    cross_avx512, mutate_avx512, truncate_avx512, distance_avx512, dot_avx512, dot4_avx512
+};
+
+#endif
+
+//DISPATCH-----------------------------------------------------------------------------------------
+
+/**
+ * Instruction set in use, -1 until the first kernel runs.
+ */
+static atomic_int current_simd = -1;
+
+/**
+ * \brief Checks if the CPU supports an instruction set.
+ *
+ * \return 1 if it is supported, 0 otherwise
+ */
+static int supported(evlearn_simd simd)
+{
+#ifdef EVLEARN_X86
+    __builtin_cpu_init();
+    switch (simd) {
+    case EVLEARN_SIMD_SCALAR:
+        return 1;
+    case EVLEARN_SIMD_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case EVLEARN_SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case EVLEARN_SIMD_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    }
+    return 0;
+#else
+    return simd == EVLEARN_SIMD_SCALAR;
+#endif
+}
+
+/**
+ * \brief Gets the instruction set the kernels run on, detecting the
+ * best one supported by the CPU the first time.
+ */
+evlearn_simd get_simd()
+{
+    int simd = atomic_load(&current_simd);
+
+    if (simd < 0) {
+        simd = EVLEARN_SIMD_AVX512;
+        while (!supported(simd)) {
+            simd--;
+        }
+        atomic_store(&current_simd, simd);
+    }
+    return simd;
+}
+
+/**
+ * \brief Forces the instruction set of the kernels.
+ *
+ * \param simd the instruction set
+ *
+ * \return 0 for success, 1 if the CPU does not support it
+ */
+int set_simd(evlearn_simd simd)
+{
+    if (simd < EVLEARN_SIMD_SCALAR || simd > EVLEARN_SIMD_AVX512 || !supported(simd))
+        return 1;
+
+    atomic_store(&current_simd, simd);
+    return 0;
+}
+
+static const kernels* active_kernels()
+{
+#ifdef EVLEARN_X86
+    switch (get_simd()) {
+    case EVLEARN_SIMD_SCALAR:
+        return &scalar_kernels;
+    case EVLEARN_SIMD_SSE2:
+        return &sse2_kernels;
+    case EVLEARN_SIMD_AVX2:
+        return &avx2_kernels;
+    case EVLEARN_SIMD_AVX512:
+        return &avx512_kernels;
+    }
+#endif
+    return &scalar_kernels;
+}
+
+void cross_genes(
+    evlearn_gene* son,
+    const evlearn_gene* mother,
+    const evlearn_gene* father,
+    const uint64_t* bits,
+    size_t count)
+{
+    active_kernels()->cross(son, mother, father, bits, count);
+}
+
+size_t mutate_genes(
+    evlearn_gene* genes,
+    const evlearn_gene* min,
+    const evlearn_gene* max,
+    const evlearn_gene* threshold,
+    const evlearn_gene* random,
+    double omega,
+    size_t count)
+{
+    return active_kernels()->mutate(genes, min, max, threshold, random, omega, count);
+}
+
+void truncate_genes(
+    evlearn_gene* genes, const evlearn_gene* min, const evlearn_gene* max, size_t count)
+{
+    active_kernels()->truncate(genes, min, max, count);
+}
+
+double squared_distance(const evlearn_gene* a, const evlearn_gene* b, size_t count)
+{
+    return active_kernels()->distance(a, b, count);
+}
+
+double dot_genes(const evlearn_gene* weights, const double* inputs, size_t count)
+{
+    return active_kernels()->dot(weights, inputs, count);
+}
+
+void dot4_genes(
+    const evlearn_gene* weights, const double* inputs, size_t stride, size_t count, double* out)
+{
+    active_kernels()->dot4(weights, inputs, stride, count, out);
+}
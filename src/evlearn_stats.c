@@ -0,0 +1,192 @@
+/**
+ * File: evlearn_stats.c
+ * Description: This is the implementation of the hot path
+ *              instrumentation declared in evlearn.h.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <string.h>
+
+#ifdef EVLEARN_STATS
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EVLEARN_TSC
+#include <x86intrin.h>
+#endif
+
+/**
+ * Names of the timers in the trace.
+ */
+static const char* timer_names[EVLEARN_TIMERS] = {
+    "select", "cross", "mutate", "rank", "evaluate", "io", "screen", "sample"
+};
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double ns_per_tick = 1;
+
+static uint64_t clock_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t stats_ticks()
+{
+#ifdef EVLEARN_TSC
+    return __rdtsc();
+#else
+    return clock_ns();
+#endif
+}
+
+/**
+ * \brief Measures the nanoseconds per tick of the time stamp counter
+ * against the monotonic clock, spinning for 2 ms. It runs once per
+ * process, the first time the stats or a trace need it.
+ */
+static void calibrate()
+{
+#ifdef EVLEARN_TSC
+    uint64_t start_ns = clock_ns();
+    uint64_t start_ticks = stats_ticks();
+    uint64_t ns = 0;
+
+    do {
+        ns = clock_ns() - start_ns;
+    } while (ns < 2000000);
+    ns_per_tick = (double) ns / (stats_ticks() - start_ticks);
+#endif
+}
+
+/**
+ * \brief Adds the ticks since start to the timer and, if there is an
+ * open trace, writes a complete event for it.
+ *
+ * \param instruments the instruments of the context
+ * \param timer the timer
+ * \param start the ticks when the timed code started
+ * \param generation the current generation, stored in the event
+ */
+void stats_time(evlearn_instruments* instruments, evlearn_timer timer, uint64_t start, size_t generation)
+{
+    uint64_t end = stats_ticks();
+
+    instruments->stats.ticks[timer] += end - start;
+    instruments->stats.calls[timer]++;
+
+    if (instruments->trace != NULL) {
+        fprintf(instruments->trace,
+            "%s{\"name\":\"%s\",\"cat\":\"evlearn\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":1,\"args\":{\"generation\":%zu}}",
+            instruments->trace_events == 0 ? "" : ",\n",
+            timer_names[timer],
+            (start - instruments->trace_start) * ns_per_tick / 1000,
+            (end - start) * ns_per_tick / 1000,
+            (int) getpid(),
+            generation);
+        instruments->trace_events++;
+    }
+}
+
+#endif
+
+/**
+ * \brief Gets the timers and counters of the context, all 0 if the
+ * library is built without EVLEARN_STATS.
+ */
+evlearn_stats get_stats(const evlearn_ctx* ctx)
+{
+    evlearn_stats stats = {0};
+
+#ifdef EVLEARN_STATS
+    pthread_once(&calibrate_once, calibrate);
+    stats = ctx->instruments->stats;
+    stats.ns_per_tick = ns_per_tick;
+#else
+    (void) ctx;
+#endif
+    return stats;
+}
+
+/**
+ * \brief Sets every timer and counter of the context to 0.
+ */
+void reset_stats(evlearn_ctx* ctx)
+{
+#ifdef EVLEARN_STATS
+    memset(&ctx->instruments->stats, 0, sizeof(evlearn_stats));
+#else
+    (void) ctx;
+#endif
+}
+
+/**
+ * \brief Starts writing an event per timed operation to a file in
+ * the Chrome trace event format, which can be opened in
+ * chrome://tracing or Perfetto. A trace already open is closed.
+ *
+ * \param ctx the context
+ * \param file_path path of the trace
+ *
+ * \return 0 for success, 1 otherwise or if the library is built
+ * without EVLEARN_STATS
+ */
+int open_trace(evlearn_ctx* ctx, const char* file_path)
+{
+#ifdef EVLEARN_STATS
+    evlearn_instruments* instruments = ctx->instruments;
+
+    if (file_path == NULL)
+        return 1;
+
+    close_trace(ctx);
+    pthread_once(&calibrate_once, calibrate);
+
+    instruments->trace = fopen(file_path, "w");
+    if (instruments->trace == NULL)
+        return 1;
+    fprintf(instruments->trace, "[\n");
+    instruments->trace_start = stats_ticks();
+    instruments->trace_events = 0;
+    return 0;
+#else
+    (void) ctx;
+    (void) file_path;
+    return 1;
+#endif
+}
+
+/**
+ * \brief Ends the trace of the context and closes the file. It does
+ * nothing if there is no trace open.
+ *
+ * \return 0 for success, 1 if the file could not be written
+ */
+int close_trace(evlearn_ctx* ctx)
+{
+#ifdef EVLEARN_STATS
+    evlearn_instruments* instruments = ctx->instruments;
+    int result = 0;
+
+    if (instruments->trace == NULL)
+        return 0;
+
+    fprintf(instruments->trace, "\n]\n");
+    result = fclose(instruments->trace) != 0;
+    instruments->trace = NULL;
+    return result;
+#else
+    (void) ctx;
+    return 0;
+#endif
+}
@@ -0,0 +1,51 @@
+/**
+ * File: evlearn_stats.h
+ * Description: This is a private header with the macros that
+ *              instrument the hot path of the library. They
+ *              compile to nothing unless EVLEARN_STATS is
+ *              defined.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "../include/evlearn.h"
+
+#include <stdio.h>
+
+#pragma once
+
+/**
+ * Instruments of a context. It is allocated apart from the context
+ * so that functions taking a const context can still count. trace is
+ * the Chrome trace file opened by open_trace(), trace_start the tick
+ * its timestamps are relative to and trace_events the number of
+ * events written to it.
+ */
+typedef struct evlearn_instruments {
+    evlearn_stats stats;
+    FILE* trace;
+    uint64_t trace_start;
+    uint64_t trace_events;
+} evlearn_instruments;
+
+#ifdef EVLEARN_STATS
+
+// Reads the time stamp counter of the CPU, or a monotonic clock in nanoseconds elsewhere.
+uint64_t stats_ticks();
+
+// Adds the ticks since start to a timer and writes the event to the trace if it is open.
+void stats_time(evlearn_instruments* instruments, evlearn_timer timer, uint64_t start, size_t generation);
+
+#define STATS_START(start) uint64_t start = stats_ticks()
+#define STATS_TIME(ctx, timer, start) \
+    stats_time((ctx)->instruments, timer, start, (ctx)->generation)
+#define STATS_ADD(ctx, counter, n) ((ctx)->instruments->stats.counter += (n))
+
+#else
+
+#define STATS_START(start) ((void) 0)
+#define STATS_TIME(ctx, timer, start) ((void) 0)
+#define STATS_ADD(ctx, counter, n) ((void) 0)
+
+#endif
@@ -0,0 +1,435 @@
+/**
+ * File: evlearn_steady.c
+ * Description: This is the implementation of the steady
+ *              state mode declared in evlearn.h, where every
+ *              evaluation that completes replaces one
+ *              individual and a new one is bred at once.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Every function of the mode takes lock, so any number of evaluator
+ * threads can ask and tell at the same time. Breeding one offspring
+ * is O(genes), much shorter than an evaluation, so the workers hardly
+ * ever wait for it.
+ *
+ * rng is the only random stream of the mode, so a single thread
+ * asking and telling in the same order always gets the same results.
+ * pending marks the individuals of the population handed out by
+ * steady_ask() for their first evaluation, they are neither parents
+ * nor replaced. Tickets below the population size are those
+ * individuals, the rest are offspring, and outstanding holds the
+ * tickets of the offspring handed out and not told yet. inserted
+ * counts the offspring told, every population_size of them is a
+ * generation.
+ */
+struct evlearn_steady {
+    pthread_mutex_t lock;
+    evlearn_rng rng;
+    size_t tournament_size;
+    double mutation_probability;
+    evlearn_replacement replacement;
+    unsigned char* pending;
+    uint64_t* outstanding;
+    size_t outstanding_count;
+    size_t outstanding_capacity;
+    uint64_t next_ticket;
+    size_t inserted;
+};
+
+/**
+ * \brief Runs a tournament of tournament_size distinct contestants
+ * among the individuals evaluated, passing over the pending ones.
+ *
+ * \return the index of the winner, or of the loser, the best
+ * individual if none is evaluated
+ */
+static size_t steady_tournament(evlearn_ctx* ctx, evlearn_steady* steady, int loser)
+{
+    return run_tournament(ctx, &steady->rng, steady->tournament_size, 0, loser, steady->pending);
+}
+
+/**
+ * \brief Breeds an offspring into chromosome: uniform crossover of
+ * the winners of two tournaments and uniform mutation scaled by the
+ * mean fitness of the parents over the best one, like the mutation of
+ * compute_next_generation() does with the fitness of the individual.
+ */
+static void breed(evlearn_ctx* ctx, evlearn_steady* steady, evlearn_gene* chromosome)
+{
+    size_t cs = ctx->chrom_size;
+    size_t genes = ctx->chrom_array_size * cs;
+    size_t mother = steady_tournament(ctx, steady, 0);
+    size_t father = steady_tournament(ctx, steady, 0);
+    double parents_f = (ctx->population[mother].fitness + ctx->population[father].fitness) / 2;
+    double omega = mutation_rate(
+        parents_f, ctx->population[ctx->best].fitness, steady->mutation_probability);
+    size_t mutations = 0;
+
+    rng_fill_bits(&steady->rng, ctx->bits, (genes + 63) / 64);
+    cross_genes(chromosome,
+        ctx->population[mother].chromosome, ctx->population[father].chromosome, ctx->bits, genes);
+
+    rng_fill_uniform_genes(&steady->rng, ctx->uniform, genes * 2);
+    STATS_ADD(ctx, rng_draws, (genes + 63) / 64 + (genes * 2 * sizeof(evlearn_gene) + 7) / 8);
+    for (size_t i = 0; i < ctx->chrom_array_size; i++) {
+        mutations += mutate_genes(
+            chromosome + i * cs,
+            ctx->min_max_matrix + i * 2 * cs,
+            ctx->min_max_matrix + (i * 2 + 1) * cs,
+            ctx->uniform + i * cs,
+            ctx->uniform + genes + i * cs,
+            omega,
+            cs);
+    }
+    ctx->mutations += mutations;
+    STATS_ADD(ctx, genes_mutated, mutations);
+}
+
+/**
+ * \brief Finds the worst individual that can be replaced, that is
+ * neither the best one nor pending.
+ *
+ * \return its index, or population_size if there is none
+ */
+static size_t find_worst(const evlearn_ctx* ctx, const evlearn_steady* steady)
+{
+    size_t worst = ctx->population_size;
+
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        if (i != ctx->best && !steady->pending[i] &&
+            (worst == ctx->population_size ||
+                ctx->population[i].fitness < ctx->population[worst].fitness)) {
+            worst = i;
+        }
+    }
+    return worst;
+}
+
+/**
+ * \brief Chooses the individual replaced by an offspring with the
+ * replacement policy. The loser of a tournament is replaced by the
+ * worst one if it is the best or pending.
+ *
+ * \return its index, or population_size if there is none
+ */
+static size_t find_victim(evlearn_ctx* ctx, evlearn_steady* steady)
+{
+    size_t victim = 0;
+
+    if (steady->replacement == EVLEARN_REPLACE_TOURNAMENT) {
+        victim = steady_tournament(ctx, steady, 1);
+        if (victim != ctx->best && !steady->pending[victim])
+            return victim;
+    }
+    return find_worst(ctx, steady);
+}
+
+/**
+ * \brief Frees the state of the steady state mode.
+ *
+ * \param steady the state, NULL is ignored
+ */
+void steady_destroy(evlearn_steady* steady)
+{
+    if (steady == NULL)
+        return;
+
+    pthread_mutex_destroy(&steady->lock);
+    free(steady->pending);
+    free(steady->outstanding);
+    free(steady);
+}
+
+/**
+ * \brief Starts the steady state mode on the current population. From
+ * now on steady_ask() hands out the individuals not evaluated yet and
+ * then offspring bred from the population, and steady_tell() inserts
+ * every offspring evaluated in place of an individual chosen by the
+ * replacement policy. The best individual is never replaced. Calling
+ * it again restarts the mode with the new parameters.
+ *
+ * Individuals handed out by ask() and not told yet should be told
+ * before starting, as they can be replaced. compute_next_generation()
+ * must not be called while the mode is on.
+ *
+ * \param ctx the context, initialized
+ * \param tournament_size contestants of the tournaments of the parents
+ * and of the loser
+ * \param mutation_probability max mutation probability
+ * \param replacement the replacement policy
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int start_steady_state(
+    evlearn_ctx* ctx,
+    size_t tournament_size,
+    double mutation_probability,
+    evlearn_replacement replacement)
+{
+    evlearn_steady* steady = NULL;
+
+    if (ctx->population == NULL ||
+        (replacement != EVLEARN_REPLACE_WORST && replacement != EVLEARN_REPLACE_TOURNAMENT))
+        return 1;
+
+    stop_steady_state(ctx);
+    steady = calloc(1, sizeof(evlearn_steady));
+    if (steady == NULL)
+        return 1;
+    steady->pending = calloc(ctx->population_size, 1);
+    if (steady->pending == NULL || pthread_mutex_init(&steady->lock, NULL)) {
+        free(steady->pending);
+        free(steady);
+        return 1;
+    }
+
+    // The stream past the selection of the generation, no individual uses it.
+    rng_seed(&steady->rng, ctx->seed, ctx->generation,
+        (uint64_t) (ctx->population_size + 1) * EVLEARN_STREAMS);
+    steady->tournament_size = tournament_size;
+    steady->mutation_probability = mutation_probability;
+    steady->replacement = replacement;
+    steady->next_ticket = ctx->population_size;
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        ctx->order[i] = i;
+    }
+    ctx->mutations = 0;
+
+    ctx->steady = steady;
+    return 0;
+}
+
+/**
+ * \brief Ends the steady state mode. It does nothing if it is off.
+ */
+void stop_steady_state(evlearn_ctx* ctx)
+{
+    steady_destroy(ctx->steady);
+    ctx->steady = NULL;
+}
+
+/**
+ * \brief Records the ticket of an offspring handed out.
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int add_outstanding(evlearn_steady* steady, uint64_t ticket)
+{
+    if (steady->outstanding_count == steady->outstanding_capacity) {
+        size_t capacity = steady->outstanding_capacity > 0 ? steady->outstanding_capacity * 2 : 16;
+        uint64_t* grown = realloc(steady->outstanding, capacity * sizeof(uint64_t));
+
+        if (grown == NULL)
+            return 1;
+        steady->outstanding = grown;
+        steady->outstanding_capacity = capacity;
+    }
+    steady->outstanding[steady->outstanding_count++] = ticket;
+    return 0;
+}
+
+/**
+ * \brief Forgets the ticket of an offspring told. There are about as
+ * many outstanding as evaluator threads, so they are just scanned.
+ *
+ * \return 0 for success, 1 if it is not outstanding
+ */
+static int remove_outstanding(evlearn_steady* steady, uint64_t ticket)
+{
+    for (size_t i = 0; i < steady->outstanding_count; i++) {
+        if (steady->outstanding[i] == ticket) {
+            steady->outstanding[i] = steady->outstanding[--steady->outstanding_count];
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * \brief Hands out an individual to evaluate, copying its genes to
+ * chromosome. While there are individuals of the population not
+ * evaluated yet it is one of them, otherwise a new offspring. It can
+ * be called from several threads at the same time.
+ *
+ * \param ctx the context, in steady state mode
+ * \param chromosome buffer of chrom_array_size * chrom_size genes
+ * \param ticket where the ticket of the individual is stored
+ *
+ * \return 0 for success, 1 if the mode is off or out of memory
+ */
+int steady_ask(evlearn_ctx* ctx, evlearn_gene* chromosome, uint64_t* ticket)
+{
+    evlearn_steady* steady = ctx->steady;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t index = 0;
+    int result = 0;
+
+    if (steady == NULL || chromosome == NULL || ticket == NULL)
+        return 1;
+
+    pthread_mutex_lock(&steady->lock);
+    if (ask(ctx, &index, 1) == 1) {
+        steady->pending[index] = 1;
+        memcpy(chromosome, ctx->population[index].chromosome, genes * sizeof(evlearn_gene));
+        *ticket = index;
+    }
+    else if (add_outstanding(steady, steady->next_ticket)) {
+        result = 1;
+    }
+    else {
+        breed(ctx, steady, chromosome);
+        *ticket = steady->next_ticket++;
+    }
+    pthread_mutex_unlock(&steady->lock);
+
+    return result;
+}
+
+/**
+ * \brief Reports the fitness of an individual handed out by
+ * steady_ask(). An individual of the population just gets it, an
+ * offspring replaces the individual chosen by the replacement policy.
+ * It can be called from several threads at the same time.
+ *
+ * \param ctx the context, in steady state mode
+ * \param ticket the ticket given by steady_ask()
+ * \param chromosome the genes given by steady_ask()
+ * \param fitness its fitness
+ *
+ * \return 0 for success, 1 if the mode is off or the ticket is not one
+ * handed out and not told yet
+ */
+int steady_tell(evlearn_ctx* ctx, uint64_t ticket, const evlearn_gene* chromosome, double fitness)
+{
+    evlearn_steady* steady = ctx->steady;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t index = 0;
+    int result = 0;
+
+    if (steady == NULL || chromosome == NULL)
+        return 1;
+
+    pthread_mutex_lock(&steady->lock);
+    if (ticket < ctx->population_size) {
+        index = (size_t) ticket;
+        if (steady->pending[index]) {
+            steady->pending[index] = 0;
+            tell(ctx, &index, &fitness, 1);
+        }
+        else {
+            result = 1;
+        }
+    }
+    else if (remove_outstanding(steady, ticket)) {
+        result = 1;
+    }
+    else {
+        index = find_victim(ctx, steady);
+        if (index < ctx->population_size) {
+            memcpy(ctx->population[index].chromosome, chromosome, genes * sizeof(evlearn_gene));
+            tell(ctx, &index, &fitness, 1);
+        }
+        steady->inserted++;
+        if (steady->inserted % ctx->population_size == 0) {
+            STATS_ADD(ctx, generations, 1);
+            ctx->generation++;
+        }
+    }
+    pthread_mutex_unlock(&steady->lock);
+
+    return result;
+}
+
+/**
+ * Arguments shared by the workers of evaluate_steady().
+ */
+typedef struct steady_job {
+    evlearn_ctx* ctx;
+    evlearn_fitness_fn fitness_fn;
+    void* user_data;
+    atomic_size_t remaining;
+    atomic_int failed;
+} steady_job;
+
+/**
+ * \brief Pool task of a worker, it asks, evaluates and tells until
+ * the evaluations of the job run out.
+ */
+static void steady_task(size_t index, void* arg)
+{
+    steady_job* job = arg;
+    evlearn_ctx* ctx = job->ctx;
+    evlearn_gene* chromosome = malloc(ctx->chrom_array_size * ctx->chrom_size * sizeof(evlearn_gene));
+    size_t remaining = atomic_load(&job->remaining);
+    uint64_t ticket = 0;
+
+    (void) index;
+    if (chromosome == NULL) {
+        atomic_store(&job->failed, 1);
+        return;
+    }
+    while (remaining > 0) {
+        if (!atomic_compare_exchange_weak(&job->remaining, &remaining, remaining - 1))
+            continue;
+        if (steady_ask(ctx, chromosome, &ticket) ||
+            steady_tell(ctx, ticket, chromosome,
+                job->fitness_fn(chromosome, ctx->chrom_array_size, ctx->chrom_size, job->user_data))) {
+            atomic_store(&job->failed, 1);
+            break;
+        }
+        remaining = atomic_load(&job->remaining);
+    }
+    free(chromosome);
+}
+
+/**
+ * \brief Runs evaluations of the steady state mode on n_threads
+ * threads, the caller included. Every thread asks, evaluates and
+ * tells on its own, so none of them waits for the others.
+ *
+ * \param ctx the context, in steady state mode
+ * \param fitness_fn function computing the fitness of a chromosome
+ * \param user_data pointer passed to every call of fitness_fn
+ * \param n_threads number of threads evaluating
+ * \param evaluations number of evaluations to run
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int evaluate_steady(
+    evlearn_ctx* ctx,
+    evlearn_fitness_fn fitness_fn,
+    void* user_data,
+    size_t n_threads,
+    size_t evaluations)
+{
+    steady_job job = {ctx, fitness_fn, user_data, evaluations, 0};
+
+    if (ctx->steady == NULL || fitness_fn == NULL || n_threads == 0)
+        return 1;
+
+    if (ctx->pool != NULL && pool_size(ctx->pool) != n_threads) {
+        pool_destroy(ctx->pool);
+        ctx->pool = NULL;
+    }
+    if (ctx->pool == NULL) {
+        ctx->pool = pool_create(n_threads);
+        if (ctx->pool == NULL)
+            return 1;
+    }
+
+    STATS_START(start);
+    pool_run(ctx->pool, steady_task, &job, n_threads);
+    STATS_TIME(ctx, EVLEARN_TIMER_EVALUATE, start);
+
+    return atomic_load(&job.failed);
+}
@@ -0,0 +1,486 @@
+/**
+ * File: evlearn_surrogate.c
+ * Description: This is the implementation of the surrogate
+ *              model declared in evlearn.h, a k nearest
+ *              neighbours predictor over an archive of evaluated
+ *              chromosomes that screens the offspring before
+ *              they are evaluated.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ranges of the index this small are scanned instead of split.
+#define LEAF_SIZE 8
+
+/**
+ * The archive keeps the chromosomes in the order they were evaluated,
+ * the first indexed of them in a vantage point tree and the rest in a
+ * pending tail scanned one by one. The tree is built again, dropping
+ * the oldest chromosomes past capacity, once the tail grows past a
+ * quarter of it, so inserting costs O(log n) amortized.
+ *
+ * The tree is implicit in order and radius: a range [lo, hi) of order
+ * longer than LEAF_SIZE has its vantage point at lo, the points within
+ * radius[lo] of it in [lo + 1, mid) and the others in [mid, hi), with
+ * mid the middle of [lo + 1, hi). distances is the scratch buffer of
+ * the build.
+ *
+ * candidates holds the chromosomes of every round of breeding,
+ * mutated the genes mutated in each of them, and s_count and fitness
+ * the state of the population the rounds start from. near and
+ * near_distances are the neighbours of a prediction.
+ */
+struct evlearn_surrogate {
+    size_t capacity;
+    size_t slots;
+    size_t neighbours;
+    size_t oversampling;
+
+    size_t count;
+    size_t indexed;
+    evlearn_gene* genes;
+    double* fitness;
+    size_t* order;
+    double* radius;
+    double* distances;
+
+    evlearn_gene* candidates;
+    size_t* mutated;
+    size_t* s_count;
+    double* parent_fitness;
+    size_t* near;
+    double* near_distances;
+
+    evlearn_surrogate_stats stats;
+};
+
+/**
+ * \brief Frees the surrogate.
+ *
+ * \param surrogate the surrogate, NULL is ignored
+ */
+void surrogate_destroy(evlearn_surrogate* surrogate)
+{
+    if (surrogate == NULL)
+        return;
+
+    free(surrogate->genes);
+    free(surrogate->fitness);
+    free(surrogate->order);
+    free(surrogate->radius);
+    free(surrogate->distances);
+    free(surrogate->candidates);
+    free(surrogate->mutated);
+    free(surrogate->s_count);
+    free(surrogate->parent_fitness);
+    free(surrogate->near);
+    free(surrogate->near_distances);
+    free(surrogate);
+}
+
+/**
+ * \brief Enables the surrogate of the context, replacing the one it
+ * had. tell() archives every chromosome with its fitness, and if
+ * oversampling is more than 1, compute_next_generation() breeds that
+ * many candidates for every individual and keeps the one with the
+ * best predicted fitness. It has to be called after init(), which
+ * ends it.
+ *
+ * \param ctx the context
+ * \param capacity chromosomes archived, the oldest are dropped, 0
+ * disables it
+ * \param neighbours archived chromosomes a prediction is made from
+ * \param oversampling candidates bred for every individual
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int set_surrogate(evlearn_ctx* ctx, size_t capacity, size_t neighbours, size_t oversampling)
+{
+    evlearn_surrogate* surrogate = NULL;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t n = ctx->population_size;
+
+    surrogate_destroy(ctx->surrogate);
+    ctx->surrogate = NULL;
+
+    if (capacity == 0)
+        return 0;
+    if (ctx->population == NULL || neighbours == 0 || neighbours > capacity || oversampling == 0)
+        return 1;
+
+    surrogate = calloc(1, sizeof(evlearn_surrogate));
+    if (surrogate == NULL)
+        return 1;
+    surrogate->capacity = capacity;
+    surrogate->slots = capacity + capacity / 4 + LEAF_SIZE;
+    surrogate->neighbours = neighbours;
+    surrogate->oversampling = oversampling;
+    if (genes > 0 && surrogate->slots > SIZE_MAX / sizeof(evlearn_gene) / genes) {
+        surrogate_destroy(surrogate);
+        return 1;
+    }
+    surrogate->genes = malloc(sizeof(evlearn_gene) * surrogate->slots * genes);
+    surrogate->fitness = malloc(sizeof(double) * surrogate->slots);
+    surrogate->order = malloc(sizeof(size_t) * surrogate->slots);
+    surrogate->radius = malloc(sizeof(double) * surrogate->slots);
+    surrogate->distances = malloc(sizeof(double) * surrogate->slots);
+    surrogate->candidates = malloc(sizeof(evlearn_gene) * oversampling * n * genes);
+    surrogate->mutated = malloc(sizeof(size_t) * oversampling * n);
+    surrogate->s_count = malloc(sizeof(size_t) * n);
+    surrogate->parent_fitness = malloc(sizeof(double) * n);
+    surrogate->near = malloc(sizeof(size_t) * neighbours);
+    surrogate->near_distances = malloc(sizeof(double) * neighbours);
+    if (surrogate->genes == NULL || surrogate->fitness == NULL || surrogate->order == NULL ||
+        surrogate->radius == NULL || surrogate->distances == NULL ||
+        surrogate->candidates == NULL || surrogate->mutated == NULL ||
+        surrogate->s_count == NULL ||
+        surrogate->parent_fitness == NULL || surrogate->near == NULL ||
+        surrogate->near_distances == NULL) {
+        surrogate_destroy(surrogate);
+        return 1;
+    }
+    surrogate->stats.capacity = capacity;
+
+    ctx->surrogate = surrogate;
+    return 0;
+}
+
+static void swap_points(evlearn_surrogate* surrogate, size_t a, size_t b)
+{
+    size_t index = surrogate->order[a];
+    double distance = surrogate->distances[a];
+
+    surrogate->order[a] = surrogate->order[b];
+    surrogate->distances[a] = surrogate->distances[b];
+    surrogate->order[b] = index;
+    surrogate->distances[b] = distance;
+}
+
+/**
+ * \brief Moves the point of [lo, hi) with the k-th smallest distance
+ * to the position k, the closer ones before it and the farther after.
+ * The points as far as the pivot are kept together, a population that
+ * converged archives many copies of the same chromosome.
+ */
+static void select_nth(evlearn_surrogate* surrogate, size_t lo, size_t hi, size_t k)
+{
+    while (hi - lo > 1) {
+        double pivot = surrogate->distances[lo + (hi - lo) / 2];
+        size_t less = lo;
+        size_t greater = hi;
+        size_t i = lo;
+
+        while (i < greater) {
+            if (surrogate->distances[i] < pivot) {
+                swap_points(surrogate, less, i);
+                less++;
+                i++;
+            }
+            else if (surrogate->distances[i] > pivot) {
+                greater--;
+                swap_points(surrogate, i, greater);
+            }
+            else {
+                i++;
+            }
+        }
+        if (k < less) {
+            hi = less;
+        }
+        else if (k >= greater) {
+            lo = greater;
+        }
+        else {
+            return;
+        }
+    }
+}
+
+/**
+ * \brief Builds the tree over the range [lo, hi) of order.
+ */
+static void build(const evlearn_ctx* ctx, evlearn_surrogate* surrogate, size_t lo, size_t hi)
+{
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t mid = lo + 1 + (hi - lo - 1) / 2;
+    const evlearn_gene* vantage = NULL;
+
+    if (hi - lo <= LEAF_SIZE)
+        return;
+
+    // The middle point as the vantage one, the archive is in no particular order around it.
+    swap_points(surrogate, lo, lo + (hi - lo) / 2);
+    vantage = surrogate->genes + surrogate->order[lo] * genes;
+    for (size_t i = lo + 1; i < hi; i++) {
+        surrogate->distances[i] =
+            euclidean_d(ctx, vantage, surrogate->genes + surrogate->order[i] * genes);
+    }
+    surrogate->stats.distances += hi - lo - 1;
+    select_nth(surrogate, lo + 1, hi, mid);
+    surrogate->radius[lo] = surrogate->distances[mid];
+
+    build(ctx, surrogate, lo + 1, mid);
+    build(ctx, surrogate, mid, hi);
+}
+
+/**
+ * \brief Indexes the whole archive again, dropping the oldest
+ * chromosomes past capacity first.
+ */
+static void rebuild(const evlearn_ctx* ctx, evlearn_surrogate* surrogate)
+{
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+
+    if (surrogate->count > surrogate->capacity) {
+        size_t dropped = surrogate->count - surrogate->capacity;
+
+        memmove(surrogate->genes, surrogate->genes + dropped * genes,
+            sizeof(evlearn_gene) * surrogate->capacity * genes);
+        memmove(surrogate->fitness, surrogate->fitness + dropped,
+            sizeof(double) * surrogate->capacity);
+        surrogate->count = surrogate->capacity;
+    }
+    for (size_t i = 0; i < surrogate->count; i++) {
+        surrogate->order[i] = i;
+    }
+    build(ctx, surrogate, 0, surrogate->count);
+    surrogate->indexed = surrogate->count;
+    surrogate->stats.rebuilds++;
+}
+
+/**
+ * \brief Archives an evaluated chromosome with its fitness.
+ *
+ * \param ctx the context
+ * \param chromosome the chromosome
+ * \param fitness its fitness
+ */
+void surrogate_insert(evlearn_ctx* ctx, const evlearn_gene* chromosome, double fitness)
+{
+    evlearn_surrogate* surrogate = ctx->surrogate;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+
+    memcpy(surrogate->genes + surrogate->count * genes, chromosome,
+        sizeof(evlearn_gene) * genes);
+    surrogate->fitness[surrogate->count] = fitness;
+    surrogate->count++;
+
+    if (surrogate->count - surrogate->indexed > surrogate->indexed / 4 + LEAF_SIZE ||
+        surrogate->count == surrogate->slots) {
+        rebuild(ctx, surrogate);
+    }
+    surrogate->stats.size =
+        surrogate->count < surrogate->capacity ? surrogate->count : surrogate->capacity;
+}
+
+/**
+ * Neighbours found so far by a search, sorted by distance, and the
+ * distance a point has to be within to be one of them.
+ */
+typedef struct search {
+    const evlearn_gene* query;
+    size_t found;
+    double bound;
+} search;
+
+/**
+ * \brief Measures the distance of the query to an archived point and
+ * keeps it if it is one of the nearest so far.
+ *
+ * \return the distance
+ */
+static double visit(
+    const evlearn_ctx* ctx, evlearn_surrogate* surrogate, search* s, size_t index)
+{
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    double distance = euclidean_d(ctx, s->query, surrogate->genes + index * genes);
+    size_t k = surrogate->neighbours;
+    size_t i = s->found < k ? s->found : k - 1;
+
+    surrogate->stats.distances++;
+    if (s->found == k && distance >= s->bound)
+        return distance;
+
+    while (i > 0 && surrogate->near_distances[i - 1] > distance) {
+        surrogate->near_distances[i] = surrogate->near_distances[i - 1];
+        surrogate->near[i] = surrogate->near[i - 1];
+        i--;
+    }
+    surrogate->near_distances[i] = distance;
+    surrogate->near[i] = index;
+    if (s->found < k) {
+        s->found++;
+    }
+    if (s->found == k) {
+        s->bound = surrogate->near_distances[k - 1];
+    }
+    return distance;
+}
+
+/**
+ * \brief Searches the range [lo, hi) of the tree, skipping the side
+ * of a vantage point that can't hold a point nearer than the bound.
+ */
+static void search_tree(
+    const evlearn_ctx* ctx, evlearn_surrogate* surrogate, search* s, size_t lo, size_t hi)
+{
+    size_t mid = lo + 1 + (hi - lo - 1) / 2;
+    double distance = 0;
+    double radius = 0;
+
+    if (hi - lo <= LEAF_SIZE) {
+        for (size_t i = lo; i < hi; i++) {
+            visit(ctx, surrogate, s, surrogate->order[i]);
+        }
+        return;
+    }
+
+    distance = visit(ctx, surrogate, s, surrogate->order[lo]);
+    radius = surrogate->radius[lo];
+    // A point only counts if it is nearer than the bound, so the ties at the bound are skipped.
+    if (distance < radius) {
+        search_tree(ctx, surrogate, s, lo + 1, mid);
+        if (distance + s->bound > radius) {
+            search_tree(ctx, surrogate, s, mid, hi);
+        }
+    }
+    else {
+        search_tree(ctx, surrogate, s, mid, hi);
+        if (distance - s->bound < radius) {
+            search_tree(ctx, surrogate, s, lo + 1, mid);
+        }
+    }
+}
+
+/**
+ * \brief Predicts the fitness of a chromosome as the mean of the
+ * fitness of its nearest archived chromosomes weighted by the inverse
+ * of their distance, or the fitness of the same chromosome if it is
+ * archived.
+ *
+ * \param ctx the context
+ * \param chromosome the chromosome
+ * \param fitness where the prediction is stored
+ *
+ * \return 0 for success, 1 if the surrogate is disabled or there are
+ * fewer archived chromosomes than neighbours
+ */
+int predict_fitness(evlearn_ctx* ctx, const evlearn_gene* chromosome, double* fitness)
+{
+    evlearn_surrogate* surrogate = ctx->surrogate;
+    search s = {chromosome, 0, INFINITY};
+    double weights = 0;
+    double sum = 0;
+
+    if (surrogate == NULL || surrogate->count < surrogate->neighbours)
+        return 1;
+
+    search_tree(ctx, surrogate, &s, 0, surrogate->indexed);
+    for (size_t i = surrogate->indexed; i < surrogate->count; i++) {
+        visit(ctx, surrogate, &s, i);
+    }
+    surrogate->stats.predictions++;
+
+    if (surrogate->near_distances[0] == 0) {
+        *fitness = surrogate->fitness[surrogate->near[0]];
+        return 0;
+    }
+    for (size_t i = 0; i < surrogate->neighbours; i++) {
+        weights += 1 / surrogate->near_distances[i];
+        sum += surrogate->fitness[surrogate->near[i]] / surrogate->near_distances[i];
+    }
+    *fitness = sum / weights;
+    return 0;
+}
+
+/**
+ * \brief Breeds the offspring of the selected individuals like
+ * cross_population() and mutate_population(), once per candidate with
+ * streams of their own, and keeps for every individual the candidate
+ * with the best predicted fitness. The first candidate is the one
+ * bred without the surrogate, which is all there is until the archive
+ * holds enough chromosomes. Only the mutations of the candidates kept
+ * are counted in ctx->mutations.
+ *
+ * \param ctx the context, with the population selected
+ * \param mutation_probability like in compute_next_generation()
+ */
+void breed_screened(evlearn_ctx* ctx, double mutation_probability)
+{
+    evlearn_surrogate* surrogate = ctx->surrogate;
+    size_t n = ctx->population_size;
+    size_t genes = ctx->chrom_array_size * ctx->chrom_size;
+    size_t rounds = surrogate->count < surrogate->neighbours ? 1 : surrogate->oversampling;
+    size_t best = ctx->best;
+    size_t mutations = ctx->mutations;
+
+    for (size_t i = 0; i < n; i++) {
+        surrogate->s_count[i] = ctx->population[i].s_count;
+        surrogate->parent_fitness[i] = ctx->population[i].fitness;
+    }
+
+    // Every round but the last one is undone, with its mutations, the last one stays.
+    for (size_t r = rounds; r-- > 0;) {
+        ctx->round = r;
+        ctx->mutations = mutations;
+        cross_population(ctx);
+        mutate_counting(ctx, mutation_probability, surrogate->mutated + r * n);
+        if (r == 0)
+            break;
+
+        for (size_t i = 0; i < n; i++) {
+            memcpy(surrogate->candidates + (r * n + i) * genes, ctx->population[i].chromosome,
+                sizeof(evlearn_gene) * genes);
+        }
+        swap_chromosomes(ctx);
+        for (size_t i = 0; i < n; i++) {
+            ctx->population[i].s_count = surrogate->s_count[i];
+            ctx->population[i].fitness = surrogate->parent_fitness[i];
+        }
+    }
+    ctx->round = 0;
+
+    for (size_t i = 0; i < n && rounds > 1; i++) {
+        size_t chosen = 0;
+        double chosen_fitness = 0;
+        double fitness = 0;
+
+        if (i == best)
+            continue;
+        predict_fitness(ctx, ctx->population[i].chromosome, &chosen_fitness);
+        for (size_t r = 1; r < rounds; r++) {
+            predict_fitness(ctx, surrogate->candidates + (r * n + i) * genes, &fitness);
+            if (fitness > chosen_fitness) {
+                chosen = r;
+                chosen_fitness = fitness;
+            }
+        }
+        if (chosen > 0) {
+            memcpy(ctx->population[i].chromosome, surrogate->candidates + (chosen * n + i) * genes,
+                sizeof(evlearn_gene) * genes);
+            ctx->mutations = ctx->mutations - surrogate->mutated[i] +
+                surrogate->mutated[chosen * n + i];
+        }
+        surrogate->stats.screened += rounds - 1;
+    }
+}
+
+/**
+ * \brief Gets the counters of the surrogate, all 0 if it is disabled.
+ */
+evlearn_surrogate_stats get_surrogate_stats(const evlearn_ctx* ctx)
+{
+    evlearn_surrogate_stats stats = {0};
+
+    if (ctx->surrogate != NULL) {
+        stats = ctx->surrogate->stats;
+    }
+    return stats;
+}
@@ -0,0 +1,704 @@
+/**
+ * File: evlearn_telemetry.c
+ * Description: This is the implementation of the per
+ *              generation telemetry declared in evlearn.h.
+ *
+ * Author: shepherd-s
+ * Contact: shepherdsoft@outlook.com
+ */
+
+#include "evlearn_ctx.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TELEMETRY_MAGIC "EVLTELE"
+
+/**
+ * Number of generations that can be waiting for the writer thread.
+ * If it falls this far behind, new records are dropped and counted
+ * instead of blocking the generation.
+ */
+#define TELEMETRY_SNAPSHOTS 8
+
+/**
+ * Header at the beginning of the binary telemetry, followed by
+ * evlearn_record structs of record_size bytes, in the byte order of
+ * the machine that wrote them.
+ */
+typedef struct telemetry_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} telemetry_header;
+
+/**
+ * The data of a generation the statistics need: the fitness of the
+ * individuals, their genes every stride genes and the range of the
+ * bounds of every gene.
+ *
+ * The genes are not copied. Once the next generation is bred into the
+ * spare chromosome buffer and swapped in, the slot takes the buffer of
+ * the evaluated one and gives the context the buffer it held instead,
+ * so buffers move between the arena and the slots. chromosomes_size
+ * is how many genes fit in the one it holds, NULL until the first
+ * generation. return_chromosomes() gives the arena its buffers back.
+ */
+typedef struct telemetry_slot {
+    size_t population_size;
+    size_t genes;
+    size_t stride;
+    evlearn_gene* chromosomes;
+    size_t chromosomes_size;
+    double* fitness;
+    size_t fitness_size;
+    double* range;
+    size_t range_size;
+} telemetry_slot;
+
+/**
+ * Arrays the writer thread computes the statistics in.
+ */
+typedef struct telemetry_scratch {
+    double* values;
+    size_t values_size;
+    double* mean;
+    double* m2;
+    size_t genes_size;
+} telemetry_scratch;
+
+/**
+ * A queued record waiting for the statistics of its snapshot.
+ */
+typedef struct telemetry_entry {
+    evlearn_record record;
+    int snapshot;
+} telemetry_entry;
+
+/**
+ * The records are queued in a ring buffer, head is the next one to
+ * be written and count the number queued. The writer thread sleeps on
+ * cond until there is something to write, then computes and writes
+ * the head without holding the mutex, and signals drained when the
+ * queue is empty. busy marks the snapshots taken by a generation or
+ * a queued record, dropped counts the records that found none free.
+ *
+ * pending and pending_snapshot are only used by the thread computing
+ * the generations: the record of begin_record() waiting for the
+ * mutations and its snapshot, -1 if it was dropped.
+ */
+struct evlearn_telemetry {
+    FILE* binary_file;
+    FILE* csv_file;
+    pthread_t thread;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_cond_t drained;
+    telemetry_entry entries[TELEMETRY_SNAPSHOTS];
+    size_t head;
+    size_t count;
+    uint64_t dropped;
+    telemetry_slot snapshots[TELEMETRY_SNAPSHOTS];
+    unsigned char busy[TELEMETRY_SNAPSHOTS];
+    int failed;
+    int shutdown;
+    telemetry_scratch scratch;
+
+    evlearn_record pending;
+    int pending_snapshot;
+};
+
+/**
+ * \brief Writes a record to the open files.
+ *
+ * \return 0 for success, 1 otherwise
+ */
+static int write_record(evlearn_telemetry* telemetry, const evlearn_record* record)
+{
+    int result = 0;
+
+    if (telemetry->binary_file != NULL &&
+        fwrite(record, sizeof(evlearn_record), 1, telemetry->binary_file) != 1) {
+        result = 1;
+    }
+    if (telemetry->csv_file != NULL &&
+        fprintf(telemetry->csv_file, "%llu,%.17g,%.17g,%.17g,%.17g,%llu,%llu,%.17g,%.17g,%llu\n",
+            (unsigned long long) record->generation,
+            record->best_fitness,
+            record->mean_fitness,
+            record->median_fitness,
+            record->worst_fitness,
+            (unsigned long long) record->best_index,
+            (unsigned long long) record->mutations,
+            record->diversity_mean,
+            record->diversity_min,
+            (unsigned long long) record->dropped) < 0) {
+        result = 1;
+    }
+    return result;
+}
+
+/**
+ * \brief Grows an array of doubles to at least size elements.
+ *
+ * \return 0 for success, 1 if there is no memory
+ */
+static int reserve(double** array, size_t* capacity, size_t size)
+{
+    double* grown = NULL;
+
+    if (size <= *capacity)
+        return 0;
+    grown = realloc(*array, size * sizeof(double));
+    if (grown == NULL)
+        return 1;
+    *array = grown;
+    *capacity = size;
+    return 0;
+}
+
+/**
+ * \brief Moves the k-th smallest value of the array to the position
+ * k, with smaller values before it and greater after (quickselect).
+ */
+static void select_kth(double* values, size_t size, size_t k)
+{
+    size_t left = 0;
+    size_t right = size - 1;
+
+    while (left < right) {
+        double pivot = values[left + (right - left) / 2];
+        size_t i = left;
+        size_t j = right;
+
+        while (i <= j) {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (values[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                double swap = values[i];
+                values[i] = values[j];
+                values[j] = swap;
+                i++;
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+        if (k <= j) {
+            right = j;
+        }
+        else if (k >= i) {
+            left = i;
+        }
+        else {
+            return;
+        }
+    }
+}
+
+/**
+ * \brief Computes the statistics of a generation that need more than
+ * a pass over the fitness. The median is found with a quickselect
+ * over a copy of the fitness, the diversity with Welford's algorithm
+ * going through the population once, individual by individual.
+ *
+ * \param scratch the arrays of the calling thread
+ * \param slot the generation
+ * \param record where the median and the diversity are stored
+ */
+static void fill_record(
+    telemetry_scratch* scratch, const telemetry_slot* slot, evlearn_record* record)
+{
+    size_t n = slot->population_size;
+    size_t genes = slot->genes;
+    size_t mean_size = scratch->genes_size;
+    double sum = 0;
+
+    if (reserve(&scratch->values, &scratch->values_size, n))
+        return;
+    memcpy(scratch->values, slot->fitness, n * sizeof(double));
+    select_kth(scratch->values, n, n / 2);
+    record->median_fitness = scratch->values[n / 2];
+    if (n % 2 == 0) {
+        double lower = scratch->values[0];
+
+        for (size_t i = 1; i < n / 2; i++) {
+            lower = fmax(lower, scratch->values[i]);
+        }
+        record->median_fitness = (record->median_fitness + lower) / 2;
+    }
+
+    if (reserve(&scratch->mean, &mean_size, genes) ||
+        reserve(&scratch->m2, &scratch->genes_size, genes))
+        return;
+    memset(scratch->mean, 0, genes * sizeof(double));
+    memset(scratch->m2, 0, genes * sizeof(double));
+    for (size_t i = 0; i < n; i++) {
+        const evlearn_gene* chromosome = slot->chromosomes + i * slot->stride;
+
+        for (size_t j = 0; j < genes; j++) {
+            double delta = chromosome[j] - scratch->mean[j];
+
+            scratch->mean[j] += delta / (i + 1);
+            scratch->m2[j] += delta * (chromosome[j] - scratch->mean[j]);
+        }
+    }
+
+    record->diversity_min = INFINITY;
+    for (size_t j = 0; j < genes; j++) {
+        double diversity = 0;
+
+        if (slot->range[j] > 0) {
+            diversity = sqrt(scratch->m2[j] / n) / slot->range[j];
+        }
+        sum += diversity;
+        record->diversity_min = fmin(record->diversity_min, diversity);
+    }
+    record->diversity_mean = sum / genes;
+}
+
+/**
+ * \brief Main loop of the writer thread. It computes the statistics
+ * of the queued records, writes them one by one and flushes the files
+ * every time the queue is empty, until the telemetry is closed and
+ * the queue is empty.
+ */
+static void* writer(void* arg)
+{
+    evlearn_telemetry* telemetry = arg;
+    telemetry_entry* entry = NULL;
+    int result = 0;
+
+    pthread_mutex_lock(&telemetry->mutex);
+    while (1) {
+        while (!telemetry->shutdown && telemetry->count == 0) {
+            pthread_cond_wait(&telemetry->cond, &telemetry->mutex);
+        }
+        if (telemetry->count == 0) {
+            break;
+        }
+        entry = &telemetry->entries[telemetry->head];
+        pthread_mutex_unlock(&telemetry->mutex);
+
+        fill_record(&telemetry->scratch, &telemetry->snapshots[entry->snapshot], &entry->record);
+        result = write_record(telemetry, &entry->record);
+
+        pthread_mutex_lock(&telemetry->mutex);
+        telemetry->busy[entry->snapshot] = 0;
+        telemetry->head = (telemetry->head + 1) % TELEMETRY_SNAPSHOTS;
+        telemetry->count--;
+        if (telemetry->count == 0) {
+            pthread_cond_broadcast(&telemetry->drained);
+            pthread_mutex_unlock(&telemetry->mutex);
+            if (telemetry->binary_file != NULL) {
+                result |= fflush(telemetry->binary_file) != 0;
+            }
+            if (telemetry->csv_file != NULL) {
+                result |= fflush(telemetry->csv_file) != 0;
+            }
+            pthread_mutex_lock(&telemetry->mutex);
+        }
+        telemetry->failed |= result;
+    }
+    pthread_mutex_unlock(&telemetry->mutex);
+
+    return NULL;
+}
+
+/**
+ * \brief Opens the binary telemetry for appending. A new file gets
+ * the header, an existing one has to start with a matching header.
+ *
+ * \return the file or NULL on error
+ */
+static FILE* open_binary(const char* file_path)
+{
+    telemetry_header header;
+    FILE* file = fopen(file_path, "a+b");
+
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+        header.version = EVLEARN_TELEMETRY_VERSION;
+        header.record_size = sizeof(evlearn_record);
+        if (fwrite(&header, sizeof(header), 1, file) == 1)
+            return file;
+    }
+    else {
+        rewind(file);
+        if (fread(&header, sizeof(header), 1, file) == 1 &&
+            memcmp(header.magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC)) == 0 &&
+            header.version == EVLEARN_TELEMETRY_VERSION &&
+            header.record_size == sizeof(evlearn_record))
+            return file;
+    }
+
+    fclose(file);
+    return NULL;
+}
+
+/**
+ * \brief Opens the csv telemetry for appending. A new file gets a
+ * line with the names of the columns.
+ *
+ * \return the file or NULL on error
+ */
+static FILE* open_csv(const char* file_path)
+{
+    FILE* file = fopen(file_path, "a");
+
+    if (file == NULL)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0 &&
+        fprintf(file, "generation,best_fitness,mean_fitness,median_fitness,worst_fitness,"
+            "best_index,mutations,diversity_mean,diversity_min,dropped\n") < 0) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * \brief Starts the telemetry of the context. From now on every call
+ * to compute_next_generation() appends a record with the statistics
+ * of the generation to the given files. If the context already had
+ * telemetry it is closed first.
+ *
+ * \param ctx the context
+ * \param binary_path path of the binary records, NULL for none
+ * \param csv_path path of the csv records, NULL for none
+ *
+ * \return 0 for success, 1 otherwise
+ */
+int open_telemetry(evlearn_ctx* ctx, const char* binary_path, const char* csv_path)
+{
+    evlearn_telemetry* telemetry = NULL;
+
+    if (ctx == NULL || (binary_path == NULL && csv_path == NULL))
+        return 1;
+
+    close_telemetry(ctx);
+
+    telemetry = calloc(1, sizeof(evlearn_telemetry));
+    if (telemetry == NULL)
+        return 1;
+
+    if (binary_path != NULL) {
+        telemetry->binary_file = open_binary(binary_path);
+    }
+    if (csv_path != NULL) {
+        telemetry->csv_file = open_csv(csv_path);
+    }
+    if ((binary_path != NULL && telemetry->binary_file == NULL) ||
+        (csv_path != NULL && telemetry->csv_file == NULL)) {
+        goto fail;
+    }
+
+    telemetry->pending_snapshot = -1;
+    pthread_mutex_init(&telemetry->mutex, NULL);
+    pthread_cond_init(&telemetry->cond, NULL);
+    pthread_cond_init(&telemetry->drained, NULL);
+    if (pthread_create(&telemetry->thread, NULL, writer, telemetry)) {
+        pthread_cond_destroy(&telemetry->drained);
+        pthread_cond_destroy(&telemetry->cond);
+        pthread_mutex_destroy(&telemetry->mutex);
+        goto fail;
+    }
+
+    ctx->telemetry = telemetry;
+    return 0;
+
+fail:
+    if (telemetry->binary_file != NULL) {
+        fclose(telemetry->binary_file);
+    }
+    if (telemetry->csv_file != NULL) {
+        fclose(telemetry->csv_file);
+    }
+    free(telemetry);
+    return 1;
+}
+
+static void free_scratch(telemetry_scratch* scratch)
+{
+    free(scratch->values);
+    free(scratch->mean);
+    free(scratch->m2);
+}
+
+/**
+ * \brief Checks if a chromosome buffer is one of the two of the arena
+ * of the context, which are right before the min max matrix.
+ */
+static int in_arena(const evlearn_ctx* ctx, const evlearn_gene* chromosomes)
+{
+    uintptr_t address = (uintptr_t) chromosomes;
+
+    return address >= (uintptr_t) ctx->arena && address < (uintptr_t) ctx->min_max_matrix;
+}
+
+/**
+ * \brief Waits for the writer thread to write every queued record and
+ * gives the arena back the chromosome buffers the snapshots hold, so
+ * it can be freed. A buffer of the snapshots the population is in is
+ * copied to the arena, the spare one is just exchanged. It is called
+ * before the arena is released and when the telemetry is closed.
+ *
+ * \param ctx the context, it has to have telemetry
+ */
+void return_chromosomes(evlearn_ctx* ctx)
+{
+    evlearn_telemetry* telemetry = ctx->telemetry;
+    size_t size = ctx->population_size * ctx->chrom_stride;
+
+    pthread_mutex_lock(&telemetry->mutex);
+    while (telemetry->count > 0) {
+        pthread_cond_wait(&telemetry->drained, &telemetry->mutex);
+    }
+    pthread_mutex_unlock(&telemetry->mutex);
+    if (ctx->population == NULL)
+        return;
+
+    for (size_t i = 0; i < TELEMETRY_SNAPSHOTS; i++) {
+        telemetry_slot* slot = &telemetry->snapshots[i];
+        evlearn_gene* own = NULL;
+
+        if (slot->chromosomes == NULL || !in_arena(ctx, slot->chromosomes))
+            continue;
+        if (!in_arena(ctx, ctx->offspring)) {
+            own = ctx->offspring;
+            ctx->offspring = slot->chromosomes;
+        }
+        else {
+            own = ctx->chromosomes;
+            memcpy(slot->chromosomes, own, size * sizeof(evlearn_gene));
+            ctx->chromosomes = slot->chromosomes;
+            for (size_t j = 0; j < ctx->population_size; j++) {
+                ctx->population[j].chromosome = ctx->chromosomes + j * ctx->chrom_stride;
+            }
+        }
+        slot->chromosomes = own;
+        slot->chromosomes_size = size;
+    }
+}
+
+/**
+ * \brief Stops the writer thread once every queued record is
+ * written and closes the files. It does nothing if the context has
+ * no telemetry.
+ *
+ * \param ctx the context
+ *
+ * \return 0 if every record was written, 1 otherwise
+ */
+int close_telemetry(evlearn_ctx* ctx)
+{
+    evlearn_telemetry* telemetry = ctx->telemetry;
+    int result = 0;
+
+    if (telemetry == NULL)
+        return 0;
+
+    return_chromosomes(ctx);
+    pthread_mutex_lock(&telemetry->mutex);
+    telemetry->shutdown = 1;
+    pthread_cond_signal(&telemetry->cond);
+    pthread_mutex_unlock(&telemetry->mutex);
+    pthread_join(telemetry->thread, NULL);
+
+    result = telemetry->failed || telemetry->dropped > 0;
+    if (telemetry->binary_file != NULL && fclose(telemetry->binary_file)) {
+        result = 1;
+    }
+    if (telemetry->csv_file != NULL && fclose(telemetry->csv_file)) {
+        result = 1;
+    }
+    pthread_cond_destroy(&telemetry->drained);
+    pthread_cond_destroy(&telemetry->cond);
+    pthread_mutex_destroy(&telemetry->mutex);
+    for (size_t i = 0; i < TELEMETRY_SNAPSHOTS; i++) {
+        free(telemetry->snapshots[i].chromosomes);
+        free(telemetry->snapshots[i].fitness);
+        free(telemetry->snapshots[i].range);
+    }
+    free_scratch(&telemetry->scratch);
+    free(telemetry);
+    ctx->telemetry = NULL;
+
+    return result;
+}
+
+/**
+ * \brief Fills the fitness and the range of the bounds of a slot from
+ * the context, growing them to its sizes.
+ *
+ * \return 0 for success, 1 if there is no memory
+ */
+static int fill_slot(const evlearn_ctx* ctx, telemetry_slot* slot)
+{
+    size_t n = ctx->population_size;
+    size_t cs = ctx->chrom_size;
+    size_t genes = ctx->chrom_array_size * cs;
+
+    if (reserve(&slot->fitness, &slot->fitness_size, n) ||
+        reserve(&slot->range, &slot->range_size, genes))
+        return 1;
+    slot->population_size = n;
+    slot->genes = genes;
+    slot->stride = ctx->chrom_stride;
+    for (size_t i = 0; i < n; i++) {
+        slot->fitness[i] = ctx->population[i].fitness;
+    }
+    for (size_t i = 0; i < ctx->chrom_array_size; i++) {
+        for (size_t j = 0; j < cs; j++) {
+            slot->range[i * cs + j] = (double) ctx->min_max_matrix[(i * 2 + 1) * cs + j] -
+                ctx->min_max_matrix[i * 2 * cs + j];
+        }
+    }
+    return 0;
+}
+
+/**
+ * \brief Gives a slot the evaluated chromosomes, left in the spare
+ * buffer by the generation just bred, in exchange for the buffer it
+ * holds. A slot without one, or with one of its own that is too small
+ * for the sizes of the context, allocates it, zeroed like the arena
+ * so that the padding after every chromosome has a known value.
+ *
+ * \return 0 for success, 1 if there is no memory
+ */
+static int exchange_chromosomes(evlearn_ctx* ctx, telemetry_slot* slot)
+{
+    size_t size = ctx->population_size * ctx->chrom_stride;
+    size_t bytes = 0;
+    evlearn_gene* spare = slot->chromosomes;
+
+    if (spare == NULL || (!in_arena(ctx, spare) && slot->chromosomes_size < size)) {
+        free(spare);
+        slot->chromosomes = NULL;
+        bytes = (size * sizeof(evlearn_gene) + EVLEARN_ALIGNMENT - 1) /
+            EVLEARN_ALIGNMENT * EVLEARN_ALIGNMENT;
+        spare = aligned_alloc(EVLEARN_ALIGNMENT, bytes);
+        if (spare == NULL)
+            return 1;
+        memset(spare, 0, bytes);
+    }
+    slot->chromosomes = ctx->offspring;
+    slot->chromosomes_size = size;
+    ctx->offspring = spare;
+    return 0;
+}
+
+/**
+ * \brief Releases the snapshot of the pending record and counts it as
+ * dropped.
+ */
+static void drop_pending(evlearn_telemetry* telemetry)
+{
+    pthread_mutex_lock(&telemetry->mutex);
+    telemetry->busy[telemetry->pending_snapshot] = 0;
+    telemetry->dropped++;
+    pthread_mutex_unlock(&telemetry->mutex);
+    telemetry->pending_snapshot = -1;
+}
+
+/**
+ * \brief Starts the record of the evaluated generation, before the
+ * next one is bred. It takes a free snapshot and sums up the fitness
+ * values at once, the writer thread computes the median and the
+ * diversity. If every snapshot is busy the record is dropped and
+ * counted, so the caller never waits for the writer.
+ *
+ * \param ctx the context, it has to have telemetry
+ */
+void begin_record(evlearn_ctx* ctx)
+{
+    evlearn_telemetry* telemetry = ctx->telemetry;
+    evlearn_record* record = &telemetry->pending;
+    int snapshot = -1;
+    double sum = 0;
+
+    pthread_mutex_lock(&telemetry->mutex);
+    for (int i = 0; snapshot < 0 && i < TELEMETRY_SNAPSHOTS; i++) {
+        if (!telemetry->busy[i]) {
+            telemetry->busy[i] = 1;
+            snapshot = i;
+        }
+    }
+    if (snapshot < 0) {
+        telemetry->dropped++;
+    }
+    pthread_mutex_unlock(&telemetry->mutex);
+    telemetry->pending_snapshot = snapshot;
+    if (snapshot < 0)
+        return;
+
+    memset(record, 0, sizeof(evlearn_record));
+    record->generation = ctx->generation;
+    record->best_fitness = ctx->population[0].fitness;
+    record->worst_fitness = ctx->population[0].fitness;
+    for (size_t i = 0; i < ctx->population_size; i++) {
+        double fitness = ctx->population[i].fitness;
+
+        sum += fitness;
+        if (fitness > record->best_fitness) {
+            record->best_fitness = fitness;
+            record->best_index = i;
+        }
+        if (fitness < record->worst_fitness) {
+            record->worst_fitness = fitness;
+        }
+    }
+    record->mean_fitness = sum / ctx->population_size;
+
+    if (fill_slot(ctx, &telemetry->snapshots[snapshot])) {
+        drop_pending(telemetry);
+    }
+}
+
+/**
+ * \brief Queues the record of begin_record() for the writer thread,
+ * with the mutations of the next generation and the count of records
+ * dropped so far, and hands it the evaluated chromosomes. It does
+ * nothing if the record was dropped.
+ *
+ * \param ctx the context, it has to have telemetry
+ */
+void end_record(evlearn_ctx* ctx)
+{
+    evlearn_telemetry* telemetry = ctx->telemetry;
+    telemetry_entry* entry = NULL;
+    int snapshot = telemetry->pending_snapshot;
+
+    if (snapshot < 0)
+        return;
+    if (exchange_chromosomes(ctx, &telemetry->snapshots[snapshot])) {
+        drop_pending(telemetry);
+        return;
+    }
+
+    pthread_mutex_lock(&telemetry->mutex);
+    entry = &telemetry->entries[(telemetry->head + telemetry->count) % TELEMETRY_SNAPSHOTS];
+    entry->record = telemetry->pending;
+    entry->record.mutations = ctx->mutations;
+    entry->record.dropped = telemetry->dropped;
+    entry->snapshot = snapshot;
+    telemetry->count++;
+    telemetry->pending_snapshot = -1;
+    pthread_cond_signal(&telemetry->cond);
+    pthread_mutex_unlock(&telemetry->mutex);
+}
@@ -0,0 +1,120 @@
+#include "../include/evlearn.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#define POPULATION_SIZE 64
+#define CHROM_ARRAY_SIZE 6
+#define CHROM_SIZE 9
+
+static int failures = 0;
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                __FILE__, __LINE__, #condition);                             \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+using Engine = evlearn::Engine<CHROM_ARRAY_SIZE, CHROM_SIZE, POPULATION_SIZE, evlearn_gene>;
+
+// Synthetic fitness used instead of the simulator, maximum at the origin.
+static double sphere(
+    const evlearn_gene* chromosome, size_t chrom_array_size, size_t chrom_size, void* user_data)
+{
+    double sum = 0;
+
+    (void) user_data;
+    for (size_t i = 0; i < chrom_array_size * chrom_size; i++) {
+        sum += chromosome[i] * chromosome[i];
+    }
+    return (double) (chrom_array_size * chrom_size) - sum;
+}
+
+template <typename E>
+static double engine_sphere(const typename E::Chromosome& chromosome)
+{
+    double sum = 0;
+
+    for (size_t i = 0; i < E::genes; i++) {
+        sum += chromosome[i] * chromosome[i];
+    }
+    return (double) E::genes - sum;
+}
+
+static bool same_genes(const Engine& engine, const evlearn_ctx* ctx)
+{
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        if (std::memcmp(engine.chromosome(i).data(), get_chromosome(ctx, i),
+                Engine::genes * sizeof(evlearn_gene)) != 0)
+            return false;
+    }
+    return true;
+}
+
+// With the same seed the engine breeds exactly the genes of a context.
+static void test_same_as_ctx()
+{
+    auto engine = std::make_unique<Engine>(42);
+    evlearn_ctx* ctx = create_ctx();
+
+    set_seed(ctx, 42);
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(same_genes(*engine, ctx));
+
+    for (size_t g = 0; g < 10; g++) {
+        evaluate(ctx, sphere, NULL, 1);
+        engine->evaluate(engine_sphere<Engine>);
+        CHECK(std::memcmp(engine->best().data(), get_best_chromosome(ctx),
+            Engine::genes * sizeof(evlearn_gene)) == 0);
+        CHECK(engine->fitness(engine->best_index()) == get_best(ctx).fitness);
+
+        compute_next_generation(ctx, 6, 0.1);
+        engine->compute_next_generation(6, 0.1);
+        CHECK(same_genes(*engine, ctx));
+        CHECK(engine->generation() == g + 1);
+    }
+
+    destroy_ctx(ctx);
+}
+
+struct HalfBounds : evlearn::ArrayBounds<2, HalfBounds> {
+    static constexpr std::array<double, 2> min_values = {{0, -0.5}};
+    static constexpr std::array<double, 2> max_values = {{0.5, 0}};
+};
+
+// Float genes and custom bounds stay within the bounds and improve the fitness.
+static void test_float_bounds()
+{
+    using Small = evlearn::Engine<1, 2, 16, float, HalfBounds>;
+    Small engine;
+    double first = 0;
+
+    engine.evaluate(engine_sphere<Small>);
+    first = engine.fitness(engine.best_index());
+    for (int g = 0; g < 20; g++) {
+        engine.compute_next_generation(2, 0.2);
+        engine.evaluate(engine_sphere<Small>);
+        for (size_t i = 0; i < Small::population_size; i++) {
+            CHECK(engine.chromosome(i)[0] >= 0 && engine.chromosome(i)[0] <= 0.5f);
+            CHECK(engine.chromosome(i)[1] >= -0.5f && engine.chromosome(i)[1] <= 0);
+        }
+    }
+    CHECK(engine.fitness(engine.best_index()) >= first);
+}
+
+int main()
+{
+    test_same_as_ctx();
+    test_float_bounds();
+
+    if (failures > 0) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
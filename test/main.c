@@ -1,3 +1,1327 @@
 #include "../include/evlearn.h"
 
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#define POPULATION_SIZE 64
+#define CHROM_ARRAY_SIZE 6
+#define CHROM_SIZE 9
+
+static int failures = 0;
+
+#define CHECK(condition)                                                     \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                     \
+                __FILE__, __LINE__, #condition);                             \
+            failures++;                                                      \
+        }                                                                    \
+    } while (0)
+
+// Synthetic fitness used instead of the simulator, maximum at the origin.
+static double sphere(
+    const evlearn_gene* chromosome, size_t chrom_array_size, size_t chrom_size, void* user_data)
+{
+    double sum = 0;
+
+    (void) user_data;
+    for (size_t i = 0; i < chrom_array_size * chrom_size; i++) {
+        sum += chromosome[i] * chromosome[i];
+    }
+    return (double) (chrom_array_size * chrom_size) - sum;
+}
+
+static void test_ask_tell()
+{
+    evlearn_ctx* ctx = create_ctx();
+    size_t indices[POPULATION_SIZE];
+    double fitness[POPULATION_SIZE];
+    size_t count = 0;
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+
+    count = ask(ctx, indices, 10);
+    CHECK(count == 10);
+    CHECK(indices[0] == 0 && indices[9] == 9);
+
+    count = ask(ctx, indices + 10, POPULATION_SIZE);
+    CHECK(count == POPULATION_SIZE - 10);
+    CHECK(ask(ctx, indices, POPULATION_SIZE) == 0);
+
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        fitness[i] = sphere(get_chromosome(ctx, indices[i]), CHROM_ARRAY_SIZE, CHROM_SIZE, NULL);
+    }
+    tell(ctx, indices, fitness, POPULATION_SIZE);
+    CHECK(get_best(ctx).fitness > 0);
+
+    compute_next_generation(ctx, 4, 0.1);
+    CHECK(ask(ctx, indices, POPULATION_SIZE) == POPULATION_SIZE);
+
+    destroy_ctx(ctx);
+}
+
+static void test_evaluate_threads()
+{
+    evlearn_ctx* ctx = create_ctx();
+    double best = 0;
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+
+    CHECK(evaluate(ctx, sphere, NULL, 4) == 0);
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        double expected = sphere(get_chromosome(ctx, i), CHROM_ARRAY_SIZE, CHROM_SIZE, NULL);
+        CHECK(get_best(ctx).fitness >= expected);
+    }
+    best = get_best(ctx).fitness;
+
+    for (int generation = 0; generation < 30; generation++) {
+        compute_next_generation(ctx, 4, 0.1);
+        CHECK(evaluate(ctx, sphere, NULL, 4) == 0);
+    }
+    CHECK(get_best(ctx).fitness >= best);
+
+    destroy_ctx(ctx);
+}
+
+// One independent run per thread, each one with its own context and sizes.
+static void* run_context(void* arg)
+{
+    evlearn_ctx* ctx = arg;
+
+    for (int generation = 0; generation < 20; generation++) {
+        evaluate(ctx, sphere, NULL, 1);
+        compute_next_generation(ctx, 3, 0.1);
+    }
+    return NULL;
+}
+
+static void test_steady_state()
+{
+    evlearn_replacement policies[] = {EVLEARN_REPLACE_WORST, EVLEARN_REPLACE_TOURNAMENT};
+    evlearn_ctx* ctx[2] = {create_ctx(), create_ctx()};
+    evlearn_gene chromosome[CHROM_ARRAY_SIZE * CHROM_SIZE];
+    uint64_t ticket = 0;
+    double first = 0;
+
+    CHECK(steady_ask(ctx[0], chromosome, &ticket) == 1);
+    for (int p = 0; p < 2; p++) {
+        CHECK(init(ctx[p], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        CHECK(start_steady_state(ctx[p], 4, 0.1, policies[p]) == 0);
+    }
+
+    // The individuals of the population are handed out first, then the offspring.
+    for (uint64_t i = 0; i < POPULATION_SIZE; i++) {
+        CHECK(steady_ask(ctx[0], chromosome, &ticket) == 0);
+        CHECK(ticket == i);
+        CHECK(steady_tell(ctx[0], ticket, chromosome,
+            sphere(chromosome, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL)) == 0);
+    }
+    CHECK(steady_tell(ctx[0], 0, chromosome, 1) == 1);
+    CHECK(steady_tell(ctx[0], POPULATION_SIZE, chromosome, 1) == 1);
+    CHECK(steady_ask(ctx[0], chromosome, &ticket) == 0);
+    CHECK(ticket == POPULATION_SIZE);
+    CHECK(steady_tell(ctx[0], ticket, chromosome,
+        sphere(chromosome, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL)) == 0);
+    CHECK(steady_tell(ctx[0], ticket, chromosome, 1) == 1);
+    first = get_best(ctx[0]).fitness;
+
+    for (int p = 0; p < 2; p++) {
+        CHECK(evaluate_steady(ctx[p], sphere, NULL, 4, POPULATION_SIZE * 30) == 0);
+        CHECK(get_best(ctx[p]).fitness > first);
+    }
+
+    // A single thread asking and telling in the same order gets the same results.
+    for (int p = 0; p < 2; p++) {
+        set_seed(ctx[p], 21);
+        CHECK(init(ctx[p], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        CHECK(start_steady_state(ctx[p], 4, 0.1, EVLEARN_REPLACE_TOURNAMENT) == 0);
+        CHECK(evaluate_steady(ctx[p], sphere, NULL, 1, POPULATION_SIZE * 5) == 0);
+    }
+    CHECK(get_best(ctx[0]).fitness == get_best(ctx[1]).fitness);
+    CHECK(get_median_fitness(ctx[0]) == get_median_fitness(ctx[1]));
+
+    // init() ends the mode.
+    CHECK(init(ctx[0], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(steady_ask(ctx[0], chromosome, &ticket) == 1);
+
+    destroy_ctx(ctx[0]);
+    destroy_ctx(ctx[1]);
+}
+
+#define RACE_CHECKPOINTS 8
+
+// Episode adding the sphere fitness at every checkpoint, raced if user_data is a context.
+static double raced_sphere(
+    const evlearn_gene* chromosome, size_t chrom_array_size, size_t chrom_size, void* user_data)
+{
+    double step = sphere(chromosome, chrom_array_size, chrom_size, NULL);
+    double estimate = 0;
+
+    for (size_t c = 0; user_data != NULL && c < RACE_CHECKPOINTS; c++) {
+        if (race(user_data, chromosome, c, step * (c + 1), &estimate) == 1)
+            return estimate;
+    }
+    return step * RACE_CHECKPOINTS;
+}
+
+static void test_racing()
+{
+    evlearn_ctx* ctx[2] = {create_ctx(), create_ctx()};
+    const Individual* top[2][POPULATION_SIZE];
+    evlearn_racing_stats stats;
+    double seen[POPULATION_SIZE * 2];
+    size_t distinct = 0;
+    double estimate = 0;
+    double first = 0;
+
+    CHECK(set_racing(ctx[0], RACE_CHECKPOINTS, 3, 0) == 1);
+    for (int p = 0; p < 2; p++) {
+        CHECK(init(ctx[p], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    }
+    CHECK(set_racing(ctx[0], RACE_CHECKPOINTS, 3, 0) == 0);
+
+    // The elite is taken when the batch is told, so nothing is stopped in the first generation.
+    for (int p = 0; p < 2; p++) {
+        CHECK(evaluate(ctx[p], raced_sphere, p == 0 ? ctx[0] : NULL, 4) == 0);
+    }
+    stats = get_racing_stats(ctx[0]);
+    CHECK(stats.elite == 3 && stats.completed == POPULATION_SIZE && stats.aborted == 0);
+    CHECK(get_best(ctx[0]).fitness == get_best(ctx[1]).fitness);
+
+    // The estimates of a steady episode are its fitness, so racing changes nothing but the time.
+    for (int p = 0; p < 2; p++) {
+        compute_next_generation(ctx[p], 4, 0.1);
+        CHECK(evaluate(ctx[p], raced_sphere, p == 0 ? ctx[0] : NULL, 4) == 0);
+        CHECK(get_top(ctx[p], top[p], POPULATION_SIZE) == POPULATION_SIZE);
+    }
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        CHECK(fabs(top[0][i]->fitness - top[1][i]->fitness) <= 1e-9 * fabs(top[1][i]->fitness));
+    }
+    stats = get_racing_stats(ctx[0]);
+    CHECK(stats.aborted > 0 && stats.skipped > 0);
+    CHECK(stats.completed + stats.aborted == POPULATION_SIZE * 2);
+    first = get_best(ctx[0]).fitness;
+
+    for (int g = 0; g < 10; g++) {
+        compute_next_generation(ctx[0], 4, 0.1);
+        CHECK(evaluate(ctx[0], raced_sphere, ctx[0], 4) == 0);
+    }
+    stats = get_racing_stats(ctx[0]);
+    CHECK(stats.completed + stats.aborted == POPULATION_SIZE * 12);
+    CHECK(stats.partials == stats.completed * RACE_CHECKPOINTS + stats.aborted * RACE_CHECKPOINTS -
+        stats.skipped);
+    CHECK(get_best(ctx[0]).fitness > first);
+
+    // Chromosomes that are not of the population and checkpoints out of order are not raced.
+    CHECK(race(ctx[0], get_chromosome(ctx[0], 0) + 1, 0, -1e9, &estimate) == -1);
+    CHECK(race(ctx[0], get_chromosome(ctx[1], 0), 0, -1e9, &estimate) == -1);
+    CHECK(race(ctx[0], get_chromosome(ctx[0], 0), 1, -1e9, &estimate) == -1);
+    CHECK(race(ctx[0], get_chromosome(ctx[0], 0), 0, 1e9, &estimate) == 0);
+    CHECK(race(ctx[0], get_chromosome(ctx[0], 0), 0, 1e9, &estimate) == -1);
+    CHECK(race(ctx[1], get_chromosome(ctx[1], 0), 0, -1e9, &estimate) == 0);
+
+    // The same trajectory enters the elite once. The best individual is kept and evaluated again
+    // in the next generation, and the trajectories are distinct for distinct fitness values.
+    CHECK(set_racing(ctx[1], RACE_CHECKPOINTS, POPULATION_SIZE * 2, 0) == 0);
+    for (int g = 0; g < 2; g++) {
+        compute_next_generation(ctx[1], 4, 0.1);
+        CHECK(evaluate(ctx[1], raced_sphere, ctx[1], 4) == 0);
+        CHECK(get_top(ctx[1], top[1], POPULATION_SIZE) == POPULATION_SIZE);
+        for (size_t i = 0; i < POPULATION_SIZE; i++) {
+            size_t j = 0;
+
+            while (j < distinct && seen[j] != top[1][i]->fitness) {
+                j++;
+            }
+            if (j == distinct) {
+                seen[distinct++] = top[1][i]->fitness;
+            }
+        }
+    }
+    stats = get_racing_stats(ctx[1]);
+    CHECK(stats.completed == POPULATION_SIZE * 2 && stats.aborted == 0);
+    CHECK(stats.elite == distinct && distinct < POPULATION_SIZE * 2);
+
+    destroy_ctx(ctx[0]);
+    destroy_ctx(ctx[1]);
+}
+
+// Pipe the failing workers write a byte to once they got a batch.
+static int got_batch[2] = {-1, -1};
+
+static void tell_got_batch()
+{
+    char byte = 1;
+
+    if (write(got_batch[1], &byte, 1) != 1)
+        _exit(4);
+}
+
+// Fitness of a worker process that crashes in the middle of a batch.
+static double crash(
+    const evlearn_gene* chromosome, size_t chrom_array_size, size_t chrom_size, void* user_data)
+{
+    (void) chromosome;
+    (void) chrom_array_size;
+    (void) chrom_size;
+    (void) user_data;
+    tell_got_batch();
+    _exit(3);
+}
+
+// Fitness of a worker process that hangs.
+static double hang(
+    const evlearn_gene* chromosome, size_t chrom_array_size, size_t chrom_size, void* user_data)
+{
+    (void) user_data;
+    tell_got_batch();
+    sleep(60);
+    return sphere(chromosome, chrom_array_size, chrom_size, NULL);
+}
+
+// Starts a worker process once the given number of failing workers got a batch.
+static pid_t spawn_worker(const char* path, evlearn_fitness_fn fitness_fn, int after)
+{
+    pid_t pid = fork();
+    char byte = 0;
+
+    if (pid == 0) {
+        for (int i = 0; i < after; i++) {
+            if (read(got_batch[0], &byte, 1) != 1)
+                _exit(4);
+        }
+        _exit(run_worker(path, fitness_fn, NULL));
+    }
+    return pid;
+}
+
+static void test_farm()
+{
+    evlearn_ctx* ctx[2] = {create_ctx(), create_ctx()};
+    evlearn_farm_stats stats;
+    char path[64];
+    pid_t workers[3];
+    int status = 0;
+
+    snprintf(path, sizeof(path), "/tmp/evlearn_test_%d.sock", (int) getpid());
+    for (int p = 0; p < 2; p++) {
+        CHECK(init(ctx[p], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    }
+    CHECK(evaluate_farm(ctx[0]) == 1);
+    CHECK(open_farm(ctx[0], path, 5, 1e7) == 1);
+    CHECK(open_farm(ctx[0], path, 5, NAN) == 1);
+    CHECK(open_farm(ctx[0], path, 5, 0.5) == 0);
+    CHECK(evaluate_farm(ctx[0]) == 1);
+
+    // The first batches go to a worker that crashes and one that hangs, the last one only connects
+    // once they got them and takes them over.
+    CHECK(pipe(got_batch) == 0);
+    workers[0] = spawn_worker(path, crash, 0);
+    workers[1] = spawn_worker(path, hang, 0);
+    workers[2] = spawn_worker(path, sphere, 2);
+    close(got_batch[0]);
+    close(got_batch[1]);
+    for (int g = 0; g < 3; g++) {
+        CHECK(evaluate_farm(ctx[0]) == 0);
+        CHECK(evaluate(ctx[1], sphere, NULL, 1) == 0);
+        CHECK(get_best(ctx[0]).fitness == get_best(ctx[1]).fitness);
+        CHECK(get_median_fitness(ctx[0]) == get_median_fitness(ctx[1]));
+        for (int p = 0; p < 2; p++) {
+            compute_next_generation(ctx[p], 4, 0.1);
+        }
+    }
+    stats = get_farm_stats(ctx[0]);
+    CHECK(stats.workers == 1 && stats.lost == 2);
+    CHECK(stats.requeued >= 2 && stats.batches >= 3 * (POPULATION_SIZE / 5));
+
+    // Closing the farm ends the worker left.
+    close_farm(ctx[0]);
+    CHECK(waitpid(workers[2], &status, 0) == workers[2] && WIFEXITED(status));
+    CHECK(WEXITSTATUS(status) == 0);
+    CHECK(waitpid(workers[0], &status, 0) == workers[0] && WEXITSTATUS(status) == 3);
+    kill(workers[1], SIGKILL);
+    waitpid(workers[1], &status, 0);
+    CHECK(access(path, F_OK) != 0);
+
+    destroy_ctx(ctx[0]);
+    destroy_ctx(ctx[1]);
+}
+
+#define ISLANDS 4
+#define ISLAND_GENERATIONS 12
+
+static void test_islands()
+{
+    evlearn_islands* islands[2];
+    evlearn_ctx* plain = NULL;
+    size_t genes = CHROM_ARRAY_SIZE * CHROM_SIZE * sizeof(evlearn_gene);
+    double first = 0;
+
+    CHECK(create_islands(0, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, 5) == NULL);
+    for (int r = 0; r < 2; r++) {
+        islands[r] =
+            create_islands(ISLANDS, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, 5);
+        CHECK(islands[r] != NULL);
+    }
+    CHECK(get_island(islands[0], ISLANDS) == NULL);
+    CHECK(set_migration(islands[0], 3, POPULATION_SIZE, EVLEARN_TOPOLOGY_RING) == 1);
+
+    // Without migration every island is a plain run with its own seed.
+    CHECK(set_migration(islands[0], 0, 2, EVLEARN_TOPOLOGY_RING) == 0);
+    CHECK(evolve_islands(islands[0], sphere, NULL, ISLAND_GENERATIONS, 4, 0.1) == 0);
+    for (size_t i = 0; i < ISLANDS; i++) {
+        plain = create_ctx();
+        set_seed(plain, 5 + i);
+        CHECK(init(plain, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        CHECK(evaluate(plain, sphere, NULL, 1) == 0);
+        for (int g = 0; g < ISLAND_GENERATIONS; g++) {
+            compute_next_generation(plain, 4, 0.1);
+            CHECK(evaluate(plain, sphere, NULL, 1) == 0);
+        }
+        CHECK(get_best(plain).fitness == get_best(get_island(islands[0], i)).fitness);
+        CHECK(memcmp(get_best_chromosome(plain),
+            get_best_chromosome(get_island(islands[0], i)), genes) == 0);
+        destroy_ctx(plain);
+    }
+    destroy_islands(islands[0]);
+
+    // With migration the results depend on the seeds only, not on the threads, and calls go on.
+    for (int r = 0; r < 2; r++) {
+        if (r == 0) {
+            islands[0] =
+                create_islands(ISLANDS, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, 5);
+        }
+        CHECK(set_migration(islands[r], 3, 2, EVLEARN_TOPOLOGY_FULL) == 0);
+        CHECK(evolve_islands(islands[r], sphere, NULL, 4, 4, 0.1) == 0);
+        CHECK(set_migration(islands[r], 2, 3, EVLEARN_TOPOLOGY_RING) == 0);
+        CHECK(evolve_islands(islands[r], sphere, NULL, ISLAND_GENERATIONS, 4, 0.1) == 0);
+    }
+    for (size_t i = 0; i < ISLANDS; i++) {
+        evlearn_ctx* island[2] = {get_island(islands[0], i), get_island(islands[1], i)};
+
+        CHECK(get_best(island[0]).fitness == get_best(island[1]).fitness);
+        CHECK(get_median_fitness(island[0]) == get_median_fitness(island[1]));
+    }
+    first = get_best(get_island(islands[1], get_best_island(islands[1]))).fitness;
+    CHECK(evolve_islands(islands[1], sphere, NULL, ISLAND_GENERATIONS, 4, 0.1) == 0);
+    CHECK(get_best(get_island(islands[1], get_best_island(islands[1]))).fitness > first);
+
+    // An island stepped on its own is a generation ahead, the others skip its migrants.
+    compute_next_generation(get_island(islands[1], 0), 4, 0.1);
+    CHECK(evaluate(get_island(islands[1], 0), sphere, NULL, 1) == 0);
+    CHECK(evolve_islands(islands[1], sphere, NULL, ISLAND_GENERATIONS, 4, 0.1) == 0);
+
+    destroy_islands(islands[0]);
+    destroy_islands(islands[1]);
+}
+
+static void test_contexts()
+{
+    evlearn_ctx* ctx[2] = {create_ctx(), create_ctx()};
+    pthread_t threads[2];
+
+    CHECK(init(ctx[0], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(init(ctx[1], POPULATION_SIZE / 2, 2, 3, NULL, NULL) == 0);
+
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&threads[i], NULL, run_context, ctx[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(evaluate(ctx[i], sphere, NULL, 1) == 0);
+    }
+    CHECK(get_best(ctx[0]).fitness <= CHROM_ARRAY_SIZE * CHROM_SIZE);
+    CHECK(get_best(ctx[1]).fitness <= 2 * 3);
+    CHECK(get_best(ctx[1]).fitness > 0);
+
+    destroy_ctx(ctx[0]);
+    destroy_ctx(ctx[1]);
+}
+
+static void test_rng()
+{
+    evlearn_rng a;
+    evlearn_rng b;
+    double bulk[100];
+    uint64_t bits[2];
+
+    rng_seed(&a, 7, 0, 0);
+    rng_seed(&b, 7, 0, 0);
+    rng_fill_uniform(&a, bulk, 100);
+    for (int i = 0; i < 100; i++) {
+        double value = rng_uniform(&b);
+        CHECK(bulk[i] == value);
+        CHECK(value >= 0 && value < 1);
+    }
+
+    rng_seed(&a, 7, 0, 1);
+    rng_seed(&b, 7, 1, 0);
+    rng_fill_bits(&a, bits, 2);
+    CHECK(bits[0] != rng_next(&b));
+}
+
+static void test_seed_reproducible()
+{
+    evlearn_ctx* ctx[3] = {create_ctx(), create_ctx(), create_ctx()};
+
+    set_seed(ctx[0], 42);
+    set_seed(ctx[1], 42);
+    set_seed(ctx[2], 43);
+    for (int i = 0; i < 3; i++) {
+        CHECK(init(ctx[i], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        for (int generation = 0; generation < 10; generation++) {
+            evaluate(ctx[i], sphere, NULL, i + 1);
+            compute_next_generation(ctx[i], 4, 0.2);
+        }
+    }
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        for (size_t j = 0; j < CHROM_ARRAY_SIZE * CHROM_SIZE; j++) {
+            CHECK(get_chromosome(ctx[0], i)[j] == get_chromosome(ctx[1], i)[j]);
+        }
+    }
+    CHECK(get_chromosome(ctx[0], 1)[0] != get_chromosome(ctx[2], 1)[0]);
+
+    for (int i = 0; i < 3; i++) {
+        destroy_ctx(ctx[i]);
+    }
+}
+
+// Offsets in the header of a checkpoint of the uint32_t engine and the uint64_t engine_offset.
+#define HEADER_ENGINE 136
+#define HEADER_ENGINE_OFFSET 144
+
+// Reads the uint64_t at offset of a file, 0 if it cannot be read.
+static uint64_t header_u64(const char* path, long offset)
+{
+    uint64_t value = 0;
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL)
+        return 0;
+    if (fseek(file, offset, SEEK_SET) || fread(&value, sizeof(value), 1, file) != 1) {
+        value = 0;
+    }
+    fclose(file);
+    return value;
+}
+
+// Copies the first length bytes of a file, or all of it if length is negative, and overwrites
+// the size bytes at offset with value if offset is not negative.
+static int copy_damaged(
+    const char* from, const char* to, long length, long offset, const void* value, size_t size)
+{
+    static char buffer[1 << 17];
+    FILE* input = fopen(from, "rb");
+    FILE* output = fopen(to, "wb");
+    size_t count = 0;
+    int result = input == NULL || output == NULL;
+
+    if (result == 0) {
+        count = fread(buffer, 1, sizeof(buffer), input);
+        result = count == sizeof(buffer);
+        count = length < 0 || (size_t) length > count ? count : (size_t) length;
+        if (offset >= 0 && (size_t) offset + size <= count) {
+            memcpy(buffer + offset, value, size);
+        }
+        result |= fwrite(buffer, 1, count, output) != count;
+    }
+    if (input != NULL) {
+        fclose(input);
+    }
+    if (output != NULL) {
+        fclose(output);
+    }
+    return result;
+}
+
+// Checks that two contexts have the same population.
+static int same_population(const evlearn_ctx* ctx1, const evlearn_ctx* ctx2)
+{
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        if (memcmp(get_chromosome(ctx1, i), get_chromosome(ctx2, i),
+                CHROM_ARRAY_SIZE * CHROM_SIZE * sizeof(evlearn_gene)))
+            return 0;
+    }
+    return get_best(ctx1).fitness == get_best(ctx2).fitness;
+}
+
+static void test_checkpoint()
+{
+    evlearn_ctx* ctx = create_ctx();
+    evlearn_ctx* resumed = create_ctx();
+    const char* path = "evlearn_test.ckpt";
+    const char* damaged = "evlearn_test_damaged.ckpt";
+    uint32_t engine = EVLEARN_ENGINE_DE;
+    size_t genes = CHROM_ARRAY_SIZE * CHROM_SIZE;
+    double rows[CHROM_ARRAY_SIZE * 2][CHROM_SIZE];
+    double* bounds[CHROM_ARRAY_SIZE * 2];
+
+    set_seed(ctx, 11);
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    for (int generation = 0; generation < 5; generation++) {
+        evaluate(ctx, sphere, NULL, 1);
+        compute_next_generation(ctx, 4, 0.2);
+    }
+    evaluate(ctx, sphere, NULL, 1);
+    CHECK(save_checkpoint(ctx, path) == 0);
+
+    CHECK(load_checkpoint(resumed, path) == 0);
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        for (size_t j = 0; j < genes; j++) {
+            CHECK(get_chromosome(ctx, i)[j] == get_chromosome(resumed, i)[j]);
+        }
+    }
+    CHECK(get_best(ctx).fitness == get_best(resumed).fitness);
+
+    // A truncated checkpoint, or one whose engine block is not the state of its engine, leaves the
+    // context as it was.
+    CHECK(copy_damaged(path, damaged, 1000, -1, NULL, 0) == 0);
+    CHECK(load_checkpoint(resumed, damaged) == 1);
+    CHECK(copy_damaged(path, damaged, -1, HEADER_ENGINE, &engine, sizeof(engine)) == 0);
+    CHECK(load_checkpoint(resumed, damaged) == 1);
+    CHECK(same_population(ctx, resumed));
+    remove(damaged);
+
+    // Both runs go on exactly the same way after the resume.
+    compute_next_generation(ctx, 4, 0.2);
+    compute_next_generation(resumed, 4, 0.2);
+    CHECK(get_chromosome(ctx, 3)[7] == get_chromosome(resumed, 3)[7]);
+
+    // init() resumes from a checkpoint with the same sizes and ignores other sizes.
+    CHECK(init(resumed, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, (char*) path) == 0);
+    CHECK(get_best(resumed).fitness > 0);
+    CHECK(init(resumed, POPULATION_SIZE, 2, 3, NULL, (char*) path) == 0);
+    CHECK(get_best(resumed).fitness == 0);
+
+    // Nor a checkpoint with other bounds, the ones given to init() win.
+    for (size_t i = 0; i < CHROM_ARRAY_SIZE * 2; i++) {
+        for (size_t j = 0; j < CHROM_SIZE; j++) {
+            rows[i][j] = i % 2 == 0 ? 2 : 3;
+        }
+        bounds[i] = rows[i];
+    }
+    CHECK(init(resumed, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, bounds, (char*) path) == 0);
+    CHECK(get_best(resumed).fitness == 0);
+    CHECK(get_chromosome(resumed, 0)[0] >= 2 && get_chromosome(resumed, 0)[0] <= 3);
+
+    CHECK(load_checkpoint(resumed, "does_not_exist.ckpt") == 1);
+    remove(path);
+
+    destroy_ctx(resumed);
+    destroy_ctx(ctx);
+}
+
+static void test_checkpoint_formats()
+{
+    evlearn_gene_format formats[] = {EVLEARN_GENES_DOUBLE, EVLEARN_GENES_FLOAT, EVLEARN_GENES_FIXED16};
+    // Bounds are {-1, 1}, so FIXED16 is off by at most 2 / 131070.
+    double tolerance[] = {1e-15, 1e-7, 2.0 / 131070 + 1e-7};
+    evlearn_ctx* ctx = create_ctx();
+    evlearn_ctx* resumed = create_ctx();
+    const char* path = "evlearn_test_format.ckpt";
+    long sizes[3];
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    evaluate(ctx, sphere, NULL, 1);
+    CHECK(set_checkpoint_format(ctx, (evlearn_gene_format) 7) == 1);
+
+    for (int f = 0; f < 3; f++) {
+        FILE* file = NULL;
+
+        CHECK(set_checkpoint_format(ctx, formats[f]) == 0);
+        CHECK(save_checkpoint(ctx, path) == 0);
+        file = fopen(path, "rb");
+        CHECK(file != NULL && fseek(file, 0, SEEK_END) == 0);
+        sizes[f] = file == NULL ? 0 : ftell(file);
+        if (file != NULL) {
+            fclose(file);
+        }
+
+        CHECK(load_checkpoint(resumed, path) == 0);
+        for (size_t i = 0; i < POPULATION_SIZE; i++) {
+            for (size_t j = 0; j < CHROM_ARRAY_SIZE * CHROM_SIZE; j++) {
+                CHECK(fabs(get_chromosome(ctx, i)[j] - get_chromosome(resumed, i)[j]) <= tolerance[f]);
+            }
+        }
+        CHECK(get_best(ctx).fitness == get_best(resumed).fitness);
+    }
+    CHECK(sizes[2] < sizes[1] && sizes[1] < sizes[0]);
+    remove(path);
+
+    destroy_ctx(resumed);
+    destroy_ctx(ctx);
+}
+
+static void test_text_export()
+{
+    evlearn_ctx* ctx = create_ctx();
+    evlearn_ctx* resumed = create_ctx();
+    FILE* file = NULL;
+    double gene = 0;
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    evaluate(ctx, sphere, NULL, 1);
+    CHECK(write_file(ctx, 0, 3) == 0);
+
+    CHECK(init(resumed, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, "best_gen.txt") == 0);
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        double difference = get_chromosome(ctx, i)[5] - get_chromosome(resumed, i)[5];
+        CHECK(difference < 1e-6 && difference > -1e-6);
+    }
+
+    // Written from the last individual on, the file starts with its first gene.
+    CHECK(write_file(ctx, POPULATION_SIZE - 1, 3) == 0);
+    file = fopen("best_gen.txt", "r");
+    CHECK(file != NULL && fscanf(file, "%lf", &gene) == 1);
+    CHECK(gene - get_chromosome(ctx, POPULATION_SIZE - 1)[0] < 1e-6 &&
+        gene - get_chromosome(ctx, POPULATION_SIZE - 1)[0] > -1e-6);
+    if (file != NULL) {
+        fclose(file);
+    }
+    remove("best_gen.txt");
+
+    destroy_ctx(resumed);
+    destroy_ctx(ctx);
+}
+
+static void test_telemetry()
+{
+    evlearn_ctx* ctx = create_ctx();
+    evlearn_ctx* twin = create_ctx();
+    const char* binary_path = "evlearn_test.tlm";
+    const char* csv_path = "evlearn_test.csv";
+    evlearn_record records[8];
+    char line[512];
+    FILE* file = NULL;
+    int lines = 0;
+
+    remove(binary_path);
+    remove(csv_path);
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(init(twin, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(open_telemetry(ctx, binary_path, csv_path) == 0);
+    for (int generation = 0; generation < 5; generation++) {
+        evaluate(ctx, sphere, NULL, 1);
+        compute_next_generation(ctx, 4, 0.2);
+        evaluate(twin, sphere, NULL, 1);
+        compute_next_generation(twin, 4, 0.2);
+    }
+    // The writer thread takes the chromosome buffers of the evaluated generations instead of
+    // copies, which changes nothing for the run, before or after they are given back.
+    CHECK(same_population(ctx, twin));
+    CHECK(close_telemetry(ctx) == 0);
+    CHECK(same_population(ctx, twin));
+
+    // Opening it again appends to the same files. The arena can be released while it is open.
+    CHECK(open_telemetry(ctx, binary_path, csv_path) == 0);
+    evaluate(ctx, sphere, NULL, 1);
+    compute_next_generation(ctx, 4, 0.2);
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    destroy_ctx(twin);
+    destroy_ctx(ctx);
+
+    file = fopen(binary_path, "rb");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        fseek(file, 16, SEEK_SET);
+        CHECK(fread(records, sizeof(evlearn_record), 8, file) == 6);
+        fclose(file);
+    }
+    for (int i = 0; i < 6; i++) {
+        CHECK(records[i].generation == (uint64_t) i);
+        CHECK(records[i].best_fitness >= records[i].median_fitness);
+        CHECK(records[i].median_fitness >= records[i].worst_fitness);
+        CHECK(records[i].mean_fitness >= records[i].worst_fitness);
+        CHECK(records[i].best_index < POPULATION_SIZE);
+        CHECK(records[i].diversity_mean > 0 && records[i].diversity_mean < 1);
+        CHECK(records[i].diversity_min <= records[i].diversity_mean);
+        CHECK(records[i].dropped == 0);
+    }
+    CHECK(records[0].mutations > 0);
+
+    file = fopen(csv_path, "r");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        while (fgets(line, sizeof(line), file) != NULL) {
+            lines++;
+        }
+        fclose(file);
+    }
+    CHECK(lines == 7);
+
+    remove(binary_path);
+    remove(csv_path);
+}
+
+static void test_simd_kernels()
+{
+    enum { COUNT = 203 };
+    evlearn_simd best = get_simd();
+    evlearn_rng rng;
+    evlearn_gene mother[COUNT], father[COUNT], min[COUNT], max[COUNT];
+    evlearn_gene threshold[COUNT], random[COUNT], expected[COUNT], actual[COUNT];
+    uint64_t bits[4];
+    size_t expected_count = 0;
+    double expected_distance = 0;
+    double expected_dot = 0;
+    double inputs[COUNT];
+
+    rng_seed(&rng, 3, 0, 0);
+    rng_fill_bits(&rng, bits, 4);
+    for (int i = 0; i < COUNT; i++) {
+        mother[i] = f_rand(&rng, -2, 2);
+        father[i] = f_rand(&rng, -2, 2);
+        min[i] = f_rand(&rng, -1, 0);
+        max[i] = f_rand(&rng, 0, 1);
+        threshold[i] = (evlearn_gene) rng_uniform(&rng);
+        random[i] = (evlearn_gene) rng_uniform(&rng);
+        inputs[i] = f_rand(&rng, -2, 2);
+    }
+
+    CHECK(set_simd(EVLEARN_SIMD_SCALAR) == 0);
+    cross_genes(expected, mother, father, bits, COUNT);
+    expected_count = mutate_genes(expected, min, max, threshold, random, 0.3, COUNT);
+    truncate_genes(expected, min, max, COUNT);
+    expected_distance = squared_distance(mother, father, COUNT);
+    expected_dot = dot_genes(mother, inputs, COUNT);
+    CHECK(expected_count > 0 && expected_count < COUNT);
+
+    // Every instruction set supported by this CPU has to give the same genes and sums.
+    for (evlearn_simd simd = EVLEARN_SIMD_SSE2; simd <= best; simd++) {
+        CHECK(set_simd(simd) == 0);
+        cross_genes(actual, mother, father, bits, COUNT);
+        CHECK(mutate_genes(actual, min, max, threshold, random, 0.3, COUNT) == expected_count);
+        truncate_genes(actual, min, max, COUNT);
+        for (int i = 0; i < COUNT; i++) {
+            CHECK(actual[i] == expected[i]);
+        }
+        CHECK(squared_distance(mother, father, COUNT) == expected_distance);
+        CHECK(dot_genes(mother, inputs, COUNT) == expected_dot);
+    }
+    CHECK(set_simd(best) == 0);
+}
+
+static void test_apply()
+{
+    enum { ROWS = 3, COLS = 11, INDIVIDUALS = 2, FRAMES = 7 };
+    evlearn_simd best = get_simd();
+    evlearn_rng rng;
+    evlearn_gene weights[INDIVIDUALS * ROWS * COLS];
+    const evlearn_gene* chromosomes[INDIVIDUALS] = {weights, weights + ROWS * COLS};
+    double frames[INDIVIDUALS * FRAMES * COLS];
+    double single[ROWS], batch[INDIVIDUALS * FRAMES * ROWS], scalar[ROWS];
+    evlearn_activation activation[ROWS] = {
+        EVLEARN_ACTIVATION_TANH, EVLEARN_ACTIVATION_RELU, EVLEARN_ACTIVATION_SIGMOID
+    };
+    double min[ROWS] = {-0.5, 0, 0}, max[ROWS] = {0.5, 1, 0.9};
+
+    rng_seed(&rng, 4, 0, 0);
+    rng_fill_uniform_genes(&rng, weights, INDIVIDUALS * ROWS * COLS);
+    for (int i = 0; i < INDIVIDUALS * FRAMES * COLS; i++) {
+        frames[i] = f_rand(&rng, -2, 2);
+    }
+
+    for (evlearn_simd simd = EVLEARN_SIMD_SCALAR; simd <= best; simd++) {
+        CHECK(set_simd(simd) == 0);
+
+        // Plain dot products, the same on every instruction set, then the outputs of every frame
+        // against a naive loop.
+        evlearn_apply(weights, ROWS, COLS, frames, single, NULL, NULL, NULL);
+        if (simd == EVLEARN_SIMD_SCALAR) {
+            memcpy(scalar, single, sizeof(single));
+        }
+        CHECK(memcmp(single, scalar, sizeof(single)) == 0);
+        for (int r = 0; r < ROWS; r++) {
+            double expected = 0;
+
+            for (int c = 0; c < COLS; c++) {
+                expected += weights[r * COLS + c] * frames[c];
+            }
+            CHECK(fabs(single[r] - expected) < 1e-9);
+        }
+
+        evlearn_apply_batch(chromosomes, INDIVIDUALS, ROWS, COLS, frames, FRAMES,
+            FRAMES * COLS, batch, activation, min, max);
+        for (int i = 0; i < INDIVIDUALS; i++) {
+            for (int f = 0; f < FRAMES; f++) {
+                evlearn_apply(chromosomes[i], ROWS, COLS, frames + (i * FRAMES + f) * COLS, single,
+                    activation, min, max);
+                CHECK(memcmp(single, batch + (i * FRAMES + f) * ROWS, sizeof(single)) == 0);
+                CHECK(single[0] >= -0.5 && single[0] <= 0.5);
+                CHECK(single[1] >= 0 && single[2] > 0 && single[2] <= 0.9);
+            }
+        }
+
+        // Shared frames give both individuals the outputs of the first frames.
+        evlearn_apply_batch(chromosomes, INDIVIDUALS, ROWS, COLS, frames, FRAMES, 0, batch,
+            NULL, NULL, NULL);
+        evlearn_apply(chromosomes[1], ROWS, COLS, frames + 6 * COLS, single, NULL, NULL, NULL);
+        CHECK(memcmp(single, batch + (FRAMES + 6) * ROWS, sizeof(single)) == 0);
+    }
+    CHECK(set_simd(best) == 0);
+}
+
+static void test_sim()
+{
+    evlearn_sim_config config;
+    evlearn_sim* sim = NULL;
+    evlearn_ctx* ctx = create_ctx();
+    evlearn_gene driver[CHROM_ARRAY_SIZE * CHROM_SIZE] = {0};
+    evlearn_sim_result first, again;
+
+    sim_default_config(&config);
+    config.bundles = 0;
+    CHECK(create_sim(&config) == NULL);
+    sim_default_config(&config);
+    sim = create_sim(&config);
+    CHECK(sim != NULL);
+    CHECK(sim_episode(sim, driver, CHROM_ARRAY_SIZE, CHROM_SIZE - 1, &first) == 1);
+
+    // Steering away from the nearest barrier and a light throttle reach the end of the road.
+    for (int b = 0; b < CHROM_SIZE; b++) {
+        double side = (b - (CHROM_SIZE - 1) / 2.0) / ((CHROM_SIZE - 1) / 2.0);
+
+        driver[b] = (evlearn_gene) (1.5 * (side > 0 ? 1 - side : (side < 0 ? -1 - side : 0)));
+        driver[CHROM_SIZE + b] = (evlearn_gene) 0.3;
+    }
+    CHECK(sim_episode(sim, driver, CHROM_ARRAY_SIZE, CHROM_SIZE, &first) == 0);
+    CHECK(first.finished && first.distance >= config.road_length);
+    CHECK(fabs(first.fitness - first.distance * first.distance / first.time) < 1e-6);
+    CHECK(sim_episode(sim, driver, CHROM_ARRAY_SIZE, CHROM_SIZE, &again) == 0);
+    CHECK(memcmp(&first, &again, sizeof(first)) == 0);
+
+    // Steering towards it hits a barrier.
+    for (int b = 0; b < CHROM_SIZE; b++) {
+        driver[b] = -driver[b];
+    }
+    CHECK(sim_episode(sim, driver, CHROM_ARRAY_SIZE, CHROM_SIZE, &again) == 0);
+    CHECK(again.crashed && !again.finished && again.fitness < first.fitness);
+
+    // The threads of evaluate() share the simulator and get the fitness of a single episode.
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(evaluate(ctx, sim_fitness, sim, 4) == 0);
+    CHECK(sim_episode(sim, get_best_chromosome(ctx), CHROM_ARRAY_SIZE, CHROM_SIZE, &again) == 0);
+    CHECK(get_best(ctx).fitness == again.fitness);
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        double fitness = sim_fitness(get_chromosome(ctx, i), CHROM_ARRAY_SIZE, CHROM_SIZE, sim);
+
+        CHECK(fitness <= again.fitness);
+    }
+
+    destroy_ctx(ctx);
+    destroy_sim(sim);
+}
+
+static void test_cache()
+{
+    evlearn_ctx* ctx[2] = {create_ctx(), create_ctx()};
+    evlearn_cache_stats stats;
+    size_t indices[POPULATION_SIZE];
+
+    for (int i = 0; i < 2; i++) {
+        set_seed(ctx[i], 5);
+        CHECK(init(ctx[i], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    }
+    CHECK(set_cache(ctx[1], POPULATION_SIZE * 4) == 0);
+    for (int generation = 0; generation < 10; generation++) {
+        for (int i = 0; i < 2; i++) {
+            evaluate(ctx[i], sphere, NULL, 2);
+            compute_next_generation(ctx[i], 4, 0.05);
+        }
+    }
+
+    // The cached run breeds exactly the same population.
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        CHECK(get_chromosome(ctx[0], i)[0] == get_chromosome(ctx[1], i)[0]);
+    }
+    stats = get_cache_stats(ctx[1]);
+    CHECK(stats.hits >= 9);
+    CHECK(stats.hits + stats.misses == POPULATION_SIZE * 10);
+    CHECK(stats.size == POPULATION_SIZE * 4);
+    CHECK(stats.evictions == stats.misses - stats.size);
+
+    // At least the elite of the new generation is not handed out again.
+    CHECK(ask(ctx[1], indices, POPULATION_SIZE) < POPULATION_SIZE);
+
+    CHECK(set_cache(ctx[1], 0) == 0);
+    CHECK(get_cache_stats(ctx[1]).capacity == 0);
+
+    destroy_ctx(ctx[0]);
+    destroy_ctx(ctx[1]);
+}
+
+#define ARCHIVE_GENERATIONS 30
+#define ARCHIVE_SIZE (POPULATION_SIZE * (ARCHIVE_GENERATIONS + 1))
+#define NEIGHBOURS 5
+
+// Every chromosome evaluated with its fitness, in the order they are told.
+typedef struct evaluations {
+    size_t count;
+    evlearn_gene genes[ARCHIVE_SIZE][CHROM_ARRAY_SIZE * CHROM_SIZE];
+    double fitness[ARCHIVE_SIZE];
+} evaluations;
+
+static evaluations archive;
+
+// The sphere fitness keeping every evaluation in the evaluations of user_data.
+static double archived_sphere(
+    const evlearn_gene* chromosome, size_t chrom_array_size, size_t chrom_size, void* user_data)
+{
+    evaluations* done = user_data;
+    double fitness = sphere(chromosome, chrom_array_size, chrom_size, NULL);
+
+    memcpy(done->genes[done->count], chromosome, sizeof(done->genes[0]));
+    done->fitness[done->count] = fitness;
+    done->count++;
+    return fitness;
+}
+
+// The prediction of the surrogate, from every evaluation.
+static double brute_predict(const evaluations* done, const evlearn_gene* chromosome)
+{
+    double near[NEIGHBOURS];
+    double near_fitness[NEIGHBOURS];
+    size_t found = 0;
+    double weights = 0;
+    double sum = 0;
+
+    for (size_t e = 0; e < done->count; e++) {
+        double distance =
+            sqrt(squared_distance(chromosome, done->genes[e], CHROM_ARRAY_SIZE * CHROM_SIZE));
+        size_t i = found < NEIGHBOURS ? found : NEIGHBOURS - 1;
+
+        if (found == NEIGHBOURS && distance >= near[NEIGHBOURS - 1])
+            continue;
+        for (; i > 0 && near[i - 1] > distance; i--) {
+            near[i] = near[i - 1];
+            near_fitness[i] = near_fitness[i - 1];
+        }
+        near[i] = distance;
+        near_fitness[i] = done->fitness[e];
+        found += found < NEIGHBOURS;
+    }
+    if (near[0] == 0)
+        return near_fitness[0];
+    for (size_t i = 0; i < NEIGHBOURS; i++) {
+        weights += 1 / near[i];
+        sum += near_fitness[i] / near[i];
+    }
+    return sum / weights;
+}
+
+static void test_surrogate()
+{
+    evlearn_ctx* ctx[3] = {create_ctx(), create_ctx(), create_ctx()};
+    evlearn_surrogate_stats stats;
+    double fitness = 0;
+
+    CHECK(set_surrogate(ctx[0], ARCHIVE_SIZE, NEIGHBOURS, 4) == 1);
+    for (int p = 0; p < 3; p++) {
+        set_seed(ctx[p], 9);
+        CHECK(init(ctx[p], POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    }
+    CHECK(set_surrogate(ctx[0], ARCHIVE_SIZE, ARCHIVE_SIZE + 1, 4) == 1);
+    CHECK(set_surrogate(ctx[0], ARCHIVE_SIZE, NEIGHBOURS, 4) == 0);
+    CHECK(set_surrogate(ctx[1], ARCHIVE_SIZE, NEIGHBOURS, 1) == 0);
+    CHECK(predict_fitness(ctx[0], get_chromosome(ctx[0], 0), &fitness) == 1);
+
+    archive.count = 0;
+    CHECK(evaluate(ctx[0], archived_sphere, &archive, 1) == 0);
+    for (int p = 1; p < 3; p++) {
+        CHECK(evaluate(ctx[p], sphere, NULL, 1) == 0);
+    }
+    for (int g = 0; g < ARCHIVE_GENERATIONS; g++) {
+        compute_next_generation(ctx[0], 4, 0.1);
+        CHECK(evaluate(ctx[0], archived_sphere, &archive, 1) == 0);
+        for (int p = 1; p < 3; p++) {
+            compute_next_generation(ctx[p], 4, 0.1);
+            CHECK(evaluate(ctx[p], sphere, NULL, 1) == 0);
+        }
+    }
+
+    // Without oversampling the surrogate only archives, the run is the same.
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        CHECK(memcmp(get_chromosome(ctx[1], i), get_chromosome(ctx[2], i),
+            CHROM_ARRAY_SIZE * CHROM_SIZE * sizeof(evlearn_gene)) == 0);
+    }
+    CHECK(get_surrogate_stats(ctx[1]).screened == 0);
+
+    // The index finds the same neighbours as comparing with every evaluation.
+    stats = get_surrogate_stats(ctx[0]);
+    CHECK(stats.size == ARCHIVE_SIZE && archive.count == ARCHIVE_SIZE);
+    CHECK(stats.screened == (POPULATION_SIZE - 1) * 3 * ARCHIVE_GENERATIONS);
+    CHECK(stats.rebuilds > 0);
+    compute_next_generation(ctx[0], 4, 0.1);
+    stats = get_surrogate_stats(ctx[0]);
+    for (size_t i = 0; i < POPULATION_SIZE; i++) {
+        double expected = brute_predict(&archive, get_chromosome(ctx[0], i));
+
+        CHECK(predict_fitness(ctx[0], get_chromosome(ctx[0], i), &fitness) == 0);
+        CHECK(fabs(fitness - expected) <= 1e-9 * fabs(expected));
+    }
+    CHECK(predict_fitness(ctx[0], archive.genes[7], &fitness) == 0);
+    CHECK(fitness == archive.fitness[7]);
+    CHECK(get_surrogate_stats(ctx[0]).distances - stats.distances <
+        (POPULATION_SIZE + 1) * ARCHIVE_SIZE / 4);
+
+    CHECK(set_surrogate(ctx[0], 0, 0, 0) == 0);
+    CHECK(get_surrogate_stats(ctx[0]).capacity == 0);
+
+    for (int p = 0; p < 3; p++) {
+        destroy_ctx(ctx[p]);
+    }
+}
+
+static double run_engine(evlearn_ctx* ctx, int generations)
+{
+    for (int g = 0; g < generations; g++) {
+        compute_next_generation(ctx, 4, 0.1);
+        CHECK(evaluate(ctx, sphere, NULL, 1) == 0);
+    }
+    return get_best(ctx).fitness;
+}
+
+static void test_engines()
+{
+    evlearn_engine engines[] = {EVLEARN_ENGINE_GA, EVLEARN_ENGINE_DE, EVLEARN_ENGINE_CMAES};
+    double steps[] = {0, 0.5, 0.3};
+    double start[3];
+    double best[3];
+    double invalid = -1;
+    const char* path = "evlearn_test_engine.ckpt";
+    const char* damaged = "evlearn_test_engine_damaged.ckpt";
+    evlearn_ctx* ctx = NULL;
+
+    for (int e = 0; e < 3; e++) {
+        evlearn_ctx* run = create_ctx();
+        evlearn_ctx* twin = create_ctx();
+        evlearn_ctx* resumed = create_ctx();
+
+        CHECK(set_engine(run, engines[e], steps[e], 0.9) == 1);
+        set_seed(run, 5);
+        set_seed(twin, 5);
+        CHECK(init(run, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        CHECK(init(twin, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        CHECK(set_engine(run, engines[e], steps[e], 0.9) == 0);
+        CHECK(set_engine(twin, engines[e], steps[e], 0.9) == 0);
+        CHECK(get_engine(run) == engines[e]);
+        CHECK(evaluate(run, sphere, NULL, 1) == 0);
+        CHECK(evaluate(twin, sphere, NULL, 1) == 0);
+        start[e] = get_best(run).fitness;
+        best[e] = run_engine(run, 20);
+        run_engine(twin, 20);
+
+        // A checkpoint keeps the state of the engine, the resumed run goes on the same way.
+        CHECK(save_checkpoint(run, path) == 0);
+        CHECK(load_checkpoint(resumed, path) == 0);
+        CHECK(get_engine(resumed) == engines[e]);
+
+        // A state with CR or sigma, its second value, out of range is rejected before anything
+        // is loaded, so the resumed run goes on as if it had not been tried.
+        if (engines[e] != EVLEARN_ENGINE_GA) {
+            CHECK(copy_damaged(path, damaged, -1,
+                (long) header_u64(path, HEADER_ENGINE_OFFSET) + (long) sizeof(double),
+                &invalid, sizeof(invalid)) == 0);
+            CHECK(load_checkpoint(resumed, damaged) == 1);
+            CHECK(get_engine(resumed) == engines[e]);
+            remove(damaged);
+        }
+        best[e] = run_engine(run, 20);
+        CHECK(run_engine(resumed, 20) == best[e]);
+        CHECK(run_engine(twin, 20) == best[e]);
+        for (size_t i = 0; i < POPULATION_SIZE; i++) {
+            CHECK(memcmp(get_chromosome(run, i), get_chromosome(resumed, i),
+                CHROM_ARRAY_SIZE * CHROM_SIZE * sizeof(evlearn_gene)) == 0);
+            CHECK(memcmp(get_chromosome(run, i), get_chromosome(twin, i),
+                CHROM_ARRAY_SIZE * CHROM_SIZE * sizeof(evlearn_gene)) == 0);
+        }
+
+        CHECK(init(run, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        CHECK(get_engine(run) == EVLEARN_ENGINE_GA);
+        remove(path);
+        destroy_ctx(resumed);
+        destroy_ctx(twin);
+        destroy_ctx(run);
+    }
+    // Every engine improves on the random population, and CMA-ES adapts to the sphere faster than
+    // the genetic algorithm.
+    for (int e = 0; e < 3; e++) {
+        CHECK(best[e] > start[e]);
+    }
+    CHECK(best[2] > best[0]);
+
+    ctx = create_ctx();
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(set_engine(ctx, EVLEARN_ENGINE_DE, 0, 0.9) == 1);
+    CHECK(set_engine(ctx, EVLEARN_ENGINE_DE, 0.5, 1.5) == 1);
+    CHECK(set_engine(ctx, EVLEARN_ENGINE_CMAES, -1, 0) == 1);
+    CHECK(set_engine(ctx, (evlearn_engine) 7, 0.5, 0) == 1);
+    CHECK(get_engine(ctx) == EVLEARN_ENGINE_GA);
+    CHECK(init(ctx, 3, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    CHECK(set_engine(ctx, EVLEARN_ENGINE_DE, 0.5, 0.9) == 1);
+    destroy_ctx(ctx);
+}
+
+static void test_selection()
+{
+    evlearn_selection methods[] = {
+        EVLEARN_SELECT_TOURNAMENT, 
+        EVLEARN_SELECT_TOURNAMENT_REPLACEMENT, 
+        EVLEARN_SELECT_RANK, 
+        EVLEARN_SELECT_SUS
+    };
+    evlearn_ctx* ctx = create_ctx();
+    const evlearn_gene* best = NULL;
+
+    for (int m = 0; m < 4; m++) {
+        double first = 0;
+
+        CHECK(set_selection(ctx, methods[m], 1.8) == 0);
+        CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+        evaluate(ctx, sphere, NULL, 1);
+        first = get_best(ctx).fitness;
+        for (int generation = 0; generation < 30; generation++) {
+            // A tournament bigger than the population must not hang.
+            compute_next_generation(ctx, POPULATION_SIZE * 2, 0.1);
+            evaluate(ctx, sphere, NULL, 1);
+        }
+        CHECK(get_best(ctx).fitness > first);
+    }
+
+    // Tournaments of the whole population without replacement always select the best.
+    CHECK(set_selection(ctx, EVLEARN_SELECT_TOURNAMENT, 2) == 0);
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    evaluate(ctx, sphere, NULL, 1);
+    compute_next_generation(ctx, POPULATION_SIZE, 0);
+    best = get_chromosome(ctx, 0);
+    for (size_t i = 1; i < POPULATION_SIZE; i++) {
+        for (size_t j = 0; j < CHROM_ARRAY_SIZE * CHROM_SIZE; j++) {
+            CHECK(get_chromosome(ctx, i)[j] == best[j]);
+        }
+    }
+
+    CHECK(set_selection(ctx, EVLEARN_SELECT_RANK, 3) == 1);
+    destroy_ctx(ctx);
+}
+
+static void test_ranking()
+{
+    evlearn_ctx* ctx = create_ctx();
+    const Individual* top[POPULATION_SIZE];
+    size_t indices[3] = {7, 20, 40};
+    double fitness[3] = {1000, 2000, -1000};
+    size_t count = 0;
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    evaluate(ctx, sphere, NULL, 1);
+
+    count = get_top(ctx, top, POPULATION_SIZE * 2);
+    CHECK(count == POPULATION_SIZE);
+    CHECK(top[0]->chromosome == get_best_chromosome(ctx));
+    CHECK(top[0]->fitness == get_best(ctx).fitness);
+    for (size_t i = 1; i < count; i++) {
+        CHECK(top[i - 1]->fitness >= top[i]->fitness);
+    }
+    CHECK(get_median_fitness(ctx) == (top[31]->fitness + top[32]->fitness) / 2);
+
+    // Told fitness moves the best and the ranking, also when the best gets worse.
+    tell(ctx, indices, fitness, 2);
+    CHECK(get_best_chromosome(ctx) == get_chromosome(ctx, 20));
+    CHECK(get_top(ctx, top, 2) == 2);
+    CHECK(top[0]->chromosome == get_chromosome(ctx, 20));
+    CHECK(top[1]->chromosome == get_chromosome(ctx, 7));
+    tell(ctx, indices + 1, fitness + 2, 1);
+    CHECK(get_best_chromosome(ctx) == get_chromosome(ctx, 7));
+
+    compute_next_generation(ctx, 4, 0.1);
+    CHECK(get_best(ctx).fitness == 0);
+
+    destroy_ctx(ctx);
+}
+
+static void test_stats()
+{
+    evlearn_ctx* ctx = create_ctx();
+    const char* path = "evlearn_test.json";
+    evlearn_stats stats;
+#ifdef EVLEARN_STATS
+    char text[64] = {0};
+    FILE* file = NULL;
+#endif
+
+    CHECK(init(ctx, POPULATION_SIZE, CHROM_ARRAY_SIZE, CHROM_SIZE, NULL, NULL) == 0);
+    reset_stats(ctx);
+#ifdef EVLEARN_STATS
+    CHECK(open_trace(ctx, path) == 0);
+#endif
+    for (int generation = 0; generation < 4; generation++) {
+        evaluate(ctx, sphere, NULL, 1);
+        compute_next_generation(ctx, 4, 0.2);
+    }
+    CHECK(close_trace(ctx) == 0);
+    stats = get_stats(ctx);
+
+#ifdef EVLEARN_STATS
+    CHECK(stats.generations == 4);
+    CHECK(stats.calls[EVLEARN_TIMER_SELECT] == 4);
+    CHECK(stats.calls[EVLEARN_TIMER_EVALUATE] == 4);
+    CHECK(stats.ticks[EVLEARN_TIMER_MUTATE] > 0);
+    CHECK(stats.ns_per_tick > 0);
+    CHECK(stats.selection_draws == 4 * 4 * POPULATION_SIZE);
+    CHECK(stats.genes_mutated > 0);
+    CHECK(stats.rng_draws > stats.selection_draws);
+
+    file = fopen(path, "r");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        CHECK(fread(text, 1, sizeof(text) - 1, file) > 0);
+        fclose(file);
+    }
+    CHECK(strstr(text, "\"name\":\"evaluate\"") != NULL);
+    remove(path);
+#else
+    CHECK(stats.generations == 0);
+    CHECK(open_trace(ctx, path) == 1);
+#endif
+
+    destroy_ctx(ctx);
+}
+
+int main()
+{
+    test_rng();
+    test_seed_reproducible();
+    test_ask_tell();
+    test_evaluate_threads();
+    test_steady_state();
+    test_racing();
+    test_farm();
+    test_islands();
+    test_contexts();
+    test_checkpoint();
+    test_checkpoint_formats();
+    test_text_export();
+    test_telemetry();
+    test_simd_kernels();
+    test_apply();
+    test_sim();
+    test_cache();
+    test_surrogate();
+    test_engines();
+    test_selection();
+    test_ranking();
+    test_stats();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}